@@ -20,61 +20,178 @@
  *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-static uint32_t crc32c_table [256];
+/*
+ * CRC32C (Castagnoli) for the file system drivers. This file is included by
+ * each driver that needs it, after fsw_core.h, so everything in it is static.
+ *
+ * fsw_crc32c updates a raw CRC without the initial and final inversion, like
+ * the Linux kernel's crc32c(); the GRUB-style grub_getcrc32c inverts on both
+ * sides. The work is done by the fastest engine the CPU supports, chosen by
+ * init_crc32c_table: the SSE4.2 crc32 instruction on x86-64, the ARMv8 CRC32
+ * instructions on AArch64, and slice-by-8 tables everywhere else.
+ */
 
-static void
-init_crc32c_table (void)
+typedef fsw_u32 (*fsw_crc32c_engine_t)(fsw_u32 crc, const fsw_u8 *data, fsw_u32 len);
+
+static fsw_u32 crc32c_table [8][256];
+static fsw_crc32c_engine_t fsw_crc32c_engine;
+
+/* Reflected form of the polynomial 0x1edc6f41 */
+#define FSW_CRC32C_POLY 0x82f63b78
+
+/*
+ * One byte at a time, for short tails and as a reference for the others.
+ */
+
+static fsw_u32
+fsw_crc32c_bytewise (fsw_u32 crc, const fsw_u8 *data, fsw_u32 len)
 {
-  auto uint32_t reflect (uint32_t ref, int len);
-  uint32_t reflect (uint32_t ref, int len)
-    {
-      uint32_t result = 0;
-      int i;
+  while (len--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xFF];
+  return crc;
+}
 
-      for (i = 1; i <= len; i++)
-        {
-          if (ref & 1)
-            result |= 1 << (len - i);
-          ref >>= 1;
-        }
+/*
+ * Slice-by-8: eight table lookups per 64 bits of input.
+ */
 
-      return result;
+static fsw_u32
+fsw_crc32c_sliced (fsw_u32 crc, const fsw_u8 *data, fsw_u32 len)
+{
+  fsw_u32 lo, hi;
+
+  while (len >= 8)
+    {
+      lo = crc ^ ((fsw_u32)data[0] | (fsw_u32)data[1] << 8 |
+                  (fsw_u32)data[2] << 16 | (fsw_u32)data[3] << 24);
+      hi = (fsw_u32)data[4] | (fsw_u32)data[5] << 8 |
+           (fsw_u32)data[6] << 16 | (fsw_u32)data[7] << 24;
+      crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+            crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+            crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+      data += 8;
+      len -= 8;
     }
+  return fsw_crc32c_bytewise (crc, data, len);
+}
 
-  static int crc32c_table_inited;
-  if(crc32c_table_inited)
-	  return;
-  crc32c_table_inited = 1;
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FSW_CRC32C_HW 1
+#define FSW_CRC32C_HW_NAME "sse4.2"
 
-  uint32_t polynomial = 0x1edc6f41;
-  int i, j;
+static int
+fsw_crc32c_hw_present (void)
+{
+  fsw_u32 eax, ebx, ecx, edx;
+
+  __asm__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1), "c" (0));
+  return (ecx >> 20) & 1;
+}
 
-  for(i = 0; i < 256; i++)
+static fsw_u32
+fsw_crc32c_hw (fsw_u32 crc, const fsw_u8 *data, fsw_u32 len)
+{
+  fsw_u64 crc64 = crc;
+
+  while (len && ((__UINTPTR_TYPE__)data & 7))
     {
-      crc32c_table[i] = reflect(i, 8) << 24;
-      for (j = 0; j < 8; j++)
-        crc32c_table[i] = (crc32c_table[i] << 1) ^
-            (crc32c_table[i] & (1 << 31) ? polynomial : 0);
-      crc32c_table[i] = reflect(crc32c_table[i], 32);
+      __asm__ ("crc32b %1, %k0" : "+r" (crc64) : "rm" (*data));
+      data++;
+      len--;
+    }
+  while (len >= 8)
+    {
+      __asm__ ("crc32q %1, %0" : "+r" (crc64) : "rm" (*(const fsw_u64 *)data));
+      data += 8;
+      len -= 8;
+    }
+  while (len--)
+    {
+      __asm__ ("crc32b %1, %k0" : "+r" (crc64) : "rm" (*data));
+      data++;
     }
+  return (fsw_u32)crc64;
 }
 
-uint32_t
-grub_getcrc32c (uint32_t crc, const void *buf, int size)
-{
-  int i;
-  const uint8_t *data = buf;
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define FSW_CRC32C_HW 1
+#define FSW_CRC32C_HW_NAME "armv8-crc"
 
-  if (! crc32c_table[1])
-    init_crc32c_table ();
+static int
+fsw_crc32c_hw_present (void)
+{
+  fsw_u64 isar0;
 
-  crc^= 0xffffffff;
+  /* ID_AA64ISAR0_EL1.CRC32, bits 19:16 */
+  __asm__ ("mrs %0, ID_AA64ISAR0_EL1" : "=r" (isar0));
+  return ((isar0 >> 16) & 0xF) != 0;
+}
 
-  for (i = 0; i < size; i++)
+static fsw_u32
+fsw_crc32c_hw (fsw_u32 crc, const fsw_u8 *data, fsw_u32 len)
+{
+  while (len && ((__UINTPTR_TYPE__)data & 7))
+    {
+      __asm__ (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r" (crc) : "r" ((fsw_u32)*data));
+      data++;
+      len--;
+    }
+  while (len >= 8)
+    {
+      __asm__ (".arch_extension crc\n\tcrc32cx %w0, %w0, %x1" : "+r" (crc) : "r" (*(const fsw_u64 *)data));
+      data += 8;
+      len -= 8;
+    }
+  while (len--)
     {
-      crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
+      __asm__ (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1" : "+r" (crc) : "r" ((fsw_u32)*data));
       data++;
     }
+  return crc;
+}
 
-  return crc ^ 0xffffffff;
+#endif
+
+static void
+init_crc32c_table (void)
+{
+  fsw_u32 crc;
+  int i, j;
+
+  if (fsw_crc32c_engine)
+    return;
+
+  for (i = 0; i < 256; i++)
+    {
+      crc = i;
+      for (j = 0; j < 8; j++)
+        crc = (crc >> 1) ^ ((crc & 1) ? FSW_CRC32C_POLY : 0);
+      crc32c_table[0][i] = crc;
+    }
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^
+                           crc32c_table[0][crc32c_table[j - 1][i] & 0xFF];
+
+  fsw_crc32c_engine = fsw_crc32c_sliced;
+#ifdef FSW_CRC32C_HW
+  if (fsw_crc32c_hw_present ())
+    fsw_crc32c_engine = fsw_crc32c_hw;
+#endif
+}
+
+static fsw_u32
+fsw_crc32c (fsw_u32 crc, const void *buf, fsw_u32 len)
+{
+  if (! fsw_crc32c_engine)
+    init_crc32c_table ();
+
+  return fsw_crc32c_engine (crc, buf, len);
+}
+
+static __inline fsw_u32
+grub_getcrc32c (fsw_u32 crc, const void *buf, int size)
+{
+  return ~fsw_crc32c (~crc, buf, size);
 }
@@ -154,5 +154,12 @@
  * Initializes a block of memory with zeros. Does not return a status.
  */
 
+/**
+ * \def fsw_ticks()
+ * Returns a 64-bit counter that increases steadily with time, used for the
+ * volume statistics. The unit is host-specific; a host without a suitable
+ * clock may return 0.
+ */
+
 
 #endif
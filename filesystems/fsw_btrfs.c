@@ -62,6 +62,14 @@
 #define BTRFS_DEFAULT_BLOCK_SIZE 4096
 #define BTRFS_INITIAL_BCACHE_SIZE 1024
 #define GRUB_BTRFS_SIGNATURE "_BHRfS_M"
+#define BTRFS_CSUM_TYPE_CRC32 0
+#define BTRFS_SUPERBLOCK_SIZE 4096
+/* tree nodes whose checksum was found good, direct mapped by address */
+#define BTRFS_CSUM_VERIFIED_SIZE 64
+/* compressed extents kept decompressed, replaced least recently used first */
+#define BTRFS_DECOMP_CACHE_SIZE 8
+/* btrfs compresses at most this much file data into one extent */
+#define BTRFS_MAX_UNCOMPRESSED (128 * 1024)
 
 /* From http://www.oberhumer.com/opensource/lzo/lzofaq.php
  * LZO will expand incompressible data by a little amount. I still haven't
@@ -106,7 +114,11 @@ struct btrfs_superblock
     uint32_t sectorsize;
     uint32_t nodesize;
 
-    uint8_t dummy3[0x31];
+    uint8_t dummy3[0x2c];
+    uint16_t csum_type;
+    uint8_t root_level;
+    uint8_t chunk_root_level;
+    uint8_t log_root_level;
     struct btrfs_device this_device;
     char label[0x100];
     uint8_t dummy4[0x100];
@@ -128,6 +140,16 @@ struct fsw_btrfs_device_desc
     uint64_t id;
 };
 
+struct fsw_btrfs_decomp_entry
+{
+    uint64_t tree;
+    uint64_t ino;
+    uint64_t extstart;
+    uint32_t size;      /* bytes of file data, rounded up to sectors */
+    uint32_t lru;       /* decomp_clock at the last use */
+    uint8_t *data;      /* NULL if the entry is unused */
+};
+
 struct fsw_btrfs_volume
 {
     struct fsw_volume g;            //!< Generic volume structure
@@ -143,8 +165,14 @@ struct fsw_btrfs_volume
     unsigned num_devices;
     unsigned sectorshift;
     unsigned sectorsize;
+    unsigned nodesize;
     int is_master;
 
+    /* checksum verification, see FSW_MOUNT_VERIFY_CHECKSUMS */
+    int verify_csum;
+    uint8_t *csum_node;  /* nodesize buffer for checking a tree node */
+    uint64_t csum_verified[BTRFS_CSUM_VERIFIED_SIZE];  /* addr | 1 */
+
     struct fsw_btrfs_device_desc *devices_attached;
     unsigned n_devices_attached;
     unsigned n_devices_allocated;
@@ -155,7 +183,12 @@ struct fsw_btrfs_volume
     uint64_t extino;
     uint64_t exttree;
     uint32_t extsize;
+    uint32_t extalloc;  /* size of the extent buffer, only grows */
     struct btrfs_extent_data *extent;
+
+    /* Decompressed extents.  */
+    struct fsw_btrfs_decomp_entry decomp[BTRFS_DECOMP_CACHE_SIZE];
+    uint32_t decomp_clock;
 };
 
 enum
@@ -371,6 +404,10 @@ static fsw_status_t btrfs_set_superblock_info(struct fsw_btrfs_volume *vol, stru
             break;
         }
     }
+    vol->nodesize = fsw_u32_le_swap(sb->nodesize);
+    /* other checksum types than crc32c are not checked */
+    vol->verify_csum = (vol->g.mount_flags & FSW_MOUNT_VERIFY_CHECKSUMS) &&
+        fsw_u16_le_swap(sb->csum_type) == BTRFS_CSUM_TYPE_CRC32;
     if(fsw_u64_le_swap(sb->num_devices) > BTRFS_MAX_NUM_DEVICES)
         vol->num_devices = BTRFS_MAX_NUM_DEVICES;
     else
@@ -389,11 +426,24 @@ static uint64_t superblock_pos[4] = {
 static fsw_status_t fsw_btrfs_read_logical(struct fsw_btrfs_volume *vol,
         uint64_t addr, void *buf, fsw_size_t size, int rdepth, int cache_level);
 
+/* the checksum covers the superblock after the checksum field */
+static int btrfs_superblock_csum_ok (uint8_t *buffer)
+{
+    struct btrfs_superblock *sb = (struct btrfs_superblock *)buffer;
+
+    if (fsw_u16_le_swap (sb->csum_type) != BTRFS_CSUM_TYPE_CRC32)
+        return 1;
+    return grub_getcrc32c (0, buffer + sizeof (btrfs_checksum_t),
+            BTRFS_SUPERBLOCK_SIZE - sizeof (btrfs_checksum_t))
+        == fsw_u32_le_swap (*(uint32_t *)sb->checksum);
+}
+
 static fsw_status_t btrfs_read_superblock (struct fsw_volume *vol, struct btrfs_superblock *sb_out)
 {
     unsigned i;
     uint64_t total_blocks = 1024;
     fsw_status_t err = FSW_SUCCESS;
+    int found = 0, bad_csum = 0;
 
     fsw_set_blocksize(vol, BTRFS_DEFAULT_BLOCK_SIZE, BTRFS_DEFAULT_BLOCK_SIZE);
     for (i = 0; i < 4; i++)
@@ -418,16 +468,24 @@ static fsw_status_t btrfs_read_superblock (struct fsw_volume *vol, struct btrfs_
             fsw_block_release(vol, superblock_pos[i], buffer);
             break;
         }
-        if (i == 0 || fsw_u64_le_swap (sb->generation) > fsw_u64_le_swap (sb_out->generation))
+        /* skip copies with a bad checksum, the others may still be good */
+        if ((vol->mount_flags & FSW_MOUNT_VERIFY_CHECKSUMS) && !btrfs_superblock_csum_ok (buffer))
+        {
+            fsw_block_release(vol, superblock_pos[i], buffer);
+            bad_csum = 1;
+            continue;
+        }
+        if (!found || fsw_u64_le_swap (sb->generation) > fsw_u64_le_swap (sb_out->generation))
         {
             fsw_memcpy (sb_out, sb, sizeof (*sb));
             total_blocks = fsw_u64_le_swap (sb->this_device.size) >> 12;
         }
+        found = 1;
         fsw_block_release(vol, superblock_pos[i], buffer);
     }
 
-    if ((err == FSW_UNSUPPORTED || !err) && i == 0)
-        return FSW_UNSUPPORTED;
+    if ((err == FSW_UNSUPPORTED || !err) && !found)
+        return bad_csum ? FSW_VOLUME_CORRUPTED : FSW_UNSUPPORTED;
 
     if (err == FSW_UNSUPPORTED)
         err = FSW_SUCCESS;
@@ -486,6 +544,47 @@ static fsw_status_t save_ref (struct fsw_btrfs_leaf_descriptor *desc,
     return FSW_SUCCESS;
 }
 
+/*
+ * Check the checksum of a tree node, which covers the whole node after the
+ * checksum field. Nodes are read in pieces, so the node is read once more as
+ * a whole; nodes found good are remembered so that this is not repeated.
+ */
+static fsw_status_t fsw_btrfs_verify_node (struct fsw_btrfs_volume *vol,
+        uint64_t addr, int rdepth, int cache_level)
+{
+    fsw_status_t err;
+    uint64_t *verified;
+
+    if (!vol->verify_csum)
+        return FSW_SUCCESS;
+
+    verified = &vol->csum_verified[(addr >> vol->sectorshift) % BTRFS_CSUM_VERIFIED_SIZE];
+    if (*verified == (addr | 1))
+        return FSW_SUCCESS;
+
+    if (vol->nodesize < sizeof (struct btrfs_header) || vol->nodesize > 0x10000)
+        return FSW_VOLUME_CORRUPTED;
+    if (!vol->csum_node)
+    {
+        vol->csum_node = AllocatePool (vol->nodesize);
+        if (!vol->csum_node)
+            return FSW_OUT_OF_MEMORY;
+    }
+    err = fsw_btrfs_read_logical (vol, addr, vol->csum_node, vol->nodesize,
+            rdepth, cache_level);
+    if (err)
+        return err;
+    if (grub_getcrc32c (0, vol->csum_node + sizeof (btrfs_checksum_t),
+                vol->nodesize - sizeof (btrfs_checksum_t))
+            != fsw_u32_le_swap (*(uint32_t *)vol->csum_node))
+    {
+        DPRINT (L"btrfs: bad checksum in tree node %lx\n", addr);
+        return FSW_VOLUME_CORRUPTED;
+    }
+    *verified = addr | 1;
+    return FSW_SUCCESS;
+}
+
 static int next (struct fsw_btrfs_volume *vol,
         struct fsw_btrfs_leaf_descriptor *desc,
         uint64_t * outaddr, fsw_size_t * outsize,
@@ -517,6 +616,10 @@ static int next (struct fsw_btrfs_volume *vol,
         if (err)
             return -err;
 
+        err = fsw_btrfs_verify_node (vol, fsw_u64_le_swap (node.addr), 0, 1);
+        if (err)
+            return -err;
+
         err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (node.addr),
                 &head, sizeof (head), 0, 1);
         if (err)
@@ -576,6 +679,9 @@ static fsw_status_t lower_bound (struct fsw_btrfs_volume *vol,
 
 reiter:
         depth++;
+        err = fsw_btrfs_verify_node (vol, addr, rdepth + 1, depth2cache(rdepth));
+        if (err)
+            return err;
         /* FIXME: preread few nodes into buffer. */
         err = fsw_btrfs_read_logical (vol, addr, &head, sizeof (head),
                 rdepth + 1, depth2cache(rdepth));
@@ -741,68 +847,92 @@ find_device (struct fsw_btrfs_volume *vol, uint64_t id, int do_rescan) {
     return NULL;
 }
 
+/*
+ * Find the chunk item that maps a logical address, first in the bootstrap mapping
+ * of the superblock, then in the chunk tree. *challoc tells whether the item was
+ * allocated and must be freed by the caller.
+ */
+static fsw_status_t fsw_btrfs_find_chunk (struct fsw_btrfs_volume *vol, uint64_t addr,
+        uint64_t *chstart, struct btrfs_chunk_item **chunk_out, int *challoc,
+        int rdepth, int cache_level)
+{
+    uint8_t *ptr;
+    struct btrfs_key *key;
+    struct btrfs_chunk_item *chunk;
+    fsw_status_t err;
+    struct btrfs_key key_out;
+    struct btrfs_key key_in;
+    fsw_size_t chsize;
+    uint64_t chaddr;
+
+    *challoc = 0;
+    for (ptr = vol->bootstrap_mapping; ptr < vol->bootstrap_mapping + sizeof (vol->bootstrap_mapping) - sizeof (struct btrfs_key);)
+    {
+        key = (struct btrfs_key *) ptr;
+        if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+            break;
+        chunk = (struct btrfs_chunk_item *) (key + 1);
+        if (fsw_u64_le_swap (key->offset) <= addr
+                && addr < fsw_u64_le_swap (key->offset)
+                + fsw_u64_le_swap (chunk->size))
+        {
+            *chstart = fsw_u64_le_swap (key->offset);
+            *chunk_out = chunk;
+            return FSW_SUCCESS;
+        }
+        ptr += sizeof (*key) + sizeof (*chunk)
+            + sizeof (struct btrfs_chunk_stripe)
+            * fsw_u16_le_swap (chunk->nstripes);
+    }
+
+    key_in.object_id = fsw_u64_le_swap (GRUB_BTRFS_OBJECT_ID_CHUNK);
+    key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+    key_in.offset = fsw_u64_le_swap (addr);
+    err = lower_bound (vol, &key_in, &key_out, vol->chunk_tree, &chaddr, &chsize, NULL, rdepth);
+    if (err)
+        return err;
+    key = &key_out;
+    if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK
+            || !(fsw_u64_le_swap (key->offset) <= addr))
+    {
+        return FSW_VOLUME_CORRUPTED;
+    }
+    // "couldn't find the chunk descriptor");
+
+    chunk = AllocatePool (chsize);
+    if (!chunk) {
+        return FSW_OUT_OF_MEMORY;
+    }
+
+    err = fsw_btrfs_read_logical (vol, chaddr, chunk, chsize, rdepth, cache_level < 5 ? cache_level+1 : 5);
+    if (err)
+    {
+        if(chunk)
+            FreePool (chunk);
+        return err;
+    }
+
+    *chstart = fsw_u64_le_swap (key->offset);
+    *chunk_out = chunk;
+    *challoc = 1;
+    return FSW_SUCCESS;
+}
+
 static fsw_status_t fsw_btrfs_read_logical (struct fsw_btrfs_volume *vol, uint64_t addr,
         void *buf, fsw_size_t size, int rdepth, int cache_level)
 {
     while (size > 0)
     {
-        uint8_t *ptr;
-        struct btrfs_key *key;
         struct btrfs_chunk_item *chunk;
         uint64_t csize;
+        uint64_t chstart;
         fsw_status_t err = 0;
-        struct btrfs_key key_out;
         int challoc = 0;
-        struct btrfs_key key_in;
-        fsw_size_t chsize;
-        uint64_t chaddr;
 
-        for (ptr = vol->bootstrap_mapping; ptr < vol->bootstrap_mapping + sizeof (vol->bootstrap_mapping) - sizeof (struct btrfs_key);)
-        {
-            key = (struct btrfs_key *) ptr;
-            if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
-                break;
-            chunk = (struct btrfs_chunk_item *) (key + 1);
-            if (fsw_u64_le_swap (key->offset) <= addr
-                    && addr < fsw_u64_le_swap (key->offset)
-                    + fsw_u64_le_swap (chunk->size))
-            {
-                goto chunk_found;
-            }
-            ptr += sizeof (*key) + sizeof (*chunk)
-                + sizeof (struct btrfs_chunk_stripe)
-                * fsw_u16_le_swap (chunk->nstripes);
-        }
-
-        key_in.object_id = fsw_u64_le_swap (GRUB_BTRFS_OBJECT_ID_CHUNK);
-        key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
-        key_in.offset = fsw_u64_le_swap (addr);
-        err = lower_bound (vol, &key_in, &key_out, vol->chunk_tree, &chaddr, &chsize, NULL, rdepth);
+        err = fsw_btrfs_find_chunk (vol, addr, &chstart, &chunk, &challoc, rdepth, cache_level);
         if (err)
             return err;
-        key = &key_out;
-        if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK
-                || !(fsw_u64_le_swap (key->offset) <= addr))
-        {
-            return FSW_VOLUME_CORRUPTED;
-        }
-        // "couldn't find the chunk descriptor");
-
-        chunk = AllocatePool (chsize);
-        if (!chunk) {
-            return FSW_OUT_OF_MEMORY;
-        }
-
-        challoc = 1;
-        err = fsw_btrfs_read_logical (vol, chaddr, chunk, chsize, rdepth, cache_level < 5 ? cache_level+1 : 5);
-        if (err)
-        {
-            if(chunk)
-                FreePool (chunk);
-            return err;
-        }
 
-chunk_found:
         {
 #ifdef __MAKEWITH_GNUEFI
 #define UINTREM UINTN
@@ -813,7 +943,7 @@ chunk_found:
 #endif
             UINTREM stripen;
             UINTREM stripe_offset;
-            uint64_t off = addr - fsw_u64_le_swap (key->offset);
+            uint64_t off = addr - chstart;
             unsigned redundancy = 1;
             unsigned i, j;
 
@@ -824,7 +954,7 @@ chunk_found:
             }
 
             DPRINT(L"btrfs chunk 0x%lx+0xlx %d stripes (%d substripes) of %lx\n",
-                    fsw_u64_le_swap (key->offset),
+                    chstart,
                     fsw_u64_le_swap (chunk->size),
                     fsw_u16_le_swap (chunk->nstripes),
                     fsw_u16_le_swap (chunk->nsubstripes),
@@ -927,7 +1057,7 @@ chunk_found:
                     paddr = fsw_u64_le_swap (stripe->offset) + stripe_offset;
 
                     DPRINT (L"btrfs: chunk 0x%lx+0x%lx (%d stripes (%d substripes) of %lx) stripe %lx maps to 0x%lx\n",
-                            fsw_u64_le_swap (key->offset),
+                            chstart,
                             fsw_u64_le_swap (chunk->size),
                             fsw_u16_le_swap (chunk->nstripes),
                             fsw_u16_le_swap (chunk->nsubstripes),
@@ -1074,6 +1204,11 @@ static void fsw_btrfs_volume_free(struct fsw_volume *volg)
         FreePool (vol->devices_attached);
     if(vol->extent)
         FreePool (vol->extent);
+    if(vol->csum_node)
+        FreePool (vol->csum_node);
+    for (i = 0; i < BTRFS_DECOMP_CACHE_SIZE; i++)
+        if(vol->decomp[i].data)
+            FreePool (vol->decomp[i].data);
 }
 
 static fsw_status_t fsw_btrfs_volume_stat(struct fsw_volume *volg, struct fsw_volume_stat *sb)
@@ -1264,6 +1399,86 @@ static fsw_ssize_t grub_btrfs_lzo_decompress(char *ibuf, fsw_size_t isize, grub_
     return ret;
 }
 
+/*
+ * Get the decompressed data of the regular extent in vol->extent, which starts at
+ * vol->extstart in file ino of tree. The data is decompressed as a whole, once,
+ * and kept in a small cache: decompressing up to an offset means inflating all
+ * the data before it, so doing that for each block read would be quadratic.
+ */
+static fsw_status_t fsw_btrfs_decomp_get (struct fsw_btrfs_volume *vol,
+        uint64_t tree, uint64_t ino, struct fsw_btrfs_decomp_entry **entry_out)
+{
+    struct fsw_btrfs_decomp_entry *entry;
+    uint64_t zsize, size, alloc;
+    char *tmp, *data;
+    fsw_ssize_t ret;
+    fsw_status_t err;
+    unsigned i;
+
+    entry = &vol->decomp[0];
+    for (i = 0; i < BTRFS_DECOMP_CACHE_SIZE; i++)
+    {
+        if (vol->decomp[i].data && vol->decomp[i].tree == tree
+                && vol->decomp[i].ino == ino && vol->decomp[i].extstart == vol->extstart)
+        {
+            *entry_out = &vol->decomp[i];
+            (*entry_out)->lru = ++vol->decomp_clock;
+            return FSW_SUCCESS;
+        }
+        if (vol->decomp[i].lru < entry->lru)
+            entry = &vol->decomp[i];
+    }
+
+    size = vol->extend - vol->extstart;
+    if (size > BTRFS_MAX_UNCOMPRESSED)
+        return FSW_VOLUME_CORRUPTED;
+    alloc = (size + vol->sectorsize - 1) & ~(uint64_t)(vol->sectorsize - 1);
+    zsize = fsw_u64_le_swap (vol->extent->compressed_size);
+    tmp = AllocatePool (zsize);
+    if (!tmp)
+        return FSW_OUT_OF_MEMORY;
+    err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
+    if (err)
+    {
+        FreePool (tmp);
+        return FSW_VOLUME_CORRUPTED;
+    }
+
+    data = AllocatePool (alloc);
+    if (!data)
+    {
+        FreePool (tmp);
+        return FSW_OUT_OF_MEMORY;
+    }
+    if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
+        ret = grub_zlib_decompress (tmp, zsize, fsw_u64_le_swap (vol->extent->offset),
+                data, size);
+    else if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
+        ret = grub_btrfs_lzo_decompress (tmp, zsize, fsw_u64_le_swap (vol->extent->offset),
+                data, size);
+    else
+        ret = -1;
+    FreePool (tmp);
+    if (ret != (fsw_ssize_t) size)
+    {
+        FreePool (data);
+        return FSW_VOLUME_CORRUPTED;
+    }
+    if (size < alloc)
+        fsw_memzero (data + size, alloc - size);
+
+    if (entry->data)
+        FreePool (entry->data);
+    entry->tree = tree;
+    entry->ino = ino;
+    entry->extstart = vol->extstart;
+    entry->size = (uint32_t) alloc;
+    entry->lru = ++vol->decomp_clock;
+    entry->data = (uint8_t *) data;
+    *entry_out = entry;
+    return FSW_SUCCESS;
+}
+
 static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dnode *dnog,
         struct fsw_extent *extent)
 {
@@ -1291,10 +1506,8 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
         uint64_t elemaddr;
         fsw_size_t elemsize;
 
-        if(vol->extent) {
-            FreePool (vol->extent);
-            vol->extent = NULL;
-        }
+        /* the buffer is kept for the next extent, invalidate what it holds */
+        vol->extend = 0;
         key_in.object_id = ino;
         key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
         key_in.offset = fsw_u64_le_swap (pos);
@@ -1311,13 +1524,20 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
         {
             return FSW_VOLUME_CORRUPTED;
         }
+        if (elemsize > vol->extalloc)
+        {
+            if (vol->extent)
+                FreePool (vol->extent);
+            vol->extalloc = 0;
+            vol->extent = AllocatePool (elemsize);
+            if (!vol->extent)
+                return FSW_OUT_OF_MEMORY;
+            vol->extalloc = elemsize;
+        }
         vol->extstart = fsw_u64_le_swap (key_out.offset);
         vol->extsize = elemsize;
-        vol->extent = AllocatePool (elemsize);
         vol->extino = ino;
         vol->exttree = tree;
-        if (!vol->extent)
-            return FSW_OUT_OF_MEMORY;
 
         err = fsw_btrfs_read_logical (vol, elemaddr, vol->extent, elemsize, 0, 1);
         if (err)
@@ -1414,47 +1634,22 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
             }
             if (vol->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
             {
-                char *tmp;
-                uint64_t zsize;
-                fsw_ssize_t ret;
-
-                zsize = fsw_u64_le_swap (vol->extent->compressed_size);
-                tmp = AllocatePool (zsize);
-                if (!tmp)
-                    return -FSW_OUT_OF_MEMORY;
-                err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
+                struct fsw_btrfs_decomp_entry *entry;
+
+                if ((vol->extstart & (vol->sectorsize - 1)) != 0)
+                    return FSW_VOLUME_CORRUPTED;
+                err = fsw_btrfs_decomp_get (vol, tree, ino, &entry);
                 if (err)
-                {
-                    FreePool (tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
+                    return err;
 
-                buf = AllocatePool( count << vol->sectorshift);
-                if(!buf) {
-                    FreePool(tmp);
+                /* hand out a copy of the whole extent, the caller frees it */
+                buf = AllocatePool (entry->size);
+                if(!buf)
                     return FSW_OUT_OF_MEMORY;
-                }
-
-                if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-                {
-                    ret = grub_zlib_decompress (tmp, zsize, extoff
-                            + fsw_u64_le_swap (vol->extent->offset),
-                            buf, csize);
-                }
-                else if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-                    ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-                            + fsw_u64_le_swap (vol->extent->offset),
-                            buf, csize);
-                else
-                    ret = -1;
-
-                FreePool (tmp);
-
-                if (ret != (fsw_ssize_t) csize) {
-                    FreePool(tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
-
+                fsw_memcpy (buf, entry->data, entry->size);
+                extent->log_start = vol->extstart >> vol->sectorshift;
+                count = entry->size >> vol->sectorshift;
+                csize = entry->size;
                 break;
             }
             break;
@@ -1475,6 +1670,154 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
     return FSW_SUCCESS;
 }
 
+/*
+ * Map a logical address to a position on this device, for data that can be read
+ * straight from the disk: single chunks with one stripe, and DUP or RAID1 chunks whose
+ * first copy is on this device. *plen is the number of contiguous bytes from there.
+ */
+static fsw_status_t fsw_btrfs_map_direct (struct fsw_btrfs_volume *vol, uint64_t addr,
+        uint64_t *paddr, uint64_t *plen)
+{
+    struct btrfs_chunk_item *chunk;
+    struct btrfs_chunk_stripe *stripe;
+    uint64_t chstart, off;
+    int challoc;
+    fsw_status_t err;
+
+    err = fsw_btrfs_find_chunk (vol, addr, &chstart, &chunk, &challoc, 0, 1);
+    if (err)
+        return err;
+
+    off = addr - chstart;
+    stripe = (struct btrfs_chunk_stripe *) (chunk + 1);
+    err = FSW_UNSUPPORTED;
+    switch (fsw_u64_le_swap (chunk->type)
+            & ~GRUB_BTRFS_CHUNK_TYPE_BITS_DONTCARE)
+    {
+        case GRUB_BTRFS_CHUNK_TYPE_SINGLE:
+            if (fsw_u16_le_swap (chunk->nstripes) != 1)
+                break;
+            /* fall through */
+        case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
+        case GRUB_BTRFS_CHUNK_TYPE_RAID1:
+            if (off < fsw_u64_le_swap (chunk->size)
+                    && find_device (vol, stripe->device_id, 0) == &vol->g)
+            {
+                *paddr = fsw_u64_le_swap (stripe->offset) + off;
+                *plen = fsw_u64_le_swap (chunk->size) - off;
+                err = FSW_SUCCESS;
+            }
+            break;
+    }
+    if (challoc)
+        FreePool (chunk);
+    return err;
+}
+
+/*
+ * Map consecutive extents for the core's extent list, walking the extent items of
+ * the inode with one tree iterator instead of one tree search per extent. Plain
+ * extents that map directly to this device become PHYSBLOCK extents, holes and
+ * extents without data become SPARSE ones. Anything else, like inline, compressed
+ * or striped data, ends the list and is left to fsw_btrfs_get_extent.
+ */
+static fsw_status_t fsw_btrfs_get_extents(struct fsw_volume *volg, struct fsw_dnode *dnog,
+        fsw_u64 log_start, struct fsw_extent *extents, fsw_u32 *count_inout)
+{
+    struct fsw_btrfs_volume *vol = (struct fsw_btrfs_volume *)volg;
+    uint64_t ino = dnog->dnode_id;
+    uint64_t tree = dnog->tree_id;
+    uint64_t pos = log_start << vol->sectorshift;
+    struct fsw_btrfs_leaf_descriptor desc;
+    struct btrfs_key key_in, key_out;
+    struct btrfs_extent_data ext;
+    uint64_t elemaddr, extstart, extend, paddr, plen, len;
+    fsw_size_t elemsize;
+    fsw_status_t err;
+    fsw_u32 n = 0;
+    int r = 1;
+
+    /* slave device got empty root */
+    if (!vol->is_master)
+        return FSW_NOT_FOUND;
+
+    key_in.object_id = ino;
+    key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
+    key_in.offset = fsw_u64_le_swap (pos);
+    desc.data = NULL;
+    err = lower_bound (vol, &key_in, &key_out, tree, &elemaddr, &elemsize, &desc, 0);
+    if (err) {
+        if (desc.data)
+            free_iterator (&desc);
+        return err;
+    }
+    if (key_out.object_id != ino
+            || key_out.type != GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM)
+        r = next (vol, &desc, &elemaddr, &elemsize, &key_out);
+
+    while (r > 0 && n < *count_inout
+            && key_out.object_id == ino
+            && key_out.type == GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM)
+    {
+        if (elemsize < sizeof (ext))
+            break;
+        if (fsw_btrfs_read_logical (vol, elemaddr, &ext, sizeof (ext), 0, 1))
+            break;
+        if (ext.type != GRUB_BTRFS_EXTENT_REGULAR || ext.encryption || ext.encoding
+                || ext.compression != GRUB_BTRFS_COMPRESSION_NONE)
+            break;
+
+        extstart = fsw_u64_le_swap (key_out.offset);
+        extend = extstart + fsw_u64_le_swap (ext.filled);
+        if (((extstart | extend) & (vol->sectorsize - 1)) != 0)
+            break;
+
+        if (extstart > pos)
+        {
+            /* hole without an extent item */
+            extents[n].type = FSW_EXTENT_TYPE_SPARSE;
+            extents[n].log_start = pos >> vol->sectorshift;
+            extents[n].log_count = (fsw_u32)((extstart - pos) >> vol->sectorshift);
+            extents[n].buffer = NULL;
+            pos = extstart;
+            if (++n >= *count_inout)
+                break;
+        }
+
+        while (pos < extend && n < *count_inout)
+        {
+            len = extend - pos;
+            extents[n].type = FSW_EXTENT_TYPE_SPARSE;
+            if (ext.laddr)
+            {
+                if (fsw_btrfs_map_direct (vol, fsw_u64_le_swap (ext.laddr)
+                            + fsw_u64_le_swap (ext.offset) + pos - extstart,
+                            &paddr, &plen)
+                        || (paddr & (vol->sectorsize - 1)) != 0)
+                    goto out;
+                if (len > plen)
+                    len = plen & ~(uint64_t)(vol->sectorsize - 1);
+                if (len == 0)
+                    goto out;
+                extents[n].type = FSW_EXTENT_TYPE_PHYSBLOCK;
+                extents[n].phys_start = paddr >> vol->sectorshift;
+            }
+            extents[n].log_start = pos >> vol->sectorshift;
+            extents[n].log_count = (fsw_u32)(len >> vol->sectorshift);
+            extents[n].buffer = NULL;
+            pos += len;
+            n++;
+        }
+
+        r = next (vol, &desc, &elemaddr, &elemsize, &key_out);
+    }
+
+out:
+    free_iterator (&desc);
+    *count_inout = n;
+    return FSW_SUCCESS;
+}
+
 static fsw_status_t fsw_btrfs_readlink(struct fsw_volume *volg, struct fsw_dnode *dnog,
         struct fsw_string *link_target)
 {
@@ -1876,5 +2219,7 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(btrfs) = {
     fsw_btrfs_dir_lookup,
     fsw_btrfs_dir_read,
     fsw_btrfs_readlink,
+    0,
+    fsw_btrfs_get_extents,
 };
 
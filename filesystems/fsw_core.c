@@ -38,15 +38,39 @@
  */
 
 #include "fsw_core.h"
+#ifndef HOST_POSIX
 #include "fsw_efi.h"
+#endif
 
 
 // functions
 
 static void fsw_blockcache_free(struct fsw_volume *vol);
+static void fsw_dir_index_free(struct fsw_dnode *dno);
+static void fsw_negcache_free(struct fsw_volume *vol);
+static fsw_status_t fsw_block_get_lendable(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level,
+                                           int lendable, void **buffer_out);
 
 #define MAX_CACHE_LEVEL (5)
 
+/** Largest number of entries fsw_dnode_dir_read_plus returns at once. */
+#define FSW_DIR_READ_PLUS_MAX (64)
+
+/** Marks the end of a block cache hash chain. */
+#define FSW_BCACHE_NONE (0xFFFFFFFF)
+
+/** Block cache memory limits; see fsw_set_cache_budget. */
+static fsw_u64 fsw_bcache_volume_budget = FSW_BCACHE_VOLUME_BUDGET;
+static fsw_u64 fsw_bcache_driver_budget = FSW_BCACHE_DRIVER_BUDGET;
+/** Block cache and directory index memory in use by all volumes of this driver. */
+static fsw_u64 fsw_bcache_driver_bytes = 0;
+/** File data blocks loaded since the last shrinker pass. */
+static fsw_u32 fsw_bcache_level0_loads = 0;
+/** FSW_MOUNT_* flags for volumes mounted from now on; see fsw_set_mount_flags. */
+static fsw_u32 fsw_mount_flags = 0;
+/** List of mounted volumes, so that the shrinker can reach all caches. */
+static struct fsw_volume *fsw_volume_head = NULL;
+
 /**
  * Mount a volume with a given file system driver. This function is called by the
  * host driver to make a volume accessible. The file system driver to use is specified
@@ -82,6 +106,13 @@ fsw_status_t fsw_mount(void *host_data,
     vol->host_table     = host_table;
     vol->fstype_table   = fstype_table;
     vol->host_string_type = host_table->native_string_type;
+    vol->mount_flags    = fsw_mount_flags;
+    fsw_slab_init(&vol->dnode_slab, fstype_table->dnode_struct_size, FSW_DNODE_SLAB_OBJECTS);
+    fsw_arena_init(&vol->name_arena, FSW_NAME_ARENA_CHUNK, FSW_NAME_ARENA_LIMIT);
+
+    // register with the shrinker
+    vol->next_volume    = fsw_volume_head;
+    fsw_volume_head     = vol;
 
     // let the fs driver mount the file system
     status = vol->fstype_table->volume_mount(vol);
@@ -108,13 +139,28 @@ errorexit:
 
 void fsw_unmount(struct fsw_volume *vol)
 {
+    struct fsw_volume **link;
+
     if (vol->root)
         fsw_dnode_release(vol->root);
     // TODO: check that no other dnodes are still around
 
     vol->fstype_table->volume_free(vol);
 
+    // de-register from the shrinker's list (dummy volumes were never on it)
+    for (link = &fsw_volume_head; *link != NULL; link = &(*link)->next_volume) {
+        if (*link == vol) {
+            *link = vol->next_volume;
+            break;
+        }
+    }
+
     fsw_blockcache_free(vol);
+    fsw_negcache_free(vol);
+    if (vol->dnode_hash != NULL)
+        fsw_free(vol->dnode_hash);
+    fsw_slab_free(&vol->dnode_slab);
+    fsw_arena_free(&vol->name_arena);
     fsw_strfree(&vol->label);
     fsw_free(vol);
 }
@@ -129,6 +175,59 @@ fsw_status_t fsw_volume_stat(struct fsw_volume *vol, struct fsw_volume_stat *sb)
     return vol->fstype_table->volume_stat(vol, sb);
 }
 
+/**
+ * Get the counters kept for the volume. The host driver calls this to report them;
+ * it fills in the allocator counters, which are kept by the allocators themselves.
+ */
+
+void fsw_volume_get_stats(struct fsw_volume *vol, struct fsw_volume_stats *stats)
+{
+    fsw_memcpy(stats, &vol->stats, sizeof(struct fsw_volume_stats));
+    stats->dnode_allocs   = vol->dnode_slab.allocs;
+    stats->dnode_chunks   = vol->dnode_slab.chunk_allocs;
+    stats->name_allocs    = vol->name_arena.allocs;
+    stats->name_chunks    = vol->name_arena.chunk_allocs;
+    stats->name_rollbacks = vol->name_arena.rollbacks;
+}
+
+/**
+ * Set the memory budget for the block cache and the directory name indexes. This
+ * function can be called by the host driver, usually before mounting any volume, to
+ * override the build-time defaults FSW_BCACHE_VOLUME_BUDGET and FSW_BCACHE_DRIVER_BUDGET.
+ * The first limit applies to each volume on its own, the second one to all volumes of
+ * the driver together. A value of zero keeps the current limit, and
+ * FSW_BCACHE_BUDGET_DEFAULT goes back to the build-time default.
+ *
+ * When a limit is reached, the cache replaces blocks instead of allocating more
+ * memory, and unreferenced file data blocks of all volumes are freed if that is
+ * not enough. Directories whose index does not fit are searched by the fstype.
+ */
+
+void fsw_set_cache_budget(fsw_u64 volume_bytes, fsw_u64 driver_bytes)
+{
+    if (volume_bytes == FSW_BCACHE_BUDGET_DEFAULT)
+        fsw_bcache_volume_budget = FSW_BCACHE_VOLUME_BUDGET;
+    else if (volume_bytes)
+        fsw_bcache_volume_budget = volume_bytes;
+    if (driver_bytes == FSW_BCACHE_BUDGET_DEFAULT)
+        fsw_bcache_driver_budget = FSW_BCACHE_DRIVER_BUDGET;
+    else if (driver_bytes)
+        fsw_bcache_driver_budget = driver_bytes;
+}
+
+/**
+ * Set the FSW_MOUNT_* flags for volumes mounted after this call. The host driver
+ * can call this before mounting any volume; volumes already mounted keep their flags.
+ *
+ * FSW_MOUNT_VERIFY_CHECKSUMS makes file systems with checksummed metadata check it
+ * as it is read and report FSW_VOLUME_CORRUPTED on a mismatch.
+ */
+
+void fsw_set_mount_flags(fsw_u32 flags)
+{
+    fsw_mount_flags = flags;
+}
+
 /**
  * Set the physical and logical block sizes of the volume. This functions is called by
  * the file system driver to announce the block sizes it wants to use for accessing
@@ -161,6 +260,387 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
     vol->log_blocksize = log_blocksize;
 }
 
+/**
+ * Compute the hash chain a physical block number belongs to. This is a
+ * multiplicative hash on the folded block number, so that runs of consecutive
+ * blocks are spread across all chains.
+ */
+
+static fsw_u32 fsw_blockcache_hash(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u32 h;
+
+    h = (fsw_u32)phys_bno ^ (fsw_u32)FSW_U64_SHR(phys_bno, 32);
+    h *= 0x9E3779B1;
+    h ^= h >> 16;
+    return h & vol->bcache_hash_mask;
+}
+
+/**
+ * Find the block cache entry holding a physical block. Returns the index of the
+ * entry, or FSW_BCACHE_NONE if the block is not cached.
+ */
+
+static fsw_u32 fsw_blockcache_lookup(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u32 i;
+
+    if (vol->bcache_hash == NULL)
+        return FSW_BCACHE_NONE;
+    for (i = vol->bcache_hash[fsw_blockcache_hash(vol, phys_bno)]; i != FSW_BCACHE_NONE;
+         i = vol->bcache[i].hash_next) {
+        if (vol->bcache[i].phys_bno == phys_bno)
+            return i;
+    }
+    return FSW_BCACHE_NONE;
+}
+
+/**
+ * Insert a block cache entry into the hash chain for its phys_bno.
+ */
+
+static void fsw_blockcache_link(struct fsw_volume *vol, fsw_u32 i)
+{
+    fsw_u32 h = fsw_blockcache_hash(vol, vol->bcache[i].phys_bno);
+
+    vol->bcache[i].hash_next = vol->bcache_hash[h];
+    vol->bcache_hash[h] = i;
+}
+
+/**
+ * Remove a block cache entry from the hash chain for its phys_bno.
+ */
+
+static void fsw_blockcache_unlink(struct fsw_volume *vol, fsw_u32 i)
+{
+    fsw_u32 *link;
+
+    link = &vol->bcache_hash[fsw_blockcache_hash(vol, vol->bcache[i].phys_bno)];
+    while (*link != FSW_BCACHE_NONE) {
+        if (*link == i) {
+            *link = vol->bcache[i].hash_next;
+            break;
+        }
+        link = &vol->bcache[*link].hash_next;
+    }
+    vol->bcache[i].hash_next = FSW_BCACHE_NONE;
+}
+
+/**
+ * Check whether allocating extra bytes for the block cache, a directory index, a
+ * readahead buffer or a dnode cache of a volume would exceed the per-volume or the
+ * per-driver memory budget.
+ */
+
+static int fsw_blockcache_over_budget(struct fsw_volume *vol, fsw_u64 extra)
+{
+    return (vol->bcache_bytes + vol->dir_index_bytes + vol->readahead_mem_bytes + vol->dnode_cache_bytes + extra >
+                fsw_bcache_volume_budget ||
+            fsw_bcache_driver_bytes + extra > fsw_bcache_driver_budget);
+}
+
+/**
+ * Account for memory allocated (or, with a negative delta, freed) by the block cache.
+ */
+
+static void fsw_blockcache_charge(struct fsw_volume *vol, fsw_s64 delta)
+{
+    vol->bcache_bytes += delta;
+    fsw_bcache_driver_bytes += delta;
+}
+
+/**
+ * Enlarge (or create) the block cache to hold new_size entries. Existing entries
+ * keep their index; the hash table is rebuilt so that chains stay short.
+ */
+
+static fsw_status_t fsw_blockcache_grow(struct fsw_volume *vol, fsw_u32 new_size)
+{
+    fsw_status_t    status;
+    fsw_u32         i, old_size, hash_size;
+    struct fsw_blockcache *new_bcache;
+    fsw_u32         *new_hash;
+
+    old_size = (vol->bcache != NULL) ? vol->bcache_size : 0;
+    for (hash_size = 16; hash_size < new_size; hash_size <<= 1)
+        ;
+
+    status = fsw_alloc(new_size * sizeof(struct fsw_blockcache), &new_bcache);
+    if (status)
+        return status;
+    status = fsw_alloc(hash_size * sizeof(fsw_u32), &new_hash);
+    if (status) {
+        fsw_free(new_bcache);
+        return status;
+    }
+
+    if (old_size > 0)
+        fsw_memcpy(new_bcache, vol->bcache, old_size * sizeof(struct fsw_blockcache));
+    for (i = old_size; i < new_size; i++) {
+        new_bcache[i].refcount = 0;
+        new_bcache[i].cache_level = 0;
+        new_bcache[i].clock_weight = 0;
+        new_bcache[i].hash_next = FSW_BCACHE_NONE;
+        new_bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
+        new_bcache[i].data = NULL;
+    }
+    for (i = 0; i < hash_size; i++)
+        new_hash[i] = FSW_BCACHE_NONE;
+
+    // switch caches
+    if (vol->bcache != NULL) {
+        fsw_free(vol->bcache);
+        fsw_blockcache_charge(vol, -(fsw_s64)(old_size * sizeof(struct fsw_blockcache)));
+    }
+    if (vol->bcache_hash != NULL) {
+        fsw_free(vol->bcache_hash);
+        fsw_blockcache_charge(vol, -(fsw_s64)((vol->bcache_hash_mask + 1) * sizeof(fsw_u32)));
+    }
+    vol->bcache = new_bcache;
+    vol->bcache_size = new_size;
+    vol->bcache_hash = new_hash;
+    vol->bcache_hash_mask = hash_size - 1;
+    fsw_blockcache_charge(vol, new_size * sizeof(struct fsw_blockcache) + hash_size * sizeof(fsw_u32));
+
+    // re-hash the entries that hold a block
+    for (i = 0; i < vol->bcache_used; i++) {
+        if (vol->bcache[i].phys_bno != (fsw_u64)FSW_INVALID_BNO)
+            fsw_blockcache_link(vol, i);
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Pick a block cache entry to be replaced, using a CLOCK sweep. Every entry gets
+ * cache_level + 1 units of credit when it is loaded or hit; the clock hand takes
+ * one unit from each unreferenced entry it passes and replaces the first entry
+ * that has none left. Blocks with a low cache level are thus purged first, and
+ * blocks that are still in use are never purged. If need_data is set, only entries
+ * that still own a data buffer are considered.
+ *
+ * Returns the index of a free entry (already removed from its hash chain), or
+ * FSW_BCACHE_NONE if all entries are in use and the cache must grow.
+ */
+
+static fsw_u32 fsw_blockcache_evict(struct fsw_volume *vol, int need_data)
+{
+    fsw_u32 i, steps;
+    struct fsw_blockcache *bc;
+
+    for (steps = (MAX_CACHE_LEVEL + 2) * vol->bcache_used; steps > 0; steps--) {
+        i = vol->bcache_clock;
+        if (++vol->bcache_clock >= vol->bcache_used)
+            vol->bcache_clock = 0;
+
+        bc = &vol->bcache[i];
+        if (bc->refcount > 0 || (need_data && bc->data == NULL))
+            continue;
+        if (bc->phys_bno == (fsw_u64)FSW_INVALID_BNO)
+            return i;   // left behind by a failed read or by the shrinker
+        if (bc->clock_weight > 0) {
+            bc->clock_weight--;
+            continue;
+        }
+
+        fsw_blockcache_unlink(vol, i);
+        bc->phys_bno = (fsw_u64)FSW_INVALID_BNO;
+        vol->stats.bcache_evictions++;
+        return i;
+    }
+    return FSW_BCACHE_NONE;
+}
+
+/**
+ * Shrink the block caches of the other mounted volumes by freeing the buffers of
+ * unreferenced file data blocks (cache level 0). Called when a volume needs
+ * memory for a new block but the per-driver budget is exhausted, so that memory
+ * can move from idle volumes to the busy one. The emptied entries stay in their
+ * tables and are filled again by later misses, as the budget permits.
+ *
+ * A pass only runs if file data blocks have been loaded since the last one, so
+ * volumes with nothing left to give do not get scanned on every miss.
+ */
+
+static void fsw_blockcache_shrink(struct fsw_volume *requester)
+{
+    struct fsw_volume *vol;
+    struct fsw_blockcache *bc;
+    struct fsw_dnode *dno;
+    fsw_u32         i;
+
+    if (fsw_bcache_level0_loads == 0)
+        return;
+    fsw_bcache_level0_loads = 0;
+
+    for (vol = fsw_volume_head; vol != NULL; vol = vol->next_volume) {
+        if (vol == requester)
+            continue;   // it can recycle its own blocks
+        for (i = 0; i < vol->bcache_used; i++) {
+            bc = &vol->bcache[i];
+            if (bc->refcount > 0 || bc->data == NULL)
+                continue;
+            if (bc->phys_bno != (fsw_u64)FSW_INVALID_BNO) {
+                if (bc->cache_level > 0)
+                    continue;
+                fsw_blockcache_unlink(vol, i);
+                bc->phys_bno = (fsw_u64)FSW_INVALID_BNO;
+            }
+            fsw_free(bc->data);
+            bc->data = NULL;
+            fsw_blockcache_charge(vol, -(fsw_s64)vol->phys_blocksize);
+            vol->stats.bcache_shrink_frees++;
+        }
+
+        // the fstype's per-dnode caches are rebuilt from the disk when needed again
+        if (vol->dnode_cache_bytes == 0 || vol->fstype_table->dnode_trim == NULL)
+            continue;
+        for (dno = vol->dnode_head; dno; dno = dno->next) {
+            if (dno->cache_bytes > 0)
+                vol->fstype_table->dnode_trim(vol, dno);
+        }
+    }
+}
+
+/**
+ * Find a block cache entry to load a new block into, and make sure it has a data
+ * buffer. Fresh entries and new buffers are only used while the memory budget
+ * allows it; otherwise an entry that still owns a buffer is replaced. The cache
+ * only grows when all of its blocks are in use, and fails with FSW_OUT_OF_MEMORY
+ * if that would exceed the budget.
+ */
+
+static fsw_status_t fsw_blockcache_get_entry(struct fsw_volume *vol, fsw_u32 *index_out)
+{
+    fsw_status_t    status;
+    fsw_u32         i;
+    fsw_u64         extra;
+
+    if (vol->bcache_bytes + vol->phys_blocksize <= fsw_bcache_volume_budget &&
+        fsw_bcache_driver_bytes + vol->phys_blocksize > fsw_bcache_driver_budget)
+        fsw_blockcache_shrink(vol);
+
+    if (!fsw_blockcache_over_budget(vol, vol->phys_blocksize)) {
+        // use a fresh entry if there is one, otherwise replace an old one
+        if (vol->bcache_used < vol->bcache_size)
+            i = vol->bcache_used++;
+        else
+            i = fsw_blockcache_evict(vol, 0);
+    } else {
+        // no memory for another buffer, recycle one
+        i = fsw_blockcache_evict(vol, 1);
+        if (i != FSW_BCACHE_NONE && vol->bcache_used < vol->bcache_size)
+            vol->stats.bcache_budget_evictions++;
+    }
+
+    if (i == FSW_BCACHE_NONE) {
+        // all entries are in use, enlarge the cache if the budget allows it
+        extra = vol->phys_blocksize;
+        if (vol->bcache_used >= vol->bcache_size)
+            extra += (fsw_u64)vol->bcache_size * (sizeof(struct fsw_blockcache) + sizeof(fsw_u32));
+        if (fsw_blockcache_over_budget(vol, extra))
+            return FSW_OUT_OF_MEMORY;
+        if (vol->bcache_used >= vol->bcache_size) {
+            status = fsw_blockcache_grow(vol, vol->bcache_size << 1);
+            if (status)
+                return status;
+        }
+        i = vol->bcache_used++;
+    }
+
+    if (vol->bcache[i].data == NULL) {
+        status = fsw_alloc(vol->phys_blocksize, &vol->bcache[i].data);
+        if (status)
+            return status;
+        fsw_blockcache_charge(vol, vol->phys_blocksize);
+    }
+
+    *index_out = i;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Decide how many blocks to read for a cache miss that continues a sequential run.
+ * Readahead needs the host's read_blocks and a staging buffer that fits into the
+ * budget, and it stops at the first block that is already cached. It is also kept
+ * to a quarter of the cache, so that it does not replace the blocks it just read
+ * or everything else. Returns 1 if only the requested block should be read.
+ */
+
+static fsw_u32 fsw_blockcache_readahead_count(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u32         count, max_count, limit;
+
+    max_count = FSW_BCACHE_READAHEAD_BYTES / vol->phys_blocksize;
+    limit = vol->bcache_size / 4;
+    if (vol->host_table->read_blocks == NULL || max_count < 2 || limit < 2)
+        return 1;
+
+    if (vol->bcache_ra_buffer == NULL) {
+        if (fsw_blockcache_over_budget(vol, (fsw_u64)max_count * vol->phys_blocksize) ||
+            fsw_alloc(max_count * vol->phys_blocksize, &vol->bcache_ra_buffer))
+            return 1;
+        fsw_blockcache_charge(vol, (fsw_s64)max_count * vol->phys_blocksize);
+    }
+
+    if (max_count > limit)
+        max_count = limit;
+    for (count = 1; count < max_count; count++)
+        if (fsw_blockcache_lookup(vol, phys_bno + count) != FSW_BCACHE_NONE)
+            break;
+    return count;
+}
+
+/**
+ * Put blocks that were read ahead into the cache. They come from the staging buffer,
+ * after the block that was actually requested. They are as young as that block and
+ * get the same CLOCK weight, but they enter at level 0, so that the shrinker can take
+ * them if they turn out to be unneeded; a later fsw_block_get promotes them as usual.
+ * Readahead stops quietly if no cache entry is available.
+ */
+
+static void fsw_blockcache_insert_readahead(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count,
+                                            fsw_u32 cache_level)
+{
+    fsw_u32         i, n;
+
+    for (n = 0; n < count; n++) {
+        if (fsw_blockcache_get_entry(vol, &i))
+            break;
+        fsw_memcpy(vol->bcache[i].data, vol->bcache_ra_buffer + (n + 1) * vol->phys_blocksize,
+                   vol->phys_blocksize);
+        vol->bcache[i].phys_bno = phys_bno + n;
+        vol->bcache[i].cache_level = 0;
+        vol->bcache[i].clock_weight = cache_level + 1;
+        vol->bcache[i].refcount = 0;
+        fsw_blockcache_link(vol, i);
+        fsw_bcache_level0_loads++;
+        vol->stats.bcache_readahead_blocks++;
+    }
+}
+
+/**
+ * Read consecutive physical blocks from the device through the host table, using
+ * read_blocks for more than one block. Every request is counted in the volume
+ * statistics.
+ */
+
+static fsw_status_t fsw_device_read(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    fsw_status_t    status;
+    fsw_u64         t0;
+
+    t0 = fsw_ticks();
+    if (count > 1)
+        status = vol->host_table->read_blocks(vol, phys_bno, count, buffer);
+    else
+        status = vol->host_table->read_block(vol, phys_bno, buffer);
+    vol->stats.device_read_ticks += fsw_ticks() - t0;
+    vol->stats.device_reads++;
+    if (status == FSW_SUCCESS)
+        vol->stats.device_read_bytes += (fsw_u64)count * vol->phys_blocksize;
+    return status;
+}
+
 /**
  * Get a block of data from the disk. This function is called by the file system driver
  * or by core functions. It calls through to the host driver's device access routine.
@@ -174,105 +654,97 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
  *  - 2: File system metadata
  *  - 3..5: File system metadata with a high rate of access
  *
+ * Cached blocks are found through a hash table on the physical block number, so
+ * the cost of a lookup does not depend on the size of the cache. The memory used
+ * by the cache is limited by the budget set with fsw_set_cache_budget.
+ *
  * If this function returns successfully, the returned data pointer is valid until the
  * caller calls fsw_block_release.
  */
 
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out)
 {
-    fsw_status_t    status;
-    fsw_u32         i, discard_level, new_bcache_size;
-    struct fsw_blockcache *new_bcache;
+    return fsw_block_get_lendable(vol, phys_bno, cache_level, 0, buffer_out);
+}
 
-    // TODO: allow the host driver to do its own caching; just call through if
-    //  the appropriate function pointers are set
+/**
+ * Internal worker for fsw_block_get. If lendable is set, the caller only copies file
+ * data out of the block, and a block that is not in the block cache may be lent from
+ * the host's own disk cache through get_block instead: the pointer goes into the
+ * host's buffer, which stays pinned until fsw_block_release. That saves copying the
+ * block and keeps it out of the block cache. File system structures are never lent,
+ * so they always go through the block cache and its cache levels.
+ */
+
+static fsw_status_t fsw_block_get_lendable(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level,
+                                           int lendable, void **buffer_out)
+{
+    fsw_status_t    status;
+    fsw_u32         i, count;
 
     if (cache_level > MAX_CACHE_LEVEL)
         cache_level = MAX_CACHE_LEVEL;
 
-    if (vol->bcache_size > 0 && vol->bcache == NULL) {
-        /* driver set the initial cache size */
-        status = fsw_alloc(vol->bcache_size * sizeof(struct fsw_blockcache), &vol->bcache);
-        if(status)
+    if (vol->bcache == NULL) {
+        // create the cache; the driver may have set the initial cache size
+        status = fsw_blockcache_grow(vol, (vol->bcache_size > 16) ? vol->bcache_size : 16);
+        if (status)
             return status;
-        for (i = 0; i < vol->bcache_size; i++) {
-            vol->bcache[i].refcount = 0;
-            vol->bcache[i].cache_level = 0;
-            vol->bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
-            vol->bcache[i].data = NULL;
-        }
-        i = 0;
-        goto miss;
     }
 
     // check block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno) {
-            // cache hit!
-            if (vol->bcache[i].cache_level < cache_level)
-                vol->bcache[i].cache_level = cache_level;  // promote the entry
-            vol->bcache[i].refcount++;
-            *buffer_out = vol->bcache[i].data;
-            return FSW_SUCCESS;
-        }
+    i = fsw_blockcache_lookup(vol, phys_bno);
+    if (i != FSW_BCACHE_NONE) {
+        // cache hit!
+        vol->stats.bcache_hits++;
+        if (vol->bcache[i].cache_level < cache_level)
+            vol->bcache[i].cache_level = cache_level;  // promote the entry
+        vol->bcache[i].clock_weight = vol->bcache[i].cache_level + 1;
+        vol->bcache[i].refcount++;
+        *buffer_out = vol->bcache[i].data;
+        return FSW_SUCCESS;
     }
 
-    // find a free entry in the cache table
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == (fsw_u64)FSW_INVALID_BNO)
-            break;
-    }
-    if (i >= vol->bcache_size) {
-        for (discard_level = 0; discard_level <= MAX_CACHE_LEVEL; discard_level++) {
-            for (i = 0; i < vol->bcache_size; i++) {
-                if (vol->bcache[i].refcount == 0 && vol->bcache[i].cache_level <= discard_level)
-                    break;
-            }
-            if (i < vol->bcache_size)
-                break;
-        }
-    }
-    if (i >= vol->bcache_size) {
-        // enlarge / create the cache
-        if (vol->bcache_size < 16)
-            new_bcache_size = 16;
-        else
-            new_bcache_size = vol->bcache_size << 1;
-        status = fsw_alloc(new_bcache_size * sizeof(struct fsw_blockcache), &new_bcache);
-        if (status)
-            return status;
-        if (vol->bcache_size > 0)
-            fsw_memcpy(new_bcache, vol->bcache, vol->bcache_size * sizeof(struct fsw_blockcache));
-        for (i = vol->bcache_size; i < new_bcache_size; i++) {
-            new_bcache[i].refcount = 0;
-            new_bcache[i].cache_level = 0;
-            new_bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
-            new_bcache[i].data = NULL;
-        }
-        i = vol->bcache_size;
+    vol->stats.bcache_misses++;
 
-        // switch caches
-        if (vol->bcache != NULL)
-            fsw_free(vol->bcache);
-        vol->bcache = new_bcache;
-        vol->bcache_size = new_bcache_size;
+    // file data can be lent by the host
+    if (lendable && vol->host_table->get_block != NULL &&
+        vol->host_table->get_block(vol, phys_bno, buffer_out) == FSW_SUCCESS) {
+        vol->stats.bcache_lent++;
+        return FSW_SUCCESS;
     }
-    vol->bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
-miss:
 
-    // read the data
-    if (vol->bcache[i].data == NULL) {
-        status = fsw_alloc(vol->phys_blocksize, &vol->bcache[i].data);
-        if (status)
-            return status;
+    // find an entry with a buffer for the block
+    status = fsw_blockcache_get_entry(vol, &i);
+    if (status)
+        return status;
+
+    // read the data, and the blocks after it if this miss continues a sequential run
+    count = 1;
+    if (phys_bno == vol->bcache_seq_bno)
+        count = fsw_blockcache_readahead_count(vol, phys_bno);
+    if (count > 1) {
+        status = fsw_device_read(vol, phys_bno, count, vol->bcache_ra_buffer);
+        if (status == FSW_SUCCESS)
+            fsw_memcpy(vol->bcache[i].data, vol->bcache_ra_buffer, vol->phys_blocksize);
+    } else {
+        status = fsw_device_read(vol, phys_bno, 1, vol->bcache[i].data);
     }
-    status = vol->host_table->read_block(vol, phys_bno, vol->bcache[i].data);
     if (status)
         return status;
+    vol->bcache_seq_bno = phys_bno + count;
 
     vol->bcache[i].phys_bno = phys_bno;
     vol->bcache[i].cache_level = cache_level;
+    vol->bcache[i].clock_weight = cache_level + 1;
     vol->bcache[i].refcount = 1;
+    fsw_blockcache_link(vol, i);
+    if (cache_level == 0)
+        fsw_bcache_level0_loads++;
+
+    if (count > 1)
+        fsw_blockcache_insert_readahead(vol, phys_bno + 1, count - 1, cache_level);
+
     *buffer_out = vol->bcache[i].data;
     return FSW_SUCCESS;
 }
@@ -286,13 +758,13 @@ void fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer
 {
     fsw_u32 i;
 
-    // TODO: allow the host driver to do its own caching; just call through if
-    //  the appropriate function pointers are set
-
-    // update block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno && vol->bcache[i].refcount > 0)
+    // update block cache, or unpin a block lent by the host
+    i = fsw_blockcache_lookup(vol, phys_bno);
+    if (i != FSW_BCACHE_NONE && vol->bcache[i].data == buffer) {
+        if (vol->bcache[i].refcount > 0)
             vol->bcache[i].refcount--;
+    } else if (vol->host_table->put_block != NULL) {
+        vol->host_table->put_block(vol, phys_bno, buffer);
     }
 }
 
@@ -305,223 +777,810 @@ static void fsw_blockcache_free(struct fsw_volume *vol)
 {
     fsw_u32 i;
 
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].data != NULL)
-            fsw_free(vol->bcache[i].data);
-    }
     if (vol->bcache != NULL) {
+        for (i = 0; i < vol->bcache_size; i++) {
+            if (vol->bcache[i].data != NULL)
+                fsw_free(vol->bcache[i].data);
+        }
         fsw_free(vol->bcache);
         vol->bcache = NULL;
     }
+    if (vol->bcache_hash != NULL) {
+        fsw_free(vol->bcache_hash);
+        vol->bcache_hash = NULL;
+    }
+    if (vol->bcache_ra_buffer != NULL) {
+        fsw_free(vol->bcache_ra_buffer);
+        vol->bcache_ra_buffer = NULL;
+    }
+    fsw_blockcache_charge(vol, -(fsw_s64)vol->bcache_bytes);
     vol->bcache_size = 0;
-    fsw_efi_clear_cache();
+    vol->bcache_used = 0;
+    vol->bcache_hash_mask = 0;
+    vol->bcache_clock = 0;
+    vol->bcache_seq_bno = FSW_INVALID_BNO;
+#ifndef HOST_POSIX
+    fsw_efi_clear_cache(vol);
+#endif
 }
 
 /**
- * Add a new dnode to the list of known dnodes. This internal function is used when a
- * dnode is created to add it to the dnode list that is used to search for existing
- * dnodes by id.
+ * Compute the hash chain for a dnode id. Inode numbers are mostly sequential,
+ * so the id is mixed with a multiplicative hash before it is masked.
  */
 
-static void fsw_dnode_register(struct fsw_volume *vol, struct fsw_dnode *dno)
+static fsw_u32 fsw_dnode_hash(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
 {
-    dno->next = vol->dnode_head;
-    if (vol->dnode_head != NULL)
-        vol->dnode_head->prev = dno;
-    dno->prev = NULL;
-    vol->dnode_head = dno;
+    fsw_u32 h;
+
+    h = (fsw_u32)dnode_id ^ (fsw_u32)FSW_U64_SHR(dnode_id, 32);
+    h ^= (fsw_u32)tree_id * 0x85EBCA6B;
+    h *= 0x9E3779B1;
+    h ^= h >> 16;
+    return h & vol->dnode_hash_mask;
+}
+
+/**
+ * Resize the dnode hash table to the given number of chains (a power of 2) and
+ * re-hash all dnodes on the volume's list. If the allocation fails, the old table
+ * stays in place; lookups still work, the chains are just longer.
+ */
+
+static fsw_status_t fsw_dnode_hash_resize(struct fsw_volume *vol, fsw_u32 new_size)
+{
+    fsw_status_t    status;
+    struct fsw_dnode **new_hash;
+    struct fsw_dnode *dno;
+    fsw_u32         h;
+
+    status = fsw_alloc_zero(new_size * sizeof(struct fsw_dnode *), (void **)&new_hash);
+    if (status)
+        return status;
+
+    if (vol->dnode_hash != NULL)
+        fsw_free(vol->dnode_hash);
+    vol->dnode_hash = new_hash;
+    vol->dnode_hash_mask = new_size - 1;
+
+    for (dno = vol->dnode_head; dno; dno = dno->next) {
+        h = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id);
+        dno->hash_next = new_hash[h];
+        new_hash[h] = dno;
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Find a dnode on record by its id. Returns NULL if there is none.
+ */
+
+static struct fsw_dnode *fsw_dnode_lookup_id(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
+{
+    struct fsw_dnode *dno;
+
+    if (vol->dnode_hash == NULL) {
+        // no table yet (or it could not be allocated), fall back to the list
+        for (dno = vol->dnode_head; dno; dno = dno->next)
+            if (dno->dnode_id == dnode_id && dno->tree_id == tree_id)
+                return dno;
+        return NULL;
+    }
+
+    for (dno = vol->dnode_hash[fsw_dnode_hash(vol, tree_id, dnode_id)]; dno; dno = dno->hash_next)
+        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id)
+            return dno;
+    return NULL;
+}
+
+/**
+ * Read consecutive physical blocks straight into a caller's buffer, bypassing the
+ * block cache. This is used for bulk reads of file data, which would otherwise be
+ * copied through the cache one block at a time and push out metadata blocks.
+ * If the host has read_blocks, this is a single device request.
+ */
+
+static fsw_status_t fsw_block_read_direct(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    fsw_status_t    status;
+    fsw_u8          *p = buffer;
+    fsw_u32         i;
+
+    if (vol->host_table->read_blocks != NULL) {
+        status = fsw_device_read(vol, phys_bno, count, buffer);
+        if (status)
+            return status;
+    } else {
+        for (i = 0; i < count; i++, p += vol->phys_blocksize) {
+            status = fsw_device_read(vol, phys_bno + i, 1, p);
+            if (status)
+                return status;
+        }
+    }
+    vol->stats.bulk_reads++;
+    vol->stats.bulk_read_bytes += (fsw_u64)count * vol->phys_blocksize;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Add a new dnode to the list of known dnodes. This internal function is used when a
+ * dnode is created to add it to the dnode list and the hash table that are used to
+ * search for existing dnodes by id.
+ */
+
+static void fsw_dnode_register(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    fsw_u32         h;
+
+    dno->next = vol->dnode_head;
+    if (vol->dnode_head != NULL)
+        vol->dnode_head->prev = dno;
+    dno->prev = NULL;
+    vol->dnode_head = dno;
+    vol->dnode_count++;
+
+    // keep the load factor at or below one; a successful resize also links the new dnode
+    if (vol->dnode_hash == NULL || vol->dnode_count > vol->dnode_hash_mask + 1) {
+        if (fsw_dnode_hash_resize(vol, vol->dnode_hash == NULL ? 64 : (vol->dnode_hash_mask + 1) << 1) == FSW_SUCCESS)
+            return;
+    }
+    if (vol->dnode_hash != NULL) {
+        h = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id);
+        dno->hash_next = vol->dnode_hash[h];
+        vol->dnode_hash[h] = dno;
+    }
+}
+
+/**
+ * Remove a dnode from the list of known dnodes and from the hash table.
+ */
+
+static void fsw_dnode_unregister(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    struct fsw_dnode **link;
+
+    if (dno->next)
+        dno->next->prev = dno->prev;
+    if (dno->prev)
+        dno->prev->next = dno->next;
+    if (vol->dnode_head == dno)
+        vol->dnode_head = dno->next;
+    vol->dnode_count--;
+
+    if (vol->dnode_hash != NULL) {
+        for (link = &vol->dnode_hash[fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id)];
+             *link != NULL; link = &(*link)->hash_next) {
+            if (*link == dno) {
+                *link = dno->hash_next;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Create a dnode representing the root directory. This function is called by the file system
+ * driver while mounting the file system. The root directory is special because it has no parent
+ * dnode, its name is defined to be empty, and its type is also fixed. Otherwise, this functions
+ * behaves in the same way as fsw_dnode_create.
+ */
+
+fsw_status_t fsw_dnode_create_root_with_tree(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id, struct fsw_dnode **dno_out)
+{
+    fsw_status_t    status;
+    struct fsw_dnode *dno;
+
+    // allocate memory for the structure
+    status = fsw_slab_alloc(&vol->dnode_slab, (void **)&dno);
+    if (status)
+        return status;
+    fsw_memzero(dno, vol->fstype_table->dnode_struct_size);
+
+    // fill the structure
+    dno->vol = vol;
+    dno->parent = NULL;
+    dno->tree_id = tree_id;
+    dno->dnode_id = dnode_id;
+    dno->type = FSW_DNODE_TYPE_DIR;
+    dno->refcount = 1;
+    dno->name.type = FSW_STRING_TYPE_EMPTY;
+    // TODO: instead, call a function to create an empty string in the native string type
+
+    fsw_dnode_register(vol, dno);
+
+    *dno_out = dno;
+    return FSW_SUCCESS;
+}
+
+fsw_status_t fsw_dnode_create_root(struct fsw_volume *vol, fsw_u64 dnode_id, struct fsw_dnode **dno_out)
+{
+	return fsw_dnode_create_root_with_tree( vol, 0, dnode_id, dno_out);
+}
+/**
+ * Create a new dnode representing a file system object. This function is called by
+ * the file system driver in response to directory lookup or read requests. Note that
+ * if there already is a dnode with the given dnode_id on record, then no new object
+ * is created. Instead, the existing dnode is returned and its reference count
+ * increased. All other parameters are ignored in this case.
+ *
+ * The type passed into this function may be FSW_DNODE_TYPE_UNKNOWN. It is sufficient
+ * to fill the type field during the dnode_fill call.
+ *
+ * The name parameter must describe a string with the object's name. A copy will be
+ * stored in the dnode structure for future reference. The name will not be used to
+ * shortcut directory lookups, but may be used to reconstruct paths.
+ *
+ * If the function returns successfully, *dno_out contains a pointer to the dnode
+ * that must be released by the caller with fsw_dnode_release.
+ */
+
+fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tree_id, fsw_u64 dnode_id, int type,
+                              struct fsw_string *name, struct fsw_dnode **dno_out)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = parent_dno->vol;
+    struct fsw_dnode *dno;
+
+    // check if we already have a dnode with the same id
+    dno = fsw_dnode_lookup_id(vol, tree_id, dnode_id);
+    if (dno != NULL) {
+        fsw_dnode_retain(dno);
+        *dno_out = dno;
+        return FSW_SUCCESS;
+    }
+
+    // allocate memory for the structure
+    status = fsw_slab_alloc(&vol->dnode_slab, (void **)&dno);
+    if (status)
+        return status;
+    fsw_memzero(dno, vol->fstype_table->dnode_struct_size);
+
+    // fill the structure
+    dno->vol = vol;
+    dno->parent = parent_dno;
+    fsw_dnode_retain(dno->parent);
+    dno->tree_id = tree_id;
+    dno->dnode_id = dnode_id;
+    dno->type = type;
+    dno->refcount = 1;
+    // small names go to the volume's arena, the rest to the pool
+    status = fsw_strdup_coerce_arena(&dno->name, vol->host_table->native_string_type, name,
+                                     &vol->name_arena);
+    if (status == FSW_SUCCESS && dno->name.data != NULL)
+        dno->name_in_arena = 1;
+    else if (status)
+        status = fsw_strdup_coerce(&dno->name, vol->host_table->native_string_type, name);
+    if (status) {
+        fsw_dnode_release(dno->parent);
+        fsw_slab_release(&vol->dnode_slab, dno);
+        return status;
+    }
+
+    fsw_dnode_register(vol, dno);
+
+    *dno_out = dno;
+    return FSW_SUCCESS;
+}
+
+fsw_status_t fsw_dnode_create(struct fsw_dnode *parent_dno, fsw_u64 dnode_id, int type,
+                              struct fsw_string *name, struct fsw_dnode **dno_out)
+{
+	return fsw_dnode_create_with_tree(parent_dno, 0, dnode_id, type, name, dno_out);
+}
+
+/**
+ * Increases the reference count of a dnode. This must be balanced with
+ * fsw_dnode_release calls. Note that some dnode functions return a retained
+ * dnode pointer to their caller.
+ */
+
+void fsw_dnode_retain(struct fsw_dnode *dno)
+{
+    dno->refcount++;
+}
+
+/**
+ * Release a dnode pointer, deallocating it if this was the last reference.
+ * This function decrements the reference counter of the dnode. If the counter
+ * reaches zero, the dnode is freed. Since the parent dnode is released
+ * during that process, this function may cause it to be freed, too.
+ */
+
+void fsw_dnode_release(struct fsw_dnode *dno)
+{
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dnode *parent_dno;
+
+    dno->refcount--;
+
+    if (dno->refcount == 0) {
+        parent_dno = dno->parent;
+
+        // de-register from volume's list and hash table
+        fsw_dnode_unregister(vol, dno);
+
+        // drop the directory's name index
+        fsw_dir_index_free(dno);
+
+        // run fstype-specific cleanup
+        vol->fstype_table->dnode_free(vol, dno);
+        if (dno->host_info != NULL)
+            fsw_free(dno->host_info);
+
+        if (dno->name_in_arena)
+            fsw_arena_release(&vol->name_arena, dno->name.data, dno->name.size);
+        else
+            fsw_strfree(&dno->name);
+        fsw_slab_release(&vol->dnode_slab, dno);
+
+        // release our pointer to the parent, possibly deallocating it, too
+        if (parent_dno)
+            fsw_dnode_release(parent_dno);
+    }
+}
+
+/**
+ * Get full information about a dnode from disk. This function is called by the host
+ * driver as well as by the core functions. Some file systems defer reading full
+ * information on a dnode until it is actually needed (i.e. separation between
+ * directory and inode information). This function makes sure that all information
+ * is available in the dnode structure. The following fields may not have a correct
+ * value until fsw_dnode_fill has been called:
+ *
+ * type, size
+ *
+ * Once the fstype's dnode_fill has succeeded, it is not called again for the dnode.
+ */
+
+fsw_status_t fsw_dnode_fill(struct fsw_dnode *dno)
+{
+    fsw_status_t    status;
+
+    if (dno->filled)
+        return FSW_SUCCESS;
+    status = dno->vol->fstype_table->dnode_fill(dno->vol, dno);
+    if (status == FSW_SUCCESS)
+        dno->filled = 1;
+    return status;
+}
+
+/**
+ * Get extended information about a dnode. This function can be called by the host
+ * driver to get a full compliment of information about a dnode in addition to the
+ * fields of the fsw_dnode structure itself.
+ *
+ * Some data requires host-specific conversion to be useful (i.e. timestamps) and
+ * will be passed to callback functions instead of being written into the structure.
+ * These callbacks must be filled in by the caller.
+ */
+
+fsw_status_t fsw_dnode_stat(struct fsw_dnode *dno, struct fsw_dnode_stat *sb)
+{
+    fsw_status_t    status;
+
+    status = fsw_dnode_fill(dno);
+    if (status)
+        return status;
+
+    sb->used_bytes = 0;
+    status = dno->vol->fstype_table->dnode_stat(dno->vol, dno, sb);
+    if (!status && !sb->used_bytes)
+        sb->used_bytes = FSW_U64_DIV(dno->size + dno->vol->log_blocksize - 1, dno->vol->log_blocksize);
+    return status;
+}
+
+/**
+ * Core: One entry of a directory name index.
+ */
+
+struct fsw_dir_index_entry {
+    fsw_u64     pos;                //!< Directory position that dir_read returns this entry from
+    fsw_u32     name_offset;        //!< Offset of the name in the names buffer
+    fsw_u32     name_size;          //!< Size of the name in bytes
+    fsw_u32     name_hash;          //!< Hash of the name
+    fsw_u32     hash_next;          //!< Index of the next entry in the same hash chain
+};
+
+/**
+ * Core: In-memory name index of a directory. Names are stored in the host string
+ * encoding, so that lookups from the host need no conversion.
+ */
+
+struct fsw_dir_index {
+    fsw_u32     count;              //!< Number of entries in use
+    fsw_u32     capacity;           //!< Number of entries allocated
+    fsw_u32     names_used;         //!< Bytes in use in the names buffer
+    fsw_u32     names_capacity;     //!< Bytes allocated for the names buffer
+    fsw_u32     hash_mask;          //!< Number of hash chains minus one (power of 2)
+    fsw_u32     *hash;              //!< Hash chain heads (indices into entries)
+    struct fsw_dir_index_entry *entries;    //!< Array of entries
+    fsw_u8      *names;             //!< Names of all entries, back to back
+    fsw_u64     bytes;              //!< Memory used, counted against the cache budget
+};
+
+/**
+ * Hash a name for the directory index and the negative lookup cache (FNV-1a over
+ * the encoded bytes).
+ */
+
+static fsw_u32 fsw_dnode_name_hash(struct fsw_string *name)
+{
+    fsw_u8          *p = (fsw_u8 *)name->data;
+    fsw_u32         h = 0x811C9DC5;
+    int             i;
+
+    for (i = 0; i < name->size; i++) {
+        h ^= p[i];
+        h *= 0x01000193;
+    }
+    return h;
+}
+
+/**
+ * Allocate memory for a directory index, charging it against the cache budget.
+ */
+
+static fsw_status_t fsw_dir_index_alloc(struct fsw_volume *vol, struct fsw_dir_index *dindex,
+                                        fsw_u32 size, void **ptr_out)
+{
+    fsw_status_t    status;
+
+    if (fsw_blockcache_over_budget(vol, size))
+        return FSW_OUT_OF_MEMORY;
+    status = fsw_alloc(size, ptr_out);
+    if (status)
+        return status;
+    dindex->bytes += size;
+    vol->dir_index_bytes += size;
+    fsw_bcache_driver_bytes += size;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free memory allocated with fsw_dir_index_alloc.
+ */
+
+static void fsw_dir_index_release(struct fsw_volume *vol, struct fsw_dir_index *dindex,
+                                  fsw_u32 size, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    fsw_free(ptr);
+    dindex->bytes -= size;
+    vol->dir_index_bytes -= size;
+    fsw_bcache_driver_bytes -= size;
+}
+
+/**
+ * Free the name index of a directory dnode, if it has one.
+ */
+
+static void fsw_dir_index_free(struct fsw_dnode *dno)
+{
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dir_index *dindex = dno->dir_index;
+
+    if (dindex == NULL)
+        return;
+    fsw_dir_index_release(vol, dindex, (dindex->hash_mask + 1) * sizeof(fsw_u32), dindex->hash);
+    fsw_dir_index_release(vol, dindex, dindex->capacity * sizeof(struct fsw_dir_index_entry), dindex->entries);
+    fsw_dir_index_release(vol, dindex, dindex->names_capacity, dindex->names);
+    fsw_free(dindex);
+    dno->dir_index = NULL;
+}
+
+/**
+ * Add a name to a directory index that is being built. The entry arrays grow by
+ * doubling; the hash table is only set up once all names are known.
+ */
+
+static fsw_status_t fsw_dir_index_add(struct fsw_volume *vol, struct fsw_dir_index *dindex,
+                                      struct fsw_string *name, fsw_u64 pos)
+{
+    fsw_status_t    status;
+    struct fsw_dir_index_entry *new_entries, *entry;
+    fsw_u8          *new_names;
+    fsw_u32         new_capacity;
+
+    if (dindex->count == dindex->capacity) {
+        new_capacity = dindex->capacity ? dindex->capacity << 1 : 64;
+        status = fsw_dir_index_alloc(vol, dindex, new_capacity * sizeof(struct fsw_dir_index_entry),
+                                     (void **)&new_entries);
+        if (status)
+            return status;
+        if (dindex->count > 0)
+            fsw_memcpy(new_entries, dindex->entries, dindex->count * sizeof(struct fsw_dir_index_entry));
+        fsw_dir_index_release(vol, dindex, dindex->capacity * sizeof(struct fsw_dir_index_entry), dindex->entries);
+        dindex->entries = new_entries;
+        dindex->capacity = new_capacity;
+    }
+
+    if (dindex->names_used + name->size > dindex->names_capacity) {
+        for (new_capacity = dindex->names_capacity ? dindex->names_capacity : 1024;
+             new_capacity < dindex->names_used + name->size; new_capacity <<= 1)
+            ;
+        status = fsw_dir_index_alloc(vol, dindex, new_capacity, (void **)&new_names);
+        if (status)
+            return status;
+        if (dindex->names_used > 0)
+            fsw_memcpy(new_names, dindex->names, dindex->names_used);
+        fsw_dir_index_release(vol, dindex, dindex->names_capacity, dindex->names);
+        dindex->names = new_names;
+        dindex->names_capacity = new_capacity;
+    }
+
+    entry = &dindex->entries[dindex->count++];
+    entry->pos = pos;
+    entry->name_offset = dindex->names_used;
+    entry->name_size = name->size;
+    entry->name_hash = fsw_dnode_name_hash(name);
+    if (name->size > 0)
+        fsw_memcpy(dindex->names + dindex->names_used, name->data, name->size);
+    dindex->names_used += name->size;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Build the name index of a directory by reading all of its entries once through
+ * the fstype's dir_read. For each entry, the index records the directory position
+ * that dir_read started from, so that a lookup can re-read just that entry.
+ */
+
+static fsw_status_t fsw_dir_index_build(struct fsw_dnode *dno)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dir_index *dindex;
+    struct fsw_shandle shand;
+    struct fsw_dnode *child_dno;
+    struct fsw_string name;
+    fsw_u64         pos;
+    fsw_u32         i, h, hash_size;
+
+    status = fsw_alloc_zero(sizeof(struct fsw_dir_index), (void **)&dindex);
+    if (status)
+        return status;
+    dno->dir_index = dindex;
+
+    status = fsw_shandle_open(dno, &shand);
+    if (status)
+        goto errorexit;
+
+    while (1) {
+        pos = shand.pos;
+        status = fsw_dnode_dir_read(&shand, &child_dno);
+        if (status == FSW_NOT_FOUND)
+            break;
+        if (status)
+            break;
+
+        if (child_dno->name.type == vol->host_string_type) {
+            status = fsw_dir_index_add(vol, dindex, &child_dno->name, pos);
+        } else {
+            status = fsw_strdup_coerce(&name, vol->host_string_type, &child_dno->name);
+            if (status == FSW_SUCCESS) {
+                status = fsw_dir_index_add(vol, dindex, &name, pos);
+                fsw_strfree(&name);
+            }
+        }
+        fsw_dnode_release(child_dno);
+        if (status)
+            break;
+    }
+    fsw_shandle_close(&shand);
+    if (status != FSW_NOT_FOUND)
+        goto errorexit;
+
+    // set up the hash chains
+    for (hash_size = 16; hash_size < dindex->count; hash_size <<= 1)
+        ;
+    status = fsw_dir_index_alloc(vol, dindex, hash_size * sizeof(fsw_u32), (void **)&dindex->hash);
+    if (status)
+        goto errorexit;
+    dindex->hash_mask = hash_size - 1;
+    for (i = 0; i < hash_size; i++)
+        dindex->hash[i] = FSW_BCACHE_NONE;
+    for (i = 0; i < dindex->count; i++) {
+        h = dindex->entries[i].name_hash & dindex->hash_mask;
+        dindex->entries[i].hash_next = dindex->hash[h];
+        dindex->hash[h] = i;
+    }
+    return FSW_SUCCESS;
+
+errorexit:
+    fsw_dir_index_free(dno);
+    return status;
 }
 
 /**
- * Create a dnode representing the root directory. This function is called by the file system
- * driver while mounting the file system. The root directory is special because it has no parent
- * dnode, its name is defined to be empty, and its type is also fixed. Otherwise, this functions
- * behaves in the same way as fsw_dnode_create.
+ * Call the fstype's dir_lookup function, counting the call in the volume statistics.
  */
 
-fsw_status_t fsw_dnode_create_root_with_tree(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id, struct fsw_dnode **dno_out)
+static fsw_status_t fsw_fstype_dir_lookup(struct fsw_volume *vol, struct fsw_dnode *dno,
+                                          struct fsw_string *lookup_name, struct fsw_dnode **child_dno_out)
 {
     fsw_status_t    status;
-    struct fsw_dnode *dno;
-
-    // allocate memory for the structure
-    status = fsw_alloc_zero(vol->fstype_table->dnode_struct_size, (void **)&dno);
-    if (status)
-        return status;
-
-    // fill the structure
-    dno->vol = vol;
-    dno->parent = NULL;
-    dno->tree_id = tree_id;
-    dno->dnode_id = dnode_id;
-    dno->type = FSW_DNODE_TYPE_DIR;
-    dno->refcount = 1;
-    dno->name.type = FSW_STRING_TYPE_EMPTY;
-    // TODO: instead, call a function to create an empty string in the native string type
-
-    fsw_dnode_register(vol, dno);
+    fsw_u64         t0;
 
-    *dno_out = dno;
-    return FSW_SUCCESS;
+    t0 = fsw_ticks();
+    status = vol->fstype_table->dir_lookup(vol, dno, lookup_name, child_dno_out);
+    vol->stats.dir_lookup_ticks += fsw_ticks() - t0;
+    vol->stats.dir_lookup_calls++;
+    return status;
 }
 
-fsw_status_t fsw_dnode_create_root(struct fsw_volume *vol, fsw_u64 dnode_id, struct fsw_dnode **dno_out)
-{
-	return fsw_dnode_create_root_with_tree( vol, 0, dnode_id, dno_out);
-}
 /**
- * Create a new dnode representing a file system object. This function is called by
- * the file system driver in response to directory lookup or read requests. Note that
- * if there already is a dnode with the given dnode_id on record, then no new object
- * is created. Instead, the existing dnode is returned and its reference count
- * increased. All other parameters are ignored in this case.
- *
- * The type passed into this function may be FSW_DNODE_TYPE_UNKNOWN. It is sufficient
- * to fill the type field during the dnode_fill call.
- *
- * The name parameter must describe a string with the object's name. A copy will be
- * stored in the dnode structure for future reference. The name will not be used to
- * shortcut directory lookups, but may be used to reconstruct paths.
+ * Look up a name in a directory through its name index, which is built on the first
+ * lookup. A name that is in the index is re-read from its recorded directory position,
+ * so that the fstype sets up the child dnode as usual; a name that is not in the index
+ * does not exist. If the index cannot be built (e.g. the memory budget is exhausted),
+ * this falls back to the fstype's dir_lookup.
  *
- * If the function returns successfully, *dno_out contains a pointer to the dnode
- * that must be released by the caller with fsw_dnode_release.
+ * The name must be given twice: as passed by the caller, and in the host string
+ * encoding together with its hash.
  */
 
-fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tree_id, fsw_u64 dnode_id, int type,
-                              struct fsw_string *name, struct fsw_dnode **dno_out)
+static fsw_status_t fsw_dir_index_lookup(struct fsw_dnode *dno, struct fsw_string *lookup_name,
+                                         struct fsw_string *name, fsw_u32 h,
+                                         struct fsw_dnode **child_dno_out)
 {
     fsw_status_t    status;
-    struct fsw_volume *vol = parent_dno->vol;
-    struct fsw_dnode *dno;
-
-    // check if we already have a dnode with the same id
-    for (dno = vol->dnode_head; dno; dno = dno->next) {
-        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id) {
-            fsw_dnode_retain(dno);
-            *dno_out = dno;
-            return FSW_SUCCESS;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dir_index *dindex;
+    struct fsw_dir_index_entry *entry;
+    struct fsw_shandle shand;
+    struct fsw_dnode *child_dno;
+    fsw_u32         i;
+
+    if (dno->dir_index == NULL) {
+        status = fsw_dir_index_build(dno);
+        if (status) {
+            dno->dir_index_failed = 1;
+            return fsw_fstype_dir_lookup(vol, dno, lookup_name, child_dno_out);
         }
     }
+    dindex = dno->dir_index;
 
-    // allocate memory for the structure
-    status = fsw_alloc_zero(vol->fstype_table->dnode_struct_size, (void **)&dno);
-    if (status)
-        return status;
+    for (i = dindex->hash[h & dindex->hash_mask]; i != FSW_BCACHE_NONE; i = entry->hash_next) {
+        entry = &dindex->entries[i];
+        if (entry->name_hash != h || entry->name_size != (fsw_u32)name->size ||
+            !fsw_memeq(dindex->names + entry->name_offset, name->data, name->size))
+            continue;
 
-    // fill the structure
-    dno->vol = vol;
-    dno->parent = parent_dno;
-    fsw_dnode_retain(dno->parent);
-    dno->tree_id = tree_id;
-    dno->dnode_id = dnode_id;
-    dno->type = type;
-    dno->refcount = 1;
-    status = fsw_strdup_coerce(&dno->name, vol->host_table->native_string_type, name);
-    if (status) {
-        fsw_free(dno);
-        return status;
-    }
+        // re-read the entry from its position
+        status = fsw_shandle_open(dno, &shand);
+        if (status)
+            return status;
+        shand.pos = entry->pos;
+        status = fsw_dnode_dir_read(&shand, &child_dno);
+        fsw_shandle_close(&shand);
+        if (status == FSW_SUCCESS) {
+            if (fsw_streq(&child_dno->name, lookup_name)) {
+                *child_dno_out = child_dno;
+                return FSW_SUCCESS;
+            }
+            fsw_dnode_release(child_dno);
+        }
 
-    fsw_dnode_register(vol, dno);
+        // the index does not match the directory, don't trust it any more
+        fsw_dir_index_free(dno);
+        dno->dir_index_failed = 1;
+        return fsw_fstype_dir_lookup(vol, dno, lookup_name, child_dno_out);
+    }
 
-    *dno_out = dno;
-    return FSW_SUCCESS;
+    return FSW_NOT_FOUND;
 }
 
-fsw_status_t fsw_dnode_create(struct fsw_dnode *parent_dno, fsw_u64 dnode_id, int type,
-                              struct fsw_string *name, struct fsw_dnode **dno_out)
+/**
+ * Find the negative lookup cache slot for a name in a directory. The cache is
+ * direct-mapped; a new miss simply replaces whatever was in its slot before.
+ */
+
+static struct fsw_negcache_entry *fsw_negcache_slot(struct fsw_volume *vol, struct fsw_dnode *dno, fsw_u32 h)
 {
-	return fsw_dnode_create_with_tree(parent_dno, 0, dnode_id, type, name, dno_out);
+    h ^= ((fsw_u32)dno->dnode_id ^ (fsw_u32)dno->tree_id) * 0x9E3779B1;
+    return &vol->negcache[(h ^ (h >> 16)) & (FSW_NEGCACHE_SIZE - 1)];
 }
 
 /**
- * Increases the reference count of a dnode. This must be balanced with
- * fsw_dnode_release calls. Note that some dnode functions return a retained
- * dnode pointer to their caller.
+ * Check whether a name is known not to exist in a directory.
  */
 
-void fsw_dnode_retain(struct fsw_dnode *dno)
+static int fsw_negcache_find(struct fsw_volume *vol, struct fsw_dnode *dno, struct fsw_string *name, fsw_u32 h)
 {
-    dno->refcount++;
+    struct fsw_negcache_entry *entry;
+
+    if (vol->negcache == NULL)
+        return 0;
+    entry = fsw_negcache_slot(vol, dno, h);
+    return (entry->name_size != 0 && entry->name_hash == h && entry->name_size == (fsw_u32)name->size &&
+            entry->dnode_id == dno->dnode_id && entry->tree_id == dno->tree_id &&
+            fsw_memeq(entry->name, name->data, name->size));
 }
 
 /**
- * Release a dnode pointer, deallocating it if this was the last reference.
- * This function decrements the reference counter of the dnode. If the counter
- * reaches zero, the dnode is freed. Since the parent dnode is released
- * during that process, this function may cause it to be freed, too.
+ * Remember that a name does not exist in a directory. Names that are too long are not
+ * cached. The cache is allocated on the first miss and counts against the budget.
  */
 
-void fsw_dnode_release(struct fsw_dnode *dno)
+static void fsw_negcache_add(struct fsw_volume *vol, struct fsw_dnode *dno, struct fsw_string *name, fsw_u32 h)
 {
-    struct fsw_volume *vol = dno->vol;
-    struct fsw_dnode *parent_dno;
-
-    dno->refcount--;
-
-    if (dno->refcount == 0) {
-        parent_dno = dno->parent;
-
-        // de-register from volume's list
-        if (dno->next)
-            dno->next->prev = dno->prev;
-        if (dno->prev)
-            dno->prev->next = dno->next;
-        if (vol->dnode_head == dno)
-            vol->dnode_head = dno->next;
-
-        // run fstype-specific cleanup
-        vol->fstype_table->dnode_free(vol, dno);
-
-        fsw_strfree(&dno->name);
-        fsw_free(dno);
-
-        // release our pointer to the parent, possibly deallocating it, too
-        if (parent_dno)
-            fsw_dnode_release(parent_dno);
+    struct fsw_negcache_entry *entry;
+    fsw_u32         size = FSW_NEGCACHE_SIZE * sizeof(struct fsw_negcache_entry);
+
+    if (name->size == 0 || name->size > FSW_NEGCACHE_NAME_MAX)
+        return;
+    if (vol->negcache == NULL) {
+        if (fsw_blockcache_over_budget(vol, size) || fsw_alloc_zero(size, (void **)&vol->negcache))
+            return;
+        vol->dir_index_bytes += size;
+        fsw_bcache_driver_bytes += size;
     }
+
+    entry = fsw_negcache_slot(vol, dno, h);
+    entry->tree_id = dno->tree_id;
+    entry->dnode_id = dno->dnode_id;
+    entry->name_hash = h;
+    entry->name_size = name->size;
+    fsw_memcpy(entry->name, name->data, name->size);
 }
 
 /**
- * Get full information about a dnode from disk. This function is called by the host
- * driver as well as by the core functions. Some file systems defer reading full
- * information on a dnode until it is actually needed (i.e. separation between
- * directory and inode information). This function makes sure that all information
- * is available in the dnode structure. The following fields may not have a correct
- * value until fsw_dnode_fill has been called:
- *
- * type, size
+ * Free the negative lookup cache of a volume.
  */
 
-fsw_status_t fsw_dnode_fill(struct fsw_dnode *dno)
+static void fsw_negcache_free(struct fsw_volume *vol)
 {
-    // TODO: check a flag right here, call fstype's dnode_fill only once per dnode
-
-    return dno->vol->fstype_table->dnode_fill(dno->vol, dno);
+    fsw_u32         size = FSW_NEGCACHE_SIZE * sizeof(struct fsw_negcache_entry);
+
+    if (vol->negcache == NULL)
+        return;
+    fsw_free(vol->negcache);
+    vol->negcache = NULL;
+    vol->dir_index_bytes -= size;
+    fsw_bcache_driver_bytes -= size;
 }
 
 /**
- * Get extended information about a dnode. This function can be called by the host
- * driver to get a full compliment of information about a dnode in addition to the
- * fields of the fsw_dnode structure itself.
- *
- * Some data requires host-specific conversion to be useful (i.e. timestamps) and
- * will be passed to callback functions instead of being written into the structure.
- * These callbacks must be filled in by the caller.
+ * Look up a name in a directory. Names that were not found before are answered from
+ * the volume's negative lookup cache. Otherwise the lookup goes to the directory's
+ * name index if the file system allows it and doesn't index the directory itself,
+ * or to the fstype's dir_lookup.
  */
 
-fsw_status_t fsw_dnode_stat(struct fsw_dnode *dno, struct fsw_dnode_stat *sb)
+static fsw_status_t fsw_dnode_dir_lookup(struct fsw_dnode *dno,
+                                         struct fsw_string *lookup_name, struct fsw_dnode **child_dno_out)
 {
     fsw_status_t    status;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_string name;
+    fsw_u32         h;
+
+    // bring the name into the host encoding for hashing and comparing
+    if (lookup_name->type == vol->host_string_type) {
+        name = *lookup_name;
+    } else {
+        status = fsw_strdup_coerce(&name, vol->host_string_type, lookup_name);
+        if (status)
+            return status;
+    }
+    h = fsw_dnode_name_hash(&name);
+
+    vol->stats.negcache_lookups++;
+    if (fsw_negcache_find(vol, dno, &name, h)) {
+        vol->stats.negcache_hits++;
+        status = FSW_NOT_FOUND;
+    } else {
+        if ((vol->fstype_table->flags & FSW_FSTYPE_DIR_INDEX) && !dno->dir_index_failed &&
+            !dno->dir_lookup_indexed)
+            status = fsw_dir_index_lookup(dno, lookup_name, &name, h, child_dno_out);
+        else
+            status = fsw_fstype_dir_lookup(vol, dno, lookup_name, child_dno_out);
+        if (status == FSW_NOT_FOUND)
+            fsw_negcache_add(vol, dno, &name, h);
+    }
 
-    status = fsw_dnode_fill(dno);
-    if (status)
-        return status;
-
-    sb->used_bytes = 0;
-    status = dno->vol->fstype_table->dnode_stat(dno->vol, dno, sb);
-    if (!status && !sb->used_bytes)
-        sb->used_bytes = FSW_U64_DIV(dno->size + dno->vol->log_blocksize - 1, dno->vol->log_blocksize);
+    if (name.data != lookup_name->data)
+        fsw_strfree(&name);
     return status;
 }
 
@@ -548,7 +1607,7 @@ fsw_status_t fsw_dnode_lookup(struct fsw_dnode *dno,
     if (dno->type != FSW_DNODE_TYPE_DIR)
         return FSW_UNSUPPORTED;
 
-    return dno->vol->fstype_table->dir_lookup(dno->vol, dno, lookup_name, child_dno_out);
+    return fsw_dnode_dir_lookup(dno, lookup_name, child_dno_out);
 }
 
 /**
@@ -640,7 +1699,7 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
 
             } else {
                 // do an actual lookup
-                status = vol->fstype_table->dir_lookup(vol, dno, &lookup_name, &child_dno);
+                status = fsw_dnode_dir_lookup(dno, &lookup_name, &child_dno);
                 if (status)
                     goto errorexit;
             }
@@ -681,18 +1740,80 @@ fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **ch
 {
     fsw_status_t    status;
     struct fsw_dnode *dno = shand->dnode;
-    fsw_u64         saved_pos;
+    struct fsw_volume *vol = dno->vol;
+    fsw_u64         saved_pos, t0;
 
     if (dno->type != FSW_DNODE_TYPE_DIR)
         return FSW_UNSUPPORTED;
 
     saved_pos = shand->pos;
-    status = dno->vol->fstype_table->dir_read(dno->vol, dno, shand, child_dno_out);
+    t0 = fsw_ticks();
+    status = vol->fstype_table->dir_read(vol, dno, shand, child_dno_out);
+    vol->stats.dir_read_ticks += fsw_ticks() - t0;
+    vol->stats.dir_read_calls++;
     if (status)
         shand->pos = saved_pos;
     return status;
 }
 
+/**
+ * Get the next batch of directory items, with full information (readdir-plus). This
+ * function reads up to *count_inout entries like fsw_dnode_dir_read, stopping after
+ * the entry that takes the iteration into the next directory block, and fills them
+ * all. Only file systems with FSW_FSTYPE_DIR_POS_BYTES have directory blocks to go by;
+ * for the others, a batch is a single entry. The entries are filled in the order of their dnode ids, so that file systems
+ * with inode tables go through the table blocks of the batch once, in order.
+ *
+ * When the end of the directory is reached, this function returns FSW_NOT_FOUND.
+ * Otherwise child_dnos[0] to child_dnos[*count_inout - 1] hold the entries in
+ * directory order, and the caller must call fsw_dnode_release on each. An entry
+ * that could not be filled is returned anyway; filling it again reports the error.
+ */
+
+fsw_status_t fsw_dnode_dir_read_plus(struct fsw_shandle *shand, struct fsw_dnode **child_dnos,
+                                     fsw_u32 *count_inout)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = shand->dnode->vol;
+    struct fsw_dnode *sorted[FSW_DIR_READ_PLUS_MAX];
+    fsw_u64         block;
+    fsw_u32         count, max_count, i, j;
+
+    max_count = *count_inout;
+    if (max_count > FSW_DIR_READ_PLUS_MAX)
+        max_count = FSW_DIR_READ_PLUS_MAX;
+    if (!(vol->fstype_table->flags & FSW_FSTYPE_DIR_POS_BYTES))
+        max_count = 1;
+    *count_inout = 0;
+
+    // read the entries up to the end of the current directory block
+    block = FSW_U64_DIV(shand->pos, vol->log_blocksize);
+    for (count = 0; count < max_count; count++) {
+        status = fsw_dnode_dir_read(shand, &child_dnos[count]);
+        if (status) {
+            if (count == 0)
+                return status;
+            break;      // the error comes up again with the next batch
+        }
+        if (FSW_U64_DIV(shand->pos, vol->log_blocksize) != block) {
+            count++;
+            break;
+        }
+    }
+
+    // fill them in dnode id order
+    for (i = 0; i < count; i++) {
+        for (j = i; j > 0 && sorted[j - 1]->dnode_id > child_dnos[i]->dnode_id; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = child_dnos[i];
+    }
+    for (i = 0; i < count; i++)
+        fsw_dnode_fill(sorted[i]);
+
+    *count_inout = count;
+    return FSW_SUCCESS;
+}
+
 /**
  * Read the target path of a symbolic link. This function is called by the host driver
  * to read the "content" of a symbolic link, that is the relative or absolute path
@@ -821,6 +1942,41 @@ errorexit:
     return status;
 }
 
+/**
+ * Allocate zeroed memory for a cache that a file system keeps for a dnode, such as
+ * copies of its indirect blocks. The memory counts against the cache budget, so the
+ * block cache gives way to it; the fstype's dnode_trim hook lets the shrinker take it
+ * back from idle volumes. A file system should start over once dno->cache_bytes
+ * reaches FSW_DNODE_CACHE_MAX_BYTES.
+ */
+
+fsw_status_t fsw_dnode_cache_alloc(struct fsw_dnode *dno, fsw_u32 size, void **ptr_out)
+{
+    fsw_status_t    status;
+
+    status = fsw_alloc_zero(size, ptr_out);
+    if (status)
+        return status;
+    dno->cache_bytes += size;
+    dno->vol->dnode_cache_bytes += size;
+    fsw_bcache_driver_bytes += size;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free memory allocated with fsw_dnode_cache_alloc.
+ */
+
+void fsw_dnode_cache_free(struct fsw_dnode *dno, fsw_u32 size, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    fsw_free(ptr);
+    dno->cache_bytes -= size;
+    dno->vol->dnode_cache_bytes -= size;
+    fsw_bcache_driver_bytes -= size;
+}
+
 /**
  * Set up a shandle (storage handle) to access a file's data. This function is called
  * by the host driver and by the core when they need to access a file's data. It is also
@@ -851,6 +2007,16 @@ fsw_status_t fsw_shandle_open(struct fsw_dnode *dno, struct fsw_shandle *shand)
     shand->dnode = dno;
     shand->pos = 0;
     shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+    shand->extents = NULL;
+    shand->extent_count = 0;
+
+    shand->ra_next_pos = (fsw_u64)-1;   // no read yet, so the first one isn't sequential
+    shand->ra_window = FSW_READAHEAD_MIN_BYTES;
+    shand->ra_buffer_size = 0;
+    shand->ra_buffer = NULL;
+    shand->ra_start = 0;
+    shand->ra_len = 0;
+    shand->ra_used = 0;
 
     return FSW_SUCCESS;
 }
@@ -864,14 +2030,181 @@ fsw_status_t fsw_shandle_open(struct fsw_dnode *dno, struct fsw_shandle *shand)
 
 void fsw_shandle_close(struct fsw_shandle *shand)
 {
+    struct fsw_volume *vol = shand->dnode->vol;
+
     if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
         fsw_free(shand->extent.buffer);
+    if (shand->extents != NULL)
+        fsw_free(shand->extents);
+    if (shand->ra_buffer != NULL) {
+        vol->stats.readahead_wasted_bytes += shand->ra_len - shand->ra_used;
+        fsw_free(shand->ra_buffer);
+        vol->readahead_mem_bytes -= shand->ra_buffer_size;
+        fsw_bcache_driver_bytes -= shand->ra_buffer_size;
+    }
     fsw_dnode_release(shand->dnode);
 }
 
+/**
+ * Look for a logical block in the extent list of a shandle and make the extent that
+ * covers it the current extent. The list is sorted, so this is a binary search.
+ * Returns zero if the block is not covered.
+ */
+
+static int fsw_shandle_find_extent(struct fsw_shandle *shand, fsw_u64 log_bno)
+{
+    fsw_u32         lo, hi, mid;
+
+    lo = 0;
+    hi = shand->extent_count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (log_bno < shand->extents[mid].log_start)
+            hi = mid;
+        else if (log_bno >= shand->extents[mid].log_start + shand->extents[mid].log_count)
+            lo = mid + 1;
+        else {
+            shand->extent = shand->extents[mid];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Make the extent that covers a logical block the current extent of a shandle. If the
+ * file system has get_extents, a whole list of extents is mapped at once and kept with
+ * the shandle, so that crossing into the next extent needs no walk of the file's
+ * mapping structures. Otherwise, or if that fails, get_extent maps the single extent.
+ */
+
+static fsw_status_t fsw_shandle_get_extent(struct fsw_shandle *shand, fsw_u64 log_bno)
+{
+    fsw_status_t    status;
+    struct fsw_dnode *dno = shand->dnode;
+    struct fsw_volume *vol = dno->vol;
+    fsw_u32         count;
+    fsw_u64         t0;
+
+    if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
+        fsw_free(shand->extent.buffer);
+    shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+
+    if (vol->fstype_table->get_extents != NULL) {
+        if (fsw_shandle_find_extent(shand, log_bno))
+            return FSW_SUCCESS;
+
+        if (shand->extents != NULL ||
+            fsw_alloc(FSW_SHANDLE_EXTENTS * sizeof(struct fsw_extent), &shand->extents) == FSW_SUCCESS) {
+            count = FSW_SHANDLE_EXTENTS;
+            t0 = fsw_ticks();
+            status = vol->fstype_table->get_extents(vol, dno, log_bno, shand->extents, &count);
+            vol->stats.get_extent_ticks += fsw_ticks() - t0;
+            vol->stats.get_extent_calls++;
+            shand->extent_count = 0;
+            if (status == FSW_SUCCESS) {
+                shand->extent_count = count;
+                vol->stats.extent_batches++;
+            }
+            if (fsw_shandle_find_extent(shand, log_bno))
+                return FSW_SUCCESS;
+        }
+    }
+
+    // ask the file system for the proper extent
+    shand->extent.log_start = log_bno;
+    t0 = fsw_ticks();
+    status = vol->fstype_table->get_extent(vol, dno, &shand->extent);
+    vol->stats.get_extent_ticks += fsw_ticks() - t0;
+    vol->stats.get_extent_calls++;
+    vol->stats.extent_lookups++;
+    if (status) {
+        shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+        return status;
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Fill the readahead window of a shandle, starting with the physical block that holds
+ * pos. The window covers at most shand->ra_window bytes and never extends past the
+ * current extent or the end of the file, so that it is a single read_blocks request.
+ * Data left over from the previous window is counted as wasted. Returns an error if
+ * readahead is not worthwhile, no buffer memory is available or the read failed; the
+ * caller then reads through the block cache as usual.
+ */
+
+static fsw_status_t fsw_shandle_readahead(struct fsw_shandle *shand, fsw_u64 pos,
+                                          fsw_u64 pos_in_extent, fsw_u64 phys_bno)
+{
+    fsw_status_t    status;
+    struct fsw_dnode *dno = shand->dnode;
+    struct fsw_volume *vol = dno->vol;
+    fsw_u64         start, avail;
+    fsw_u32         count, max_count;
+
+    start = pos - (pos & (vol->phys_blocksize - 1));
+    avail = shand->extent.log_count * vol->log_blocksize - (pos_in_extent - (pos - start));
+    if (avail > dno->size - start)
+        avail = dno->size - start;
+    if (avail > shand->ra_window)
+        avail = shand->ra_window;
+    count = (fsw_u32)FSW_U64_DIV(avail + vol->phys_blocksize - 1, vol->phys_blocksize);
+    if (count < 2)
+        return FSW_UNSUPPORTED;
+
+    // get a buffer for the whole window, or make do with the one we have
+    if (shand->ra_buffer_size < shand->ra_window &&
+        !fsw_blockcache_over_budget(vol, shand->ra_window - shand->ra_buffer_size)) {
+        if (shand->ra_buffer != NULL) {
+            vol->stats.readahead_wasted_bytes += shand->ra_len - shand->ra_used;
+            shand->ra_len = shand->ra_used = 0;
+            fsw_free(shand->ra_buffer);
+            vol->readahead_mem_bytes -= shand->ra_buffer_size;
+            fsw_bcache_driver_bytes -= shand->ra_buffer_size;
+            shand->ra_buffer = NULL;
+            shand->ra_buffer_size = 0;
+        }
+        if (fsw_alloc(shand->ra_window, &shand->ra_buffer) == FSW_SUCCESS) {
+            shand->ra_buffer_size = shand->ra_window;
+            vol->readahead_mem_bytes += shand->ra_buffer_size;
+            fsw_bcache_driver_bytes += shand->ra_buffer_size;
+        }
+    }
+    max_count = shand->ra_buffer_size / vol->phys_blocksize;
+    if (count > max_count)
+        count = max_count;
+    if (count < 2)
+        return FSW_UNSUPPORTED;
+
+    vol->stats.readahead_wasted_bytes += shand->ra_len - shand->ra_used;
+    shand->ra_len = shand->ra_used = 0;
+    status = fsw_device_read(vol, phys_bno, count, shand->ra_buffer);
+    if (status)
+        return status;
+    vol->stats.readahead_reads++;
+
+    shand->ra_start = start;
+    shand->ra_len = count * vol->phys_blocksize;
+    if (shand->ra_len > dno->size - start)
+        shand->ra_len = (fsw_u32)(dno->size - start);
+
+    // the reader kept up, so look further ahead next time
+    shand->ra_window *= 2;
+    if (shand->ra_window > FSW_READAHEAD_MAX_BYTES)
+        shand->ra_window = FSW_READAHEAD_MAX_BYTES;
+    return FSW_SUCCESS;
+}
+
 /**
  * Read data from a shandle (storage handle for a dnode). This function is called by the
  * host driver or internally when data is read from a file. TODO: more
+ *
+ * Reads of file data that continue where the previous read on the same shandle stopped
+ * are served from a readahead window, if the host has read_blocks. The window starts
+ * at FSW_READAHEAD_MIN_BYTES, doubles with every refill up to FSW_READAHEAD_MAX_BYTES
+ * and falls back to the minimum as soon as the reader seeks elsewhere. Reads that are
+ * larger than the window bypass it and go straight to the disk.
  */
 
 fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_inout, void *buffer_in)
@@ -883,6 +2216,7 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
     fsw_u64         buflen, copylen, pos;
     fsw_u64         log_bno, pos_in_extent, phys_bno, pos_in_physblock;
     fsw_u32         cache_level;
+    int             sequential;
 
     if (shand->pos >= dno->size) {   // already at EOF
         *buffer_size_inout = 0;
@@ -898,23 +2232,38 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
     if (buflen > dno->size - pos)
         buflen = (fsw_u32)(dno->size - pos);
 
+    // detect sequential access for readahead
+    sequential = (dno->type == FSW_DNODE_TYPE_FILE && vol->host_table->read_blocks != NULL &&
+                  shand->pos == shand->ra_next_pos);
+    if (!sequential)
+        shand->ra_window = FSW_READAHEAD_MIN_BYTES;
+
     while (buflen > 0) {
+        // serve from the readahead window if possible
+        if (pos >= shand->ra_start && pos < shand->ra_start + shand->ra_len) {
+            copylen = shand->ra_start + shand->ra_len - pos;
+            if (copylen > buflen)
+                copylen = buflen;
+            fsw_memcpy(buffer, shand->ra_buffer + (pos - shand->ra_start), copylen);
+            if (pos + copylen - shand->ra_start > shand->ra_used) {
+                vol->stats.readahead_useful_bytes += pos + copylen - shand->ra_start - shand->ra_used;
+                shand->ra_used = (fsw_u32)(pos + copylen - shand->ra_start);
+            }
+
+            buffer += copylen;
+            buflen -= copylen;
+            pos    += copylen;
+            continue;
+        }
+
         // get extent for the current logical block
         log_bno = FSW_U64_DIV(pos, vol->log_blocksize);
         if (shand->extent.type == FSW_EXTENT_TYPE_INVALID ||
             log_bno < shand->extent.log_start ||
             log_bno >= shand->extent.log_start + shand->extent.log_count) {
-
-            if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER)
-                fsw_free(shand->extent.buffer);
-
-            // ask the file system for the proper extent
-            shand->extent.log_start = log_bno;
-            status = vol->fstype_table->get_extent(vol, dno, &shand->extent);
-            if (status) {
-                shand->extent.type = FSW_EXTENT_TYPE_INVALID;
+            status = fsw_shandle_get_extent(shand, log_bno);
+            if (status)
                 return status;
-            }
         }
 
         pos_in_extent = pos - shand->extent.log_start * vol->log_blocksize;
@@ -924,12 +2273,35 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
             // convert to physical block number and offset
             phys_bno = shand->extent.phys_start + FSW_U64_DIV(pos_in_extent, vol->phys_blocksize);
             pos_in_physblock = pos_in_extent & (vol->phys_blocksize - 1);
+
+            if (sequential && buflen < shand->ra_window &&
+                fsw_shandle_readahead(shand, pos, pos_in_extent, phys_bno) == FSW_SUCCESS)
+                continue;   // served from the new window on the next pass
+
+            if (dno->type == FSW_DNODE_TYPE_FILE && pos_in_physblock == 0 && buflen >= vol->phys_blocksize) {
+                // whole blocks of file data: read them straight into the caller's buffer
+                copylen = shand->extent.log_count * vol->log_blocksize - pos_in_extent;
+                if (copylen > buflen)
+                    copylen = buflen;
+                copylen &= ~(fsw_u64)(vol->phys_blocksize - 1);
+                status = fsw_block_read_direct(vol, phys_bno,
+                                               (fsw_u32)FSW_U64_DIV(copylen, vol->phys_blocksize), buffer);
+                if (status)
+                    return status;
+
+                buffer += copylen;
+                buflen -= copylen;
+                pos    += copylen;
+                continue;
+            }
+
             copylen = vol->phys_blocksize - pos_in_physblock;
             if (copylen > buflen)
                 copylen = buflen;
 
             // get one physical block
-            status = fsw_block_get(vol, phys_bno, cache_level, (void **)&block_buffer);
+            status = fsw_block_get_lendable(vol, phys_bno, cache_level, dno->type == FSW_DNODE_TYPE_FILE,
+                                            (void **)&block_buffer);
             if (status)
                 return status;
 
@@ -958,6 +2330,7 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
 
     *buffer_size_inout = (fsw_u32)(pos - shand->pos);
     shand->pos = pos;
+    shand->ra_next_pos = pos;
 
     return FSW_SUCCESS;
 }
@@ -56,6 +56,59 @@
 /** Indicates that the block cache entry is empty. */
 #define FSW_INVALID_BNO 0xFFFFFFFFFFFFFFFF
 
+#ifndef FSW_BCACHE_VOLUME_BUDGET
+/** Default limit for the block cache memory of a single volume, in bytes. */
+#define FSW_BCACHE_VOLUME_BUDGET (8 * 1024 * 1024)
+#endif
+
+#ifndef FSW_BCACHE_DRIVER_BUDGET
+/** Default limit for the block cache memory of all volumes of this driver, in bytes. */
+#define FSW_BCACHE_DRIVER_BUDGET (32 * 1024 * 1024)
+#endif
+
+/** Value for fsw_set_cache_budget that goes back to the build-time default. */
+#define FSW_BCACHE_BUDGET_DEFAULT ((fsw_u64)-1)
+
+#ifndef FSW_BCACHE_READAHEAD_BYTES
+/** Amount of data the block cache reads ahead on sequential misses, if the host has read_blocks. */
+#define FSW_BCACHE_READAHEAD_BYTES (64 * 1024)
+#endif
+
+#ifndef FSW_SHANDLE_EXTENTS
+/** Number of extents a shandle asks for at once from a file system that has get_extents. */
+#define FSW_SHANDLE_EXTENTS (64)
+#endif
+
+#ifndef FSW_READAHEAD_MIN_BYTES
+/** Initial readahead window of a file handle, used again after a non-sequential read. */
+#define FSW_READAHEAD_MIN_BYTES (64 * 1024)
+#endif
+
+#ifndef FSW_READAHEAD_MAX_BYTES
+/** Largest readahead window of a file handle; the window doubles with each sequential refill. */
+#define FSW_READAHEAD_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+#ifndef FSW_DNODE_CACHE_MAX_BYTES
+/** Memory a file system keeps per dnode with fsw_dnode_cache_alloc before it starts over. */
+#define FSW_DNODE_CACHE_MAX_BYTES (256 * 1024)
+#endif
+
+/** Number of dnode structures carved from one slab chunk. */
+#define FSW_DNODE_SLAB_OBJECTS (32)
+/** Size of one chunk of the per-volume name arena, in bytes. */
+#define FSW_NAME_ARENA_CHUNK (4096)
+/** Most memory the per-volume name arena takes; names beyond that use fsw_alloc. */
+#define FSW_NAME_ARENA_LIMIT (64 * 1024)
+
+/** Number of entries in the negative lookup cache of a volume (power of 2). */
+#define FSW_NEGCACHE_SIZE (256)
+/** Longest name, in bytes of the host encoding, kept in the negative lookup cache. */
+#define FSW_NEGCACHE_NAME_MAX (128)
+
+/** Mount flag: verify the checksums of on-disk structures where the file system has them. */
+#define FSW_MOUNT_VERIFY_CHECKSUMS (1)
+
 
 //
 // Byte-swapping macros
@@ -205,16 +258,100 @@ enum {
 /* forward declarations */
 
 struct fsw_dnode;
+struct fsw_dir_index;
 struct fsw_host_table;
 struct fsw_fstype_table;
 
+/**
+ * Core: Negative lookup cache entry, remembering a name that does not exist in a directory.
+ */
+
+struct fsw_negcache_entry {
+    fsw_u64     tree_id;            //!< Tree (btrfs subvolume) of the directory
+    fsw_u64     dnode_id;           //!< Directory the name was looked up in
+    fsw_u32     name_hash;          //!< Hash of the name
+    fsw_u32     name_size;          //!< Size of the name in bytes, zero if the entry is unused
+    fsw_u8      name[FSW_NEGCACHE_NAME_MAX];    //!< Name in the host string encoding
+};
+
 struct fsw_blockcache {
     fsw_u32     refcount;           //!< Reference count
     fsw_u32     cache_level;        //!< Level of importance of this block
+    fsw_u32     clock_weight;       //!< Remaining CLOCK sweeps before the entry may be replaced
+    fsw_u32     hash_next;          //!< Index of the next entry in the same hash chain
     fsw_u64     phys_bno;           //!< Physical block number
     void        *data;              //!< Block data buffer
 };
 
+/**
+ * Core: A slab allocator for objects of one size. Objects are carved from larger chunks
+ * and recycled through a free list; the chunks are only given back by fsw_slab_free.
+ */
+
+struct fsw_slab {
+    fsw_u32     object_size;        //!< Size of one object, rounded up for alignment
+    fsw_u32     chunk_objects;      //!< Number of objects carved from one chunk
+    void        *free_list;         //!< Free objects, linked through their first bytes
+    void        *chunks;            //!< Chunks, linked through their first bytes
+    fsw_u32     allocs;             //!< Objects handed out
+    fsw_u32     chunk_allocs;       //!< Chunks allocated from the host
+};
+
+/**
+ * Core: A bump allocator. Memory is handed out from larger chunks in order and only
+ * given back by fsw_arena_free, except that the latest allocation can be taken back.
+ */
+
+struct fsw_arena {
+    fsw_u8      *chunk;             //!< Current chunk, its first bytes link to the previous one
+    fsw_u32     chunk_size;         //!< Size of one chunk
+    fsw_u32     used;               //!< Bytes used in the current chunk
+    fsw_u32     limit;              //!< Most memory the arena may take from the host
+    fsw_u32     total;              //!< Memory taken from the host so far
+    fsw_u32     allocs;             //!< Allocations served
+    fsw_u32     chunk_allocs;       //!< Chunks allocated from the host
+    fsw_u32     rollbacks;          //!< Allocations taken back because they were freed right away
+};
+
+/**
+ * Core: Counters kept for a volume, for finding out where a driver spends its time.
+ * Ticks are measured with fsw_ticks and include any work done by nested calls.
+ */
+
+struct fsw_volume_stats {
+    fsw_u64     bcache_hits;        //!< Blocks found in the block cache
+    fsw_u64     bcache_misses;      //!< Blocks not found in the block cache
+    fsw_u64     bcache_lent;        //!< Misses served by lending file data from the host's cache
+    fsw_u64     bcache_evictions;   //!< Cached blocks replaced by other blocks
+    fsw_u64     bcache_budget_evictions;    //!< Blocks replaced because the budget did not allow new memory
+    fsw_u64     bcache_shrink_frees;        //!< Block buffers freed by the shrinker
+    fsw_u64     bcache_readahead_blocks;    //!< Blocks put into the cache by readahead
+    fsw_u64     device_reads;       //!< Requests passed to the host's read_block or read_blocks
+    fsw_u64     device_read_bytes;  //!< Bytes read by those requests
+    fsw_u64     device_read_ticks;  //!< Time spent in those requests
+    fsw_u64     get_extent_calls;   //!< Calls to the fstype's get_extent or get_extents
+    fsw_u64     get_extent_ticks;   //!< Time spent in those calls
+    fsw_u64     dir_lookup_calls;   //!< Calls to the fstype's dir_lookup
+    fsw_u64     dir_lookup_ticks;   //!< Time spent in those calls
+    fsw_u64     dir_read_calls;     //!< Calls to the fstype's dir_read
+    fsw_u64     dir_read_ticks;     //!< Time spent in those calls
+    fsw_u64     negcache_lookups;   //!< Directory lookups that checked the negative lookup cache
+    fsw_u64     negcache_hits;      //!< Directory lookups answered by the negative lookup cache
+    fsw_u64     bulk_reads;         //!< File data reads that bypassed the block cache
+    fsw_u64     bulk_read_bytes;    //!< Bytes read that way
+    fsw_u64     readahead_reads;    //!< Readahead windows filled for shandles
+    fsw_u64     readahead_useful_bytes; //!< Readahead bytes that were handed to a reader
+    fsw_u64     readahead_wasted_bytes; //!< Readahead bytes that were discarded unread
+    fsw_u64     extent_lookups;     //!< Single extents mapped with get_extent
+    fsw_u64     extent_batches;     //!< Extent lists mapped with get_extents
+    // filled in from the allocators by fsw_volume_get_stats
+    fsw_u64     dnode_allocs;       //!< Dnodes handed out by the dnode slab
+    fsw_u64     dnode_chunks;       //!< Chunks the dnode slab took from the host
+    fsw_u64     name_allocs;        //!< Names stored in the name arena
+    fsw_u64     name_chunks;        //!< Chunks the name arena took from the host
+    fsw_u64     name_rollbacks;     //!< Name arena allocations taken back right away
+};
+
 /**
  * Core: Represents a mounted volume.
  */
@@ -227,9 +364,28 @@ struct fsw_volume {
     struct fsw_string label;        //!< Volume label
 
     struct fsw_dnode *dnode_head;   //!< List of all dnodes allocated for this volume
+    struct fsw_dnode **dnode_hash;  //!< Hash chain heads for dnodes, keyed by (tree_id, dnode_id)
+    fsw_u32     dnode_hash_mask;    //!< Number of hash chains minus one (power of 2)
+    fsw_u32     dnode_count;        //!< Number of dnodes on the list
+    struct fsw_slab dnode_slab;     //!< Memory for dnode structures
+    struct fsw_arena name_arena;    //!< Memory for dnode names
 
     struct fsw_blockcache *bcache;  //!< Array of block cache entries
     fsw_u32     bcache_size;        //!< Number of entries in the block cache array
+    fsw_u32     bcache_used;        //!< Number of entries that have been handed out at least once
+    fsw_u32     *bcache_hash;       //!< Hash chain heads (indices into bcache), keyed by phys_bno
+    fsw_u32     bcache_hash_mask;   //!< Number of hash chains minus one (power of 2)
+    fsw_u32     bcache_clock;       //!< CLOCK hand for choosing the next entry to replace
+    fsw_u64     bcache_bytes;       //!< Memory used by the block cache, counted against the budget
+    fsw_u64     bcache_seq_bno;     //!< Block following the last cache miss, for detecting sequential runs
+    fsw_u8      *bcache_ra_buffer;  //!< Staging buffer for readahead through read_blocks
+    fsw_u64     dir_index_bytes;    //!< Memory used by directory indexes and the negative lookup cache
+    struct fsw_negcache_entry *negcache;    //!< Negative lookup cache (FSW_NEGCACHE_SIZE entries)
+    struct fsw_volume *next_volume; //!< List of all mounted volumes, for the shrinker
+    fsw_u64     readahead_mem_bytes;    //!< Memory used by shandle readahead buffers
+    fsw_u64     dnode_cache_bytes;  //!< Memory used by the fstype's per-dnode caches (fsw_dnode_cache_alloc)
+    fsw_u32     mount_flags;        //!< FSW_MOUNT_* flags in effect for this volume
+    struct fsw_volume_stats stats;  //!< Counters for the host to report
 
     void        *host_data;         //!< Hook for a host-specific data structure
     struct fsw_host_table *host_table;      //!< Dispatch table for host-specific functions
@@ -255,6 +411,15 @@ struct fsw_dnode {
 
     struct fsw_dnode *next;         //!< Doubly-linked list of all dnodes: previous dnode
     struct fsw_dnode *prev;         //!< Doubly-linked list of all dnodes: next dnode
+    struct fsw_dnode *hash_next;    //!< Next dnode in the same hash chain
+
+    struct fsw_dir_index *dir_index; //!< Name index of a directory, built by the core on the first lookup
+    int         dir_index_failed;   //!< The name index could not be built, use the fstype's dir_lookup
+    int         dir_lookup_indexed; //!< The fstype's dir_lookup uses an on-disk index, don't build a name index
+    int         name_in_arena;      //!< The name's data lives in the volume's name arena
+    int         filled;             //!< dnode_fill has succeeded, the fstype is not asked again
+    void        *host_info;         //!< Host's cached description of the dnode, fsw_free'd with the dnode
+    fsw_u32     cache_bytes;        //!< Memory the fstype holds for this dnode through fsw_dnode_cache_alloc
 };
 
 /**
@@ -302,6 +467,16 @@ struct fsw_shandle {
 
     fsw_u64     pos;                //!< Current file pointer in bytes
     struct fsw_extent extent;       //!< Current extent
+    struct fsw_extent *extents;     //!< Consecutive extents from get_extents (NULL if none)
+    fsw_u32     extent_count;       //!< Number of valid entries in extents
+
+    fsw_u64     ra_next_pos;        //!< Position following the last read, for detecting sequential access (-1 before the first)
+    fsw_u32     ra_window;          //!< Size of the next readahead window in bytes
+    fsw_u32     ra_buffer_size;     //!< Allocated size of ra_buffer
+    fsw_u8      *ra_buffer;         //!< Readahead buffer (NULL until the first sequential read)
+    fsw_u64     ra_start;           //!< File position of the first byte in ra_buffer
+    fsw_u32     ra_len;             //!< Valid bytes in ra_buffer
+    fsw_u32     ra_used;            //!< Bytes of ra_buffer that were handed to the reader so far
 };
 
 /**
@@ -343,6 +518,11 @@ struct fsw_host_table
                                      fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                                      fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
     fsw_status_t EFIAPI (*read_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+    // optional, may be NULL: read count consecutive blocks in one device request
+    fsw_status_t EFIAPI (*read_blocks)(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer);
+    // optional, may be NULL: lend a block straight from the host's own cache, pinned until put_block
+    fsw_status_t EFIAPI (*get_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out);
+    void         EFIAPI (*put_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
 };
 
 /**
@@ -372,8 +552,35 @@ struct fsw_fstype_table
                              struct fsw_shandle *shand, struct DNODESTRUCTNAME **child_dno);
     fsw_status_t (*readlink)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
                              struct fsw_string *link_target);
+
+    fsw_u32     flags;              //!< FSW_FSTYPE_* flags
+
+    // optional, may be NULL: map up to *count_inout consecutive extents, the first one
+    // covering log_start, each one starting where the previous one ends. Only _PHYSBLOCK
+    // and _SPARSE extents may be returned; stopping early is fine. If this fails or maps
+    // nothing, the core uses get_extent instead.
+    fsw_status_t (*get_extents)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
+                                fsw_u64 log_start, struct fsw_extent *extents, fsw_u32 *count_inout);
+
+    // optional, may be NULL: free everything the dnode holds through fsw_dnode_cache_alloc.
+    // The block cache shrinker calls it on the dnodes of idle volumes to reclaim memory.
+    void         (*dnode_trim)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno);
 };
 
+/**
+ * Flags for fsw_fstype_table. FSW_FSTYPE_DIR_INDEX lets the core answer lookups from a
+ * name index that it builds with dir_read. A file system may only set it if dir_lookup
+ * matches names exactly, and if dir_read, started at the position an earlier call
+ * started at, returns the same entry again.
+ *
+ * FSW_FSTYPE_DIR_POS_BYTES says that dir_read keeps the byte offset into the directory's
+ * data in shand->pos, so that fsw_dnode_dir_read_plus can batch the entries of one
+ * directory block. Without it, shand->pos is opaque to the core (an entry index or a
+ * B-tree key, say), and entries are read one at a time.
+ */
+#define FSW_FSTYPE_DIR_INDEX (1)
+#define FSW_FSTYPE_DIR_POS_BYTES (2)
+
 
 /**
  * \name Volume Functions
@@ -386,7 +593,10 @@ fsw_status_t fsw_mount(void *host_data,
                        struct fsw_volume **vol_out);
 void         fsw_unmount(struct fsw_volume *vol);
 fsw_status_t fsw_volume_stat(struct fsw_volume *vol, struct fsw_volume_stat *sb);
+void         fsw_volume_get_stats(struct fsw_volume *vol, struct fsw_volume_stats *stats);
 
+void         fsw_set_cache_budget(fsw_u64 volume_bytes, fsw_u64 driver_bytes);
+void         fsw_set_mount_flags(fsw_u32 flags);
 void         fsw_set_blocksize(struct VOLSTRUCTNAME *vol, fsw_u32 phys_blocksize, fsw_u32 log_blocksize);
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out);
 void         fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer);
@@ -417,9 +627,13 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
                                    struct fsw_string *lookup_path, char separator,
                                    struct fsw_dnode **child_dno_out);
 fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **child_dno_out);
+fsw_status_t fsw_dnode_dir_read_plus(struct fsw_shandle *shand, struct fsw_dnode **child_dnos,
+                                     fsw_u32 *count_inout);
 fsw_status_t fsw_dnode_readlink(struct fsw_dnode *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_readlink_data(struct DNODESTRUCTNAME *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_resolve(struct fsw_dnode *dno, struct fsw_dnode **target_dno_out);
+fsw_status_t fsw_dnode_cache_alloc(struct DNODESTRUCTNAME *dno, fsw_u32 size, void **ptr_out);
+void         fsw_dnode_cache_free(struct DNODESTRUCTNAME *dno, fsw_u32 size, void *ptr);
 void fsw_store_time_posix(struct fsw_dnode_stat *sb, int which, fsw_u32 posix_time);
 void fsw_store_attr_posix(struct fsw_dnode_stat *sb, fsw_u16 posix_mode);
 void fsw_store_attr_efi(struct fsw_dnode_stat *sb, fsw_u16 attr);
@@ -447,6 +661,16 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
 fsw_status_t fsw_alloc_zero(int len, void **ptr_out);
 fsw_status_t fsw_memdup(void **dest_out, void *src, int len);
 
+void         fsw_slab_init(struct fsw_slab *slab, fsw_u32 object_size, fsw_u32 chunk_objects);
+fsw_status_t fsw_slab_alloc(struct fsw_slab *slab, void **ptr_out);
+void         fsw_slab_release(struct fsw_slab *slab, void *ptr);
+void         fsw_slab_free(struct fsw_slab *slab);
+
+void         fsw_arena_init(struct fsw_arena *arena, fsw_u32 chunk_size, fsw_u32 limit);
+fsw_status_t fsw_arena_alloc(struct fsw_arena *arena, fsw_u32 size, void **ptr_out);
+void         fsw_arena_release(struct fsw_arena *arena, void *ptr, fsw_u32 size);
+void         fsw_arena_free(struct fsw_arena *arena);
+
 /*@}*/
 
 
@@ -459,6 +683,8 @@ int          fsw_strlen(struct fsw_string *s);
 int          fsw_streq(struct fsw_string *s1, struct fsw_string *s2);
 int          fsw_streq_cstr(struct fsw_string *s1, const char *s2);
 fsw_status_t fsw_strdup_coerce(struct fsw_string *dest, int type, struct fsw_string *src);
+fsw_status_t fsw_strdup_coerce_arena(struct fsw_string *dest, int type, struct fsw_string *src,
+                                     struct fsw_arena *arena);
 void         fsw_strsplit(struct fsw_string *lookup_name, struct fsw_string *buffer, char separator);
 
 void         fsw_strfree(struct fsw_string *s);
@@ -77,10 +77,30 @@ EFI_GUID gEfiFileSystemVolumeLabelInfoIdGuid = EFI_FILE_SYSTEM_VOLUME_LABEL_INFO
 #define gEfiSimpleFileSystemProtocolGuid FileSystemProtocol
 #endif
 
+#ifndef EFI_BLOCK_IO_PROTOCOL_REVISION3
+#define EFI_BLOCK_IO_PROTOCOL_REVISION3 ((2 << 16) | 31)
+#endif
+
+/** Vendor GUID for rEFInd's EFI variables, which also hold the driver settings. */
+#define FSW_EFI_REFIND_GUID \
+  { \
+    0x36D08FA7, 0xCF0B, 0x42F5, {0x8F, 0x14, 0x68, 0xDF, 0x73, 0xED, 0x37, 0x40 } \
+  }
+
+static EFI_GUID fsw_efi_refind_guid = FSW_EFI_REFIND_GUID;
+static EFI_GUID fsw_efi_stats_guid = FSW_STATS_PROTOCOL_GUID;
+static EFI_GUID fsw_efi_disk_io2_guid = FSW_EFI_DISK_IO2_PROTOCOL_GUID;
+
 /** Helper macro for stringification. */
 #define FSW_EFI_STRINGIFY(x) #x
 /** Expands to the EFI driver name given the file system type name. */
+#ifdef FSW_EFI_ALL
+#define FSW_EFI_DRIVER_NAME(t) L"rEFInd 0.10.7 Combined File System Driver"
+#else
 #define FSW_EFI_DRIVER_NAME(t) L"rEFInd 0.10.7 " FSW_EFI_STRINGIFY(t) L" File System Driver"
+#endif
+/** Expands to the file system type name as a wide string. */
+#define FSW_EFI_FSTYPE_NAME(t) L"" FSW_EFI_STRINGIFY(t)
 
 // function prototypes
 
@@ -108,11 +128,16 @@ void EFIAPI fsw_efi_change_blocksize(struct fsw_volume *vol,
                               fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                               fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
 fsw_status_t EFIAPI fsw_efi_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+fsw_status_t EFIAPI fsw_efi_read_blocks(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer);
+fsw_status_t EFIAPI fsw_efi_get_block(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out);
+void EFIAPI fsw_efi_put_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
 
 EFI_STATUS fsw_efi_map_status(fsw_status_t fsw_status, FSW_VOLUME_DATA *Volume);
 
 EFI_STATUS EFIAPI fsw_efi_FileSystem_OpenVolume(IN EFI_FILE_IO_INTERFACE *This,
                                                 OUT EFI_FILE **Root);
+EFI_STATUS EFIAPI fsw_efi_Stats_GetStats(IN FSW_STATS_PROTOCOL *This,
+                                         OUT FSW_VOLUME_STATS *Stats);
 EFI_STATUS fsw_efi_dnode_to_FileHandle(IN struct fsw_dnode *dno,
                                        OUT EFI_FILE **NewFileHandle);
 
@@ -132,6 +157,7 @@ EFI_STATUS fsw_efi_dir_open(IN FSW_FILE_DATA *File,
 EFI_STATUS fsw_efi_dir_read(IN FSW_FILE_DATA *File,
                             IN OUT UINTN *BufferSize,
                             OUT VOID *Buffer);
+VOID fsw_efi_dir_batch_drop(IN FSW_FILE_DATA *File);
 EFI_STATUS fsw_efi_dir_setpos(IN FSW_FILE_DATA *File,
                               IN UINT64 Position);
 
@@ -145,20 +171,28 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(IN FSW_VOLUME_DATA *Volume,
                                        OUT VOID *Buffer);
 
 /**
- * Structure for holding disk cache data.
+ * Geometry of the per-volume disk cache of fsw_efi_read_block. The disk is read in
+ * aligned windows of WINDOW_SIZE bytes (more if the device prefers larger transfers),
+ * and every window maps to one set of windows, which are replaced in LRU order.
+ * The number of sets and ways can be changed with the FswReadCache EFI variable.
+ * If the disk has the Disk I/O 2 protocol, sequential reads load the next window
+ * asynchronously while the driver works on the current one. Such a read is waited
+ * for at most WINDOW_WAIT_TIMEOUT microseconds; after that, the window is read
+ * synchronously and the volume stops reading ahead.
  */
 
-#define CACHE_SIZE 131072 /* 128KiB */
-struct cache_data {
-   fsw_u8            *Cache;
-   fsw_u64           CacheStart;
-   BOOLEAN           CacheValid;
-   FSW_VOLUME_DATA   *Volume; // NOTE: Do not deallocate; copied here to ID volume
-};
+#define WINDOW_SIZE 131072 /* 128KiB */
+#define WINDOW_MAX_SIZE (1024 * 1024)
+#define WINDOW_SETS 4
+#define WINDOW_WAYS 2
+#define WINDOW_WAIT_STEP 10 /* microseconds */
+#define WINDOW_WAIT_TIMEOUT 1000000 /* 1 second */
 
-#define NUM_CACHES 2 /* Don't increase without modifying fsw_efi_read_block() */
-static struct cache_data    Caches[NUM_CACHES];
-static int LastRead = -1;
+static UINT32 fsw_efi_window_sets = WINDOW_SETS;
+static UINT32 fsw_efi_window_ways = WINDOW_WAYS;
+
+static VOID fsw_efi_window_wait(FSW_VOLUME_DATA *Volume, FSW_EFI_WINDOW *Window);
+static VOID fsw_efi_window_release(FSW_EFI_WINDOW *Window);
 
 /**
  * Interface structure for the EFI Driver Binding protocol.
@@ -191,28 +225,149 @@ struct fsw_host_table   fsw_efi_host_table = {
     FSW_STRING_TYPE_UTF16,
 
     fsw_efi_change_blocksize,
-    fsw_efi_read_block
+    fsw_efi_read_block,
+    fsw_efi_read_blocks,
+    fsw_efi_get_block,
+    fsw_efi_put_block
+};
+
+#ifdef FSW_EFI_ALL
+
+/**
+ * File system types of the combined driver, built with DRIVERNAME=all. Each entry
+ * names the superblock signature that selects a type; a volume is only offered to
+ * the types whose signature it carries, in the order of this table. ext4 comes
+ * before ext2 because it reads ext2 and ext3 as well.
+ */
+
+extern struct fsw_fstype_table   fsw_ext4_table, fsw_ext2_table, fsw_reiserfs_table,
+                                 fsw_btrfs_table, fsw_hfs_table, fsw_iso9660_table, fsw_ntfs_table;
+
+typedef struct {
+    struct fsw_fstype_table     *Table;
+    CHAR16                      *Name;
+    UINTN                       Offset;         //!< Disk offset of the signature, in bytes
+    UINTN                       Length;         //!< Length of the signature, in bytes
+    CHAR8                       *Signature;
+} FSW_EFI_FSTYPE;
+
+static FSW_EFI_FSTYPE fsw_efi_fstypes[] = {
+    { &fsw_ext4_table,     L"ext4",     1024 + 56,  2, (CHAR8 *) "\x53\xEF" },
+    { &fsw_ext2_table,     L"ext2",     1024 + 56,  2, (CHAR8 *) "\x53\xEF" },
+    { &fsw_reiserfs_table, L"reiserfs", 65536 + 52, 8, (CHAR8 *) "ReIsErFs" },
+    { &fsw_reiserfs_table, L"reiserfs", 65536 + 52, 9, (CHAR8 *) "ReIsEr2Fs" },
+    { &fsw_reiserfs_table, L"reiserfs", 65536 + 52, 9, (CHAR8 *) "ReIsEr3Fs" },
+    { &fsw_reiserfs_table, L"reiserfs", 8192 + 52,  8, (CHAR8 *) "ReIsErFs" },
+    { &fsw_btrfs_table,    L"btrfs",    65536 + 64, 8, (CHAR8 *) "_BHRfS_M" },
+    { &fsw_hfs_table,      L"hfs",      1024,       2, (CHAR8 *) "H+" },
+    { &fsw_hfs_table,      L"hfs",      1024,       2, (CHAR8 *) "HX" },
+    { &fsw_hfs_table,      L"hfs",      1024,       2, (CHAR8 *) "BD" },
+    { &fsw_iso9660_table,  L"iso9660",  32768 + 1,  5, (CHAR8 *) "CD001" },
+    { &fsw_ntfs_table,     L"ntfs",     3,          8, (CHAR8 *) "NTFS    " }
 };
 
+/** Bytes at the start of a volume that hold all the signatures above. */
+#define FSW_EFI_PROBE_SIZE (68 * 1024)
+
+#else
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
+#endif
+
 
+/**
+ * Release the disk cache of a volume. Called by the FSW core when it drops its own
+ * block cache, which includes unmounting the volume. The core only lends blocks for
+ * the length of one copy in fsw_shandle_read, so none can be lent at this point, and
+ * all windows are freed; a block given back later would find no window and be ignored.
+ */
 
-VOID EFIAPI fsw_efi_clear_cache(VOID) {
-   int i;
+VOID EFIAPI fsw_efi_clear_cache(struct fsw_volume *vol) {
+   FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   FSW_EFI_WINDOW   *Window;
+   UINTN            i, Count;
+
+   if (Volume == NULL || Volume->Windows == NULL)
+      return;
+   Count = (UINTN) Volume->WindowSets * Volume->WindowWays;
+
+   // stop the readahead in flight before its buffers go away
+   for (i = 0; i < Count; i++) {
+      if (Volume->Windows[i].Pending) {
+         refit_call1_wrapper(Volume->DiskIo2->Cancel, Volume->DiskIo2);
+         break;
+      }
+   }
 
-   // clear the cache
-   for (i = 0; i < NUM_CACHES; i++) {
-      if (Caches[i].Cache != NULL) {
-         FreePool(Caches[i].Cache);
-         Caches[i].Cache = NULL;
-      } // if
-            Caches[i].CacheStart = 0;
-            Caches[i].CacheValid = FALSE;
-            Caches[i].Volume = NULL;
+   for (i = 0; i < Count; i++) {
+      Window = &Volume->Windows[i];
+      fsw_efi_window_wait(Volume, Window);
+      fsw_efi_window_release(Window);
    }
-   LastRead = -1;
+   Volume->WindowNext = Volume->BulkNext = 0;
+   FreePool(Volume->Windows);
+   Volume->Windows = NULL;
 } // VOID EFIAPI fsw_efi_clear_cache();
 
+/**
+ * Read the disk cache geometry from the FswReadCache EFI variable, if it is set.
+ * The variable holds two UINT32 values: the number of sets (rounded down to a
+ * power of 2) and the number of windows per set. Zero keeps the build-time default.
+ */
+
+static VOID fsw_efi_read_window_config(VOID)
+{
+    EFI_STATUS  Status;
+    UINT32      Config[2];
+    UINTN       Size = sizeof(Config);
+
+    Status = refit_call5_wrapper(RT->GetVariable, L"FswReadCache", &fsw_efi_refind_guid,
+                                 NULL, &Size, Config);
+    if (EFI_ERROR(Status) || Size != sizeof(Config))
+        return;
+    if (Config[0] > 0) {
+        fsw_efi_window_sets = 1;
+        while (fsw_efi_window_sets * 2 <= Config[0] && fsw_efi_window_sets < 1024)
+            fsw_efi_window_sets *= 2;
+    }
+    if (Config[1] > 0)
+        fsw_efi_window_ways = (Config[1] < 64) ? Config[1] : 64;
+}
+
+/**
+ * Read the block cache budget from the FswCacheBudget EFI variable, if it is set.
+ * The variable holds two UINT32 values: the budget for a single volume and the
+ * budget for all volumes of the driver, both in KiB. Zero keeps the build-time default.
+ */
+
+static VOID fsw_efi_read_cache_budget(VOID)
+{
+    EFI_STATUS  Status;
+    UINT32      Budget[2];
+    UINTN       Size = sizeof(Budget);
+
+    Status = refit_call5_wrapper(RT->GetVariable, L"FswCacheBudget", &fsw_efi_refind_guid,
+                                 NULL, &Size, Budget);
+    if (!EFI_ERROR(Status) && Size == sizeof(Budget))
+        fsw_set_cache_budget((fsw_u64)Budget[0] * 1024, (fsw_u64)Budget[1] * 1024);
+}
+
+/**
+ * Read the mount flags from the FswMountFlags EFI variable, if it is set. The
+ * variable holds one UINT32 with FSW_MOUNT_* bits, such as 1 to verify checksums.
+ */
+
+static VOID fsw_efi_read_mount_flags(VOID)
+{
+    EFI_STATUS  Status;
+    UINT32      Flags;
+    UINTN       Size = sizeof(Flags);
+
+    Status = refit_call5_wrapper(RT->GetVariable, L"FswMountFlags", &fsw_efi_refind_guid,
+                                 NULL, &Size, &Flags);
+    if (!EFI_ERROR(Status) && Size == sizeof(Flags))
+        fsw_set_mount_flags(Flags);
+}
+
 /**
  * Image entry point. Installs the Driver Binding and Component Name protocols
  * on the image's handle. Actually mounting a file system is initiated through
@@ -228,6 +383,10 @@ EFI_STATUS EFIAPI fsw_efi_main(IN EFI_HANDLE         ImageHandle,
     InitializeLib(ImageHandle, SystemTable);
 #endif
 
+    fsw_efi_read_cache_budget();
+    fsw_efi_read_window_config();
+    fsw_efi_read_mount_flags();
+
     // complete Driver Binding protocol instance
     fsw_efi_DriverBinding_table.ImageHandle          = ImageHandle;
     fsw_efi_DriverBinding_table.DriverBindingHandle  = ImageHandle;
@@ -307,6 +466,51 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Supported(IN EFI_DRIVER_BINDING_PROTOCOL
     return Status;
 }
 
+#ifdef FSW_EFI_ALL
+
+/**
+ * Mount a volume with the combined driver. The start of the volume is read once,
+ * and only the file system types whose superblock signature shows up in it get to
+ * try mounting the volume. *FstypeName is set to the name of the type that did.
+ */
+
+static EFI_STATUS fsw_efi_mount_any(IN FSW_VOLUME_DATA *Volume, OUT CHAR16 **FstypeName)
+{
+    EFI_STATUS          Status;
+    FSW_EFI_FSTYPE      *Fstype;
+    UINT8               *Probe;
+    UINTN               ProbeSize, i;
+
+    ProbeSize = FSW_EFI_PROBE_SIZE;
+    if (Volume->MediaSize > 0 && Volume->MediaSize < ProbeSize)
+        ProbeSize = (UINTN) Volume->MediaSize;
+    Probe = AllocatePool(ProbeSize);
+    if (Probe == NULL)
+        return EFI_OUT_OF_RESOURCES;
+    Status = refit_call5_wrapper(Volume->DiskIo->ReadDisk, Volume->DiskIo, Volume->MediaId,
+                                 0, ProbeSize, (VOID*) Probe);
+    if (EFI_ERROR(Status)) {
+        FreePool(Probe);
+        return Status;
+    }
+
+    Status = EFI_UNSUPPORTED;
+    for (i = 0; i < sizeof(fsw_efi_fstypes) / sizeof(fsw_efi_fstypes[0]) && EFI_ERROR(Status); i++) {
+        Fstype = &fsw_efi_fstypes[i];
+        if (Fstype->Offset + Fstype->Length > ProbeSize ||
+            CompareMem(Probe + Fstype->Offset, Fstype->Signature, Fstype->Length) != 0)
+            continue;
+        Status = fsw_efi_map_status(fsw_mount(Volume, &fsw_efi_host_table, Fstype->Table, &Volume->vol),
+                                    Volume);
+        if (!EFI_ERROR(Status))
+            *FstypeName = Fstype->Name;
+    }
+    FreePool(Probe);
+    return Status;
+}
+
+#endif
+
 /**
  * Driver Binding EFI protocol, Start function. This function is called by EFI
  * to start driving the given device. It is still possible at this point to
@@ -327,7 +531,9 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Start(IN EFI_DRIVER_BINDING_PROTOCOL  *T
     EFI_STATUS          Status;
     EFI_BLOCK_IO        *BlockIo;
     EFI_DISK_IO         *DiskIo;
+    FSW_EFI_DISK_IO2    *DiskIo2;
     FSW_VOLUME_DATA     *Volume;
+    CHAR16              *FstypeName;
 
 #if DEBUG_LEVEL
     Print(L"fsw_efi_DriverBinding_Start\n");
@@ -356,25 +562,50 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Start(IN EFI_DRIVER_BINDING_PROTOCOL  *T
         return Status;
     }
 
+    // Disk I/O 2 is optional, it is only used for readahead
+    Status = refit_call6_wrapper(BS->OpenProtocol, ControllerHandle,
+                              &fsw_efi_disk_io2_guid,
+                              (VOID **) &DiskIo2,
+                              This->DriverBindingHandle,
+                              ControllerHandle,
+                              EFI_OPEN_PROTOCOL_BY_DRIVER);
+    if (EFI_ERROR(Status))
+        DiskIo2 = NULL;
+
     // allocate volume structure
     Volume = AllocateZeroPool(sizeof(FSW_VOLUME_DATA));
     Volume->Signature       = FSW_VOLUME_DATA_SIGNATURE;
     Volume->Handle          = ControllerHandle;
     Volume->DiskIo          = DiskIo;
+    Volume->DiskIo2         = DiskIo2;
     Volume->MediaId         = BlockIo->Media->MediaId;
     Volume->LastIOStatus    = EFI_SUCCESS;
+    Volume->MediaSize       = MultU64x32(BlockIo->Media->LastBlock + 1, BlockIo->Media->BlockSize);
+    if (BlockIo->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3)
+        Volume->OptimalTransfer = BlockIo->Media->OptimalTransferLengthGranularity * BlockIo->Media->BlockSize;
 
     // mount the filesystem
+#ifdef FSW_EFI_ALL
+    Status = fsw_efi_mount_any(Volume, &FstypeName);
+#else
     Status = fsw_efi_map_status(fsw_mount(Volume, &fsw_efi_host_table,
                                           &FSW_FSTYPE_TABLE_NAME(FSTYPE), &Volume->vol),
                                 Volume);
+    FstypeName = FSW_EFI_FSTYPE_NAME(FSTYPE);
+#endif
     if (!EFI_ERROR(Status)) {
         // register the SimpleFileSystem protocol
         Volume->FileSystem.Revision     = EFI_FILE_IO_INTERFACE_REVISION;
         Volume->FileSystem.OpenVolume   = fsw_efi_FileSystem_OpenVolume;
-        Status = refit_call4_wrapper(BS->InstallMultipleProtocolInterfaces, &ControllerHandle,
+        // and the statistics protocol next to it
+        Volume->Stats.Revision          = FSW_STATS_PROTOCOL_REVISION;
+        Volume->Stats.DriverName        = FstypeName;
+        Volume->Stats.GetStats          = fsw_efi_Stats_GetStats;
+        Status = refit_call6_wrapper(BS->InstallMultipleProtocolInterfaces, &ControllerHandle,
                                                        &gEfiSimpleFileSystemProtocolGuid,
                                                        &Volume->FileSystem,
+                                                       &fsw_efi_stats_guid,
+                                                       &Volume->Stats,
                                                        NULL);
         if (EFI_ERROR(Status)) {
 //            Print(L"Fsw ERROR: InstallMultipleProtocolInterfaces returned %x\n", Status);
@@ -391,6 +622,11 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Start(IN EFI_DRIVER_BINDING_PROTOCOL  *T
                           &gEfiDiskIoProtocolGuid,
                           This->DriverBindingHandle,
                           ControllerHandle);
+        if (DiskIo2 != NULL)
+            refit_call4_wrapper(BS->CloseProtocol, ControllerHandle,
+                              &fsw_efi_disk_io2_guid,
+                              This->DriverBindingHandle,
+                              ControllerHandle);
     }
     return Status;
 }
@@ -413,6 +649,7 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Stop(IN  EFI_DRIVER_BINDING_PROTOCOL  *T
     EFI_STATUS          Status;
     EFI_FILE_IO_INTERFACE *FileSystem;
     FSW_VOLUME_DATA     *Volume;
+    BOOLEAN             HasDiskIo2;
 
 #if DEBUG_LEVEL
     Print(L"fsw_efi_DriverBinding_Stop\n");
@@ -432,8 +669,9 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Stop(IN  EFI_DRIVER_BINDING_PROTOCOL  *T
     Volume = FSW_VOLUME_FROM_FILE_SYSTEM(FileSystem);
 
     // uninstall Simple File System protocol
-    Status = refit_call4_wrapper(BS->UninstallMultipleProtocolInterfaces, ControllerHandle,
+    Status = refit_call6_wrapper(BS->UninstallMultipleProtocolInterfaces, ControllerHandle,
                                                      &gEfiSimpleFileSystemProtocolGuid, &Volume->FileSystem,
+                                                     &fsw_efi_stats_guid, &Volume->Stats,
                                                      NULL);
     if (EFI_ERROR(Status)) {
  //       Print(L"Fsw ERROR: UninstallMultipleProtocolInterfaces returned %x\n", Status);
@@ -443,20 +681,23 @@ EFI_STATUS EFIAPI fsw_efi_DriverBinding_Stop(IN  EFI_DRIVER_BINDING_PROTOCOL  *T
     Print(L"fsw_efi_DriverBinding_Stop: protocol uninstalled successfully\n");
 #endif
 
-    // release private data structure
+    // release private data structure, the unmount also drops the disk cache
+    HasDiskIo2 = (Volume->DiskIo2 != NULL);
     if (Volume->vol != NULL)
         fsw_unmount(Volume->vol);
     FreePool(Volume);
 
     // close the consumed protocols
+    if (HasDiskIo2)
+        refit_call4_wrapper(BS->CloseProtocol, ControllerHandle,
+                          &fsw_efi_disk_io2_guid,
+                          This->DriverBindingHandle,
+                          ControllerHandle);
     Status = refit_call4_wrapper(BS->CloseProtocol, ControllerHandle,
                                &gEfiDiskIoProtocolGuid,
                                This->DriverBindingHandle,
                                ControllerHandle);
 
-    // clear the cache
-    fsw_efi_clear_cache();
-
     return Status;
 }
 
@@ -506,87 +747,269 @@ void EFIAPI fsw_efi_change_blocksize(struct fsw_volume *vol,
     // nothing to do
 }
 
+/**
+ * Set up the disk cache of a volume. The window size starts at WINDOW_SIZE and grows
+ * to the device's optimal transfer size, rounded up to a power of 2, if that is larger.
+ * The window buffers themselves are only allocated when they are first filled.
+ */
+
+static EFI_STATUS fsw_efi_window_setup(FSW_VOLUME_DATA *Volume)
+{
+    Volume->WindowSize = WINDOW_SIZE;
+    while (Volume->WindowSize < Volume->OptimalTransfer && Volume->WindowSize < WINDOW_MAX_SIZE)
+        Volume->WindowSize <<= 1;
+    Volume->WindowSets = fsw_efi_window_sets;
+    Volume->WindowWays = fsw_efi_window_ways;
+    Volume->WindowClock = 0;
+    Volume->Windows = AllocateZeroPool(sizeof(FSW_EFI_WINDOW) * Volume->WindowSets * Volume->WindowWays);
+    return (Volume->Windows == NULL) ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
+}
+
+/**
+ * Look up the window for the given aligned disk offset in its set. Returns the window
+ * if it holds that part of the disk, or is being read for it. Otherwise returns NULL
+ * and sets *Victim to the least recently used window of the set that can be replaced,
+ * or to NULL if every window of the set is lent to the FSW core or busy.
+ */
+
+static FSW_EFI_WINDOW *fsw_efi_window_find(FSW_VOLUME_DATA *Volume, UINT64 WindowStart, FSW_EFI_WINDOW **Victim)
+{
+    FSW_EFI_WINDOW      *Set;
+    UINTN               i;
+
+    Set = &Volume->Windows[(UINTN) (DivU64x32(WindowStart, Volume->WindowSize, NULL) & (Volume->WindowSets - 1)) *
+                           Volume->WindowWays];
+    *Victim = NULL;
+    for (i = 0; i < Volume->WindowWays; i++) {
+        if (Set[i].Length > 0 && Set[i].Start == WindowStart)
+            return &Set[i];
+        if (Set[i].Pins == 0 && !Set[i].Pending && (*Victim == NULL ||
+            ((*Victim)->Length > 0 && (Set[i].Length == 0 || Set[i].LastUse < (*Victim)->LastUse))))
+            *Victim = &Set[i];
+    }
+    return NULL;
+}
+
+/**
+ * Number of bytes to read into the window at the given disk offset, which is the
+ * window size except at the end of the disk.
+ */
+
+static UINTN fsw_efi_window_length(FSW_VOLUME_DATA *Volume, UINT64 WindowStart)
+{
+    if (Volume->MediaSize > WindowStart && Volume->MediaSize - WindowStart < Volume->WindowSize)
+        return (UINTN) (Volume->MediaSize - WindowStart);
+    return Volume->WindowSize;
+}
+
+/**
+ * Check whether the caller runs at TPL_APPLICATION. Disk I/O 2 completes requests
+ * from a timer callback, which cannot run while the caller has raised the TPL, so
+ * readahead is only started at TPL_APPLICATION.
+ */
+
+static BOOLEAN fsw_efi_at_application_tpl(VOID)
+{
+    EFI_TPL             OldTpl;
+
+    OldTpl = (EFI_TPL) refit_call1_wrapper(BS->RaiseTPL, TPL_HIGH_LEVEL);
+    refit_call1_wrapper(BS->RestoreTPL, OldTpl);
+    return (OldTpl == TPL_APPLICATION);
+}
+
+/**
+ * Wait for the asynchronous read into a window to complete. If it failed, the
+ * window is left empty. If it does not complete within WINDOW_WAIT_TIMEOUT, it is
+ * cancelled, the window is left empty so that the caller reads it synchronously,
+ * and readahead is turned off for the volume. The window's buffer and event are
+ * abandoned rather than freed, because the firmware may still complete the read.
+ */
+
+static VOID fsw_efi_window_wait(FSW_VOLUME_DATA *Volume, FSW_EFI_WINDOW *Window)
+{
+    UINTN               Waited = 0;
+
+    if (!Window->Pending)
+        return;
+    while (refit_call1_wrapper(BS->CheckEvent, Window->Token.Event) == EFI_NOT_READY) {
+        if (Waited >= WINDOW_WAIT_TIMEOUT) {
+            refit_call1_wrapper(Volume->DiskIo2->Cancel, Volume->DiskIo2);
+            Volume->DiskIo2Stalled = TRUE;
+            Window->Data = NULL;
+            Window->Token.Event = NULL;
+            Window->Pending = FALSE;
+            Window->Length = 0;
+            Window->Prefetched = FALSE;
+            return;
+        }
+        refit_call1_wrapper(BS->Stall, WINDOW_WAIT_STEP);
+        Waited += WINDOW_WAIT_STEP;
+    }
+    Window->Pending = FALSE;
+    if (EFI_ERROR(Window->Token.TransactionStatus)) {
+        Window->Length = 0;
+        Window->Prefetched = FALSE;
+    }
+}
+
+/**
+ * Free the buffer and the completion event of an idle window.
+ */
+
+static VOID fsw_efi_window_release(FSW_EFI_WINDOW *Window)
+{
+    if (Window->Data != NULL) {
+        FreePool(Window->Data);
+        Window->Data = NULL;
+    }
+    if (Window->Token.Event != NULL) {
+        refit_call1_wrapper(BS->CloseEvent, Window->Token.Event);
+        Window->Token.Event = NULL;
+    }
+}
+
+/**
+ * Start reading the window at the given aligned disk offset through Disk I/O 2,
+ * without waiting for the data. Nothing happens if the disk has no Disk I/O 2 or
+ * an earlier read through it timed out, if the caller runs above TPL_APPLICATION,
+ * if the window is already cached, or if the only window that could be replaced is
+ * the one the caller is using right now.
+ */
+
+static VOID fsw_efi_window_prefetch(FSW_VOLUME_DATA *Volume, UINT64 WindowStart)
+{
+    EFI_STATUS          Status;
+    FSW_EFI_WINDOW      *Window;
+
+    if (Volume->DiskIo2 == NULL || Volume->DiskIo2Stalled ||
+        (Volume->MediaSize > 0 && WindowStart >= Volume->MediaSize) || !fsw_efi_at_application_tpl())
+        return;
+    if (fsw_efi_window_find(Volume, WindowStart, &Window) != NULL || Window == NULL ||
+        Window->LastUse == Volume->WindowClock)
+        return;
+
+    if (Window->Data == NULL) {
+        Window->Data = AllocatePool(Volume->WindowSize);
+        if (Window->Data == NULL)
+            return;
+    }
+    if (Window->Token.Event == NULL) {
+        Status = refit_call5_wrapper(BS->CreateEvent, 0, 0, NULL, NULL, &Window->Token.Event);
+        if (EFI_ERROR(Status)) {
+            Window->Token.Event = NULL;
+            return;
+        }
+    }
+    Window->Start = WindowStart;
+    Window->Length = fsw_efi_window_length(Volume, WindowStart);
+    Window->LastUse = Volume->WindowClock;
+    Window->Pending = TRUE;
+    Window->Prefetched = TRUE;
+    Status = refit_call6_wrapper(Volume->DiskIo2->ReadDiskEx, Volume->DiskIo2, Volume->MediaId,
+                                 WindowStart, &Window->Token, Window->Length, (VOID*) Window->Data);
+    if (EFI_ERROR(Status)) {
+        Window->Length = 0;
+        Window->Pending = FALSE;
+        Window->Prefetched = FALSE;
+    }
+}
+
+/**
+ * Find the read window holding the given range of the disk, loading it if necessary.
+ * The window is looked for in its set; on a miss the least recently used window of
+ * that set is replaced, so the windows of other sets are never touched. Windows with
+ * blocks lent to the FSW core are never replaced. Once the windows are being read in
+ * order, the window after the one returned is read ahead asynchronously.
+ * Returns NULL if the range could not be read through the cache.
+ */
+
+static FSW_EFI_WINDOW *fsw_efi_window_get(FSW_VOLUME_DATA *Volume, UINT64 StartRead, UINTN Length)
+{
+    EFI_STATUS          Status;
+    FSW_EFI_WINDOW      *Window, *Victim;
+    UINT64              WindowStart;
+
+    if (Volume->Windows == NULL && fsw_efi_window_setup(Volume) != EFI_SUCCESS)
+        return NULL;
+
+    WindowStart = StartRead & ~((UINT64) Volume->WindowSize - 1);
+    Window = fsw_efi_window_find(Volume, WindowStart, &Victim);
+    if (Window != NULL)
+        fsw_efi_window_wait(Volume, Window);
+
+    if (Window != NULL && Window->Length > 0) {
+        Window->LastUse = ++Volume->WindowClock;
+        if (Window->Prefetched) {
+            // the reader has caught up with the readahead, keep it going
+            Window->Prefetched = FALSE;
+            fsw_efi_window_prefetch(Volume, WindowStart + Volume->WindowSize);
+        }
+    } else {
+        // load the window, stopping at the end of the disk
+        if (Window == NULL)
+            Window = Victim;
+        if (Window == NULL)
+            return NULL;    // every window of the set is pinned or busy
+        Window->Length = 0;
+        if (Window->Data == NULL) {
+            Window->Data = AllocatePool(Volume->WindowSize);
+            if (Window->Data == NULL)
+                return NULL;
+        }
+        // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
+        // The same binary is fine under VirtualBox, and the same call is fine when
+        // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
+        // hang but produces a failure to mount the filesystem, even when the same
+        // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
+        // directly (without refit_call5_wrapper()) changes nothing. Placing Print()
+        // statements at the start and end of the function, and before and after the
+        // ReadDisk() call, suggests that when it fails, the program is executing
+        // code starting mid-function, so there seems to be something messed up in
+        // the way the function is being called. FIGURE THIS OUT!
+        Status = refit_call5_wrapper(Volume->DiskIo->ReadDisk, Volume->DiskIo, Volume->MediaId,
+                                     WindowStart, fsw_efi_window_length(Volume, WindowStart),
+                                     (VOID*) Window->Data);
+        if (EFI_ERROR(Status))
+            return NULL;
+        Window->Start = WindowStart;
+        Window->Length = fsw_efi_window_length(Volume, WindowStart);
+        Window->LastUse = ++Volume->WindowClock;
+        if (WindowStart == Volume->WindowNext)
+            fsw_efi_window_prefetch(Volume, WindowStart + Volume->WindowSize);
+        Volume->WindowNext = WindowStart + Volume->WindowSize;
+    }
+
+    if (StartRead + Length > Window->Start + Window->Length)
+        return NULL;    // at the end of the disk
+    return Window;
+}
+
 /**
  * FSW interface function to read data blocks. This function is called by the FSW core
  * to read a block of data from the device. The buffer is allocated by the core code.
- * Two caches are maintained, so as to improve performance on some systems. (VirtualBox
- * is particularly susceptible to performance problems with an uncached driver -- the
- * ext2 driver can take 200 seconds to load a Linux kernel under VirtualBox, whereas
- * the time is more like 3 seconds with a cache!) Two independent caches are maintained
- * because the ext2fs driver tends to alternate between accessing two parts of the
- * disk.
+ * Blocks are served from a per-volume disk cache of large read windows, so as to
+ * improve performance on some systems. (VirtualBox is particularly susceptible to
+ * performance problems with an uncached driver -- the ext2 driver can take 200 seconds
+ * to load a Linux kernel under VirtualBox, whereas the time is more like 3 seconds with
+ * a cache!) The cache is set-associative because drivers tend to alternate between
+ * several parts of the disk, e.g. btrfs between its chunk tree, fs tree and data.
  */
 
 fsw_status_t EFIAPI fsw_efi_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer) {
-   int              i, ReadCache = -1;
    FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   FSW_EFI_WINDOW   *Window;
    EFI_STATUS       Status = EFI_SUCCESS;
-   BOOLEAN          ReadOneBlock = FALSE;
    UINT64           StartRead = (UINT64) phys_bno * (UINT64) vol->phys_blocksize;
 
    if (buffer == NULL)
       return (fsw_status_t) EFI_BAD_BUFFER_SIZE;
 
-   // Initialize static data structures, if necessary....
-   if (LastRead < 0) {
-      fsw_efi_clear_cache();
-   } // if
-
-   // Look for a cache hit on the current query....
-   i = 0;
-   do {
-      if ((Caches[i].Volume == Volume) &&
-          (Caches[i].CacheValid == TRUE) &&
-          (StartRead >= Caches[i].CacheStart) &&
-          ((StartRead + vol->phys_blocksize) <= (Caches[i].CacheStart + CACHE_SIZE))) {
-         ReadCache = i;
-      }
-      i++;
-   } while ((i < NUM_CACHES) && (ReadCache < 0));
-
-   // No cache hit found; load new cache and pass it on....
-   if (ReadCache < 0) {
-      if (LastRead == -1)
-         LastRead = 1;
-      ReadCache = 1 - LastRead; // NOTE: If NUM_CACHES > 2, this must become more complex
-      Caches[ReadCache].CacheValid = FALSE;
-      if (Caches[ReadCache].Cache == NULL)
-         Caches[ReadCache].Cache = AllocatePool(CACHE_SIZE);
-      if (Caches[ReadCache].Cache != NULL) {
-         // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
-         // The same binary is fine under VirtualBox, and the same call is fine when
-         // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
-         // hang but produces a failure to mount the filesystem, even when the same
-         // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
-         // directly (without refit_call5_wrapper()) changes nothing. Placing Print()
-         // statements at the start and end of the function, and before and after the
-         // ReadDisk() call, suggests that when it fails, the program is executing
-         // code starting mid-function, so there seems to be something messed up in
-         // the way the function is being called. FIGURE THIS OUT!
-         Status = refit_call5_wrapper(Volume->DiskIo->ReadDisk, Volume->DiskIo, Volume->MediaId,
-                                      StartRead, (UINTN) CACHE_SIZE, (VOID*) Caches[ReadCache].Cache);
-         if (!EFI_ERROR(Status)) {
-            Caches[ReadCache].CacheStart = StartRead;
-            Caches[ReadCache].CacheValid = TRUE;
-            Caches[ReadCache].Volume = Volume;
-            LastRead = ReadCache;
-         } else {
-            ReadOneBlock = TRUE;
-         }
-      } else {
-         ReadOneBlock = TRUE;
-      } // if cache memory allocated
-   } // if (ReadCache < 0)
-
-   if (Caches[ReadCache].Cache != NULL && Caches[ReadCache].CacheValid == TRUE && vol->phys_blocksize > 0) {
-      CopyMem(buffer, &Caches[ReadCache].Cache[StartRead - Caches[ReadCache].CacheStart], vol->phys_blocksize);
-   } else {
-      ReadOneBlock = TRUE;
-   }
-
-   if (ReadOneBlock) { // Something's failed, so try a simple disk read of one block....
+   Window = fsw_efi_window_get(Volume, StartRead, vol->phys_blocksize);
+   if (Window != NULL) {
+      CopyMem(buffer, &Window->Data[StartRead - Window->Start], vol->phys_blocksize);
+   } else { // Something's failed, so try a simple disk read of one block....
       Status = refit_call5_wrapper(Volume->DiskIo->ReadDisk, Volume->DiskIo, Volume->MediaId,
-                                   phys_bno * vol->phys_blocksize,
+                                   StartRead,
                                    (UINTN) vol->phys_blocksize,
                                    (VOID*) buffer);
    }
@@ -595,6 +1018,105 @@ fsw_status_t EFIAPI fsw_efi_read_block(struct fsw_volume *vol, fsw_u64 phys_bno,
    return Status;
 } // fsw_status_t *fsw_efi_read_block()
 
+/**
+ * FSW interface function for reading several consecutive blocks in one go. This
+ * function is called by the FSW core for bulk reads and readahead. Whatever the
+ * read windows already hold (or are reading ahead) is copied from them; the rest
+ * goes straight from the disk into the caller's buffer. When bulk reads follow
+ * each other, the window after the current one is read ahead asynchronously, so
+ * the disk works while the FSW core and the caller process the data.
+ */
+
+fsw_status_t EFIAPI fsw_efi_read_blocks(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer)
+{
+    FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+    FSW_EFI_WINDOW   *Window, *Victim;
+    EFI_STATUS       Status = EFI_SUCCESS;
+    UINT8            *Dest = (UINT8 *) buffer;
+    UINT64           Offset = (UINT64) start_bno * vol->phys_blocksize;
+    UINTN            Length = (UINTN) count * vol->phys_blocksize;
+    UINTN            Part;
+    BOOLEAN          Sequential = (Offset == Volume->BulkNext);
+
+    if (buffer == NULL)
+        return (fsw_status_t) EFI_BAD_BUFFER_SIZE;
+    Volume->BulkNext = Offset + Length;
+
+    while (Length > 0 && Volume->Windows != NULL) {
+        Window = fsw_efi_window_find(Volume, Offset & ~((UINT64) Volume->WindowSize - 1), &Victim);
+        if (Window == NULL)
+            break;
+        fsw_efi_window_wait(Volume, Window);
+        if (Offset >= Window->Start + Window->Length)
+            break;
+        Part = (UINTN) (Window->Start + Window->Length - Offset);
+        if (Part > Length)
+            Part = Length;
+        CopyMem(Dest, &Window->Data[Offset - Window->Start], Part);
+        Window->LastUse = ++Volume->WindowClock;
+        Window->Prefetched = FALSE;
+        Dest += Part;
+        Offset += Part;
+        Length -= Part;
+    }
+
+    if (Length > 0)
+        Status = refit_call5_wrapper(Volume->DiskIo->ReadDisk, Volume->DiskIo, Volume->MediaId,
+                                     Offset, Length, (VOID*) Dest);
+    Volume->LastIOStatus = Status;
+
+    if (Sequential && !EFI_ERROR(Status) && Volume->DiskIo2 != NULL &&
+        (Volume->Windows != NULL || fsw_efi_window_setup(Volume) == EFI_SUCCESS))
+        fsw_efi_window_prefetch(Volume, Volume->BulkNext & ~((UINT64) Volume->WindowSize - 1));
+    return Status;
+} // fsw_status_t EFIAPI fsw_efi_read_blocks()
+
+/**
+ * FSW interface function to lend a block of file data straight out of the disk cache,
+ * so that the FSW core does not have to keep a copy of it in its own block cache.
+ * The window holding the block stays pinned until fsw_efi_put_block. Fails if the
+ * block cannot be served from the cache; the core then reads it the usual way.
+ */
+
+fsw_status_t EFIAPI fsw_efi_get_block(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out)
+{
+    FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+    FSW_EFI_WINDOW   *Window;
+    UINT64           StartRead = (UINT64) phys_bno * (UINT64) vol->phys_blocksize;
+
+    Window = fsw_efi_window_get(Volume, StartRead, vol->phys_blocksize);
+    if (Window == NULL)
+        return FSW_UNSUPPORTED;
+    Window->Pins++;
+    *buffer_out = &Window->Data[StartRead - Window->Start];
+    return FSW_SUCCESS;
+} // fsw_status_t EFIAPI fsw_efi_get_block()
+
+/**
+ * FSW interface function to give back a block lent by fsw_efi_get_block.
+ */
+
+void EFIAPI fsw_efi_put_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+    FSW_EFI_WINDOW   *Set;
+    UINT64           WindowStart;
+    UINTN            i;
+
+    if (Volume == NULL || Volume->Windows == NULL)
+        return;
+    WindowStart = ((UINT64) phys_bno * (UINT64) vol->phys_blocksize) & ~((UINT64) Volume->WindowSize - 1);
+    Set = &Volume->Windows[(UINTN) (DivU64x32(WindowStart, Volume->WindowSize, NULL) & (Volume->WindowSets - 1)) *
+                           Volume->WindowWays];
+    for (i = 0; i < Volume->WindowWays; i++) {
+        if (Set[i].Pins > 0 && (UINT8 *) buffer >= Set[i].Data &&
+            (UINT8 *) buffer < Set[i].Data + Volume->WindowSize) {
+            Set[i].Pins--;
+            return;
+        }
+    }
+} // void EFIAPI fsw_efi_put_block()
+
 /**
  * Map FSW status codes to EFI status codes. The FSW_IO_ERROR code is only produced
  * by fsw_efi_read_block, so we map it back to the EFI status code remembered from
@@ -638,12 +1160,81 @@ EFI_STATUS EFIAPI fsw_efi_FileSystem_OpenVolume(IN EFI_FILE_IO_INTERFACE *This,
     Print(L"fsw_efi_FileSystem_OpenVolume\n");
 #endif
 
-    fsw_efi_clear_cache();
+    fsw_efi_clear_cache(Volume->vol);
     Status = fsw_efi_dnode_to_FileHandle(Volume->vol->root, Root);
 
     return Status;
 }
 
+/**
+ * Get the rate of fsw_ticks, measured once against the firmware's Stall.
+ * Returns 0 if the driver has no clock.
+ */
+
+static UINT64 fsw_efi_ticks_per_second(VOID)
+{
+    static UINT64       TicksPerSecond = 0;
+    UINT64              Start;
+
+    if (TicksPerSecond == 0) {
+        Start = fsw_ticks();
+        if (Start != 0) {
+            refit_call1_wrapper(BS->Stall, 1000);
+            TicksPerSecond = (fsw_ticks() - Start) * 1000;
+        }
+    }
+    return TicksPerSecond;
+}
+
+/**
+ * Statistics protocol, GetStats function. Copies the counters the FSW core
+ * keeps for the volume.
+ */
+
+EFI_STATUS EFIAPI fsw_efi_Stats_GetStats(IN FSW_STATS_PROTOCOL *This,
+                                         OUT FSW_VOLUME_STATS *Stats)
+{
+    FSW_VOLUME_DATA     *Volume = FSW_VOLUME_FROM_STATS(This);
+    struct fsw_volume_stats VolStats, *vs = &VolStats;
+
+    if (Stats == NULL)
+        return EFI_INVALID_PARAMETER;
+
+    fsw_volume_get_stats(Volume->vol, vs);
+    Stats->TicksPerSecond       = fsw_efi_ticks_per_second();
+    Stats->BlockCacheHits       = vs->bcache_hits;
+    Stats->BlockCacheMisses     = vs->bcache_misses;
+    Stats->BlockCacheEvictions  = vs->bcache_evictions;
+    Stats->DeviceReads          = vs->device_reads;
+    Stats->DeviceReadBytes      = vs->device_read_bytes;
+    Stats->DeviceReadTicks      = vs->device_read_ticks;
+    Stats->GetExtentCalls       = vs->get_extent_calls;
+    Stats->GetExtentTicks       = vs->get_extent_ticks;
+    Stats->DirLookupCalls       = vs->dir_lookup_calls;
+    Stats->DirLookupTicks       = vs->dir_lookup_ticks;
+    Stats->DirReadCalls         = vs->dir_read_calls;
+    Stats->DirReadTicks         = vs->dir_read_ticks;
+    Stats->BlockCacheLent       = vs->bcache_lent;
+    Stats->BlockCacheBudgetEvictions = vs->bcache_budget_evictions;
+    Stats->BlockCacheShrinkFrees     = vs->bcache_shrink_frees;
+    Stats->BlockCacheReadaheadBlocks = vs->bcache_readahead_blocks;
+    Stats->NegativeCacheLookups = vs->negcache_lookups;
+    Stats->NegativeCacheHits    = vs->negcache_hits;
+    Stats->BulkReads            = vs->bulk_reads;
+    Stats->BulkReadBytes        = vs->bulk_read_bytes;
+    Stats->ReadaheadReads       = vs->readahead_reads;
+    Stats->ReadaheadUsefulBytes = vs->readahead_useful_bytes;
+    Stats->ReadaheadWastedBytes = vs->readahead_wasted_bytes;
+    Stats->ExtentLookups        = vs->extent_lookups;
+    Stats->ExtentBatches        = vs->extent_batches;
+    Stats->DnodeAllocs          = vs->dnode_allocs;
+    Stats->DnodeChunks          = vs->dnode_chunks;
+    Stats->NameAllocs           = vs->name_allocs;
+    Stats->NameChunks           = vs->name_chunks;
+    Stats->NameRollbacks        = vs->name_rollbacks;
+    return EFI_SUCCESS;
+}
+
 /**
  * File Handle EFI protocol, Open function. Dispatches the call
  * based on the kind of file handle.
@@ -676,6 +1267,7 @@ EFI_STATUS EFIAPI fsw_efi_FileHandle_Close(IN EFI_FILE *This)
     Print(L"fsw_efi_FileHandle_Close\n");
 #endif
 
+    fsw_efi_dir_batch_drop(File);
     fsw_shandle_close(&File->shand);
     FreePool(File);
 
@@ -956,9 +1548,22 @@ EFI_STATUS fsw_efi_dir_open(IN FSW_FILE_DATA *File,
     return Status;
 }
 
+/**
+ * Release the directory entries a directory handle has read ahead.
+ */
+
+VOID fsw_efi_dir_batch_drop(IN FSW_FILE_DATA *File)
+{
+    while (File->DirBatchNext < File->DirBatchCount)
+        fsw_dnode_release(File->DirBatch[File->DirBatchNext++]);
+    File->DirBatchCount = File->DirBatchNext = 0;
+}
+
 /**
  * Read function for directories. A file handle read on a directory retrieves
- * the next directory entry.
+ * the next directory entry. Entries are read and filled with fsw_dnode_dir_read_plus,
+ * a directory block at a time on file systems whose directory positions are byte
+ * offsets. An entry that does not fit into the caller's buffer is kept for the next call.
  */
 
 EFI_STATUS fsw_efi_dir_read(IN FSW_FILE_DATA *File,
@@ -967,14 +1572,21 @@ EFI_STATUS fsw_efi_dir_read(IN FSW_FILE_DATA *File,
 {
     EFI_STATUS          Status;
     FSW_VOLUME_DATA     *Volume = (FSW_VOLUME_DATA *)File->shand.dnode->vol->host_data;
-    struct fsw_dnode    *dno;
+    fsw_u32             Count;
 
 #if DEBUG_LEVEL
     Print(L"fsw_efi_dir_read...\n");
 #endif
 
-    // read the next entry
-    Status = fsw_efi_map_status(fsw_dnode_dir_read(&File->shand, &dno), Volume);
+    // read the next batch of entries
+    Status = EFI_SUCCESS;
+    if (File->DirBatchNext >= File->DirBatchCount) {
+        File->DirBatchCount = File->DirBatchNext = 0;
+        Count = FSW_EFI_DIR_BATCH;
+        Status = fsw_efi_map_status(fsw_dnode_dir_read_plus(&File->shand, File->DirBatch, &Count), Volume);
+        if (!EFI_ERROR(Status))
+            File->DirBatchCount = Count;
+    }
     if (Status == EFI_NOT_FOUND) {
         // end of directory
         *BufferSize = 0;
@@ -987,8 +1599,9 @@ EFI_STATUS fsw_efi_dir_read(IN FSW_FILE_DATA *File,
         return Status;
 
     // get info into buffer
-    Status = fsw_efi_dnode_fill_FileInfo(Volume, dno, BufferSize, Buffer);
-    fsw_dnode_release(dno);
+    Status = fsw_efi_dnode_fill_FileInfo(Volume, File->DirBatch[File->DirBatchNext], BufferSize, Buffer);
+    if (Status != EFI_BUFFER_TOO_SMALL)
+        fsw_dnode_release(File->DirBatch[File->DirBatchNext++]);
     return Status;
 }
 
@@ -1001,6 +1614,7 @@ EFI_STATUS fsw_efi_dir_read(IN FSW_FILE_DATA *File,
 EFI_STATUS fsw_efi_dir_setpos(IN FSW_FILE_DATA *File, IN UINT64 Position)
 {
     if (Position == 0) {
+        fsw_efi_dir_batch_drop(File);
         File->shand.pos = 0;
         return EFI_SUCCESS;
     } else {
@@ -1131,7 +1745,9 @@ void fsw_store_attr_efi(struct fsw_dnode_stat *sb, fsw_u16 attr)
 }
 
 /**
- * Common function to fill an EFI_FILE_INFO with information about a dnode.
+ * Common function to fill an EFI_FILE_INFO with information about a dnode. The
+ * structure is built once per dnode and kept with it, so later calls (and calls
+ * that only ask for the buffer size) just copy it.
  */
 
 EFI_STATUS fsw_efi_dnode_fill_FileInfo(IN FSW_VOLUME_DATA *Volume,
@@ -1144,18 +1760,42 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(IN FSW_VOLUME_DATA *Volume,
     UINTN               RequiredSize;
     struct fsw_dnode_stat sb;
 
-    // make sure the dnode has complete info
-    Status = fsw_efi_map_status(fsw_dnode_fill(dno), Volume);
-    if (EFI_ERROR(Status))
-        return Status;
+    if (dno->host_info == NULL) {
+        // make sure the dnode has complete info
+        Status = fsw_efi_map_status(fsw_dnode_fill(dno), Volume);
+        if (EFI_ERROR(Status))
+            return Status;
 
-    // TODO: check/assert that the dno's name is in UTF16
+        // TODO: check/assert that the dno's name is in UTF16
+
+        // fill structure
+        RequiredSize = SIZE_OF_EFI_FILE_INFO + fsw_efi_strsize(&dno->name);
+        FileInfo = AllocateZeroPool(RequiredSize);
+        if (FileInfo == NULL)
+            return EFI_OUT_OF_RESOURCES;
+        FileInfo->Size = RequiredSize;
+        FileInfo->FileSize          = dno->size;
+        FileInfo->Attribute         = 0;
+        if (dno->type == FSW_DNODE_TYPE_DIR)
+            FileInfo->Attribute    |= EFI_FILE_DIRECTORY;
+        fsw_efi_strcpy(FileInfo->FileName, &dno->name);
+
+        // get the missing info from the fs driver
+        ZeroMem(&sb, sizeof(struct fsw_dnode_stat));
+        sb.host_data = FileInfo;
+        Status = fsw_efi_map_status(fsw_dnode_stat(dno, &sb), Volume);
+        if (EFI_ERROR(Status)) {
+            FreePool(FileInfo);
+            return Status;
+        }
+        FileInfo->PhysicalSize      = sb.used_bytes;
+        dno->host_info = FileInfo;
+    }
+    FileInfo = (EFI_FILE_INFO *)dno->host_info;
+    RequiredSize = (UINTN) FileInfo->Size;
 
     // check buffer size
-    RequiredSize = SIZE_OF_EFI_FILE_INFO + fsw_efi_strsize(&dno->name);
     if (*BufferSize < RequiredSize) {
-        // TODO: wind back the directory in this case
-
 #if DEBUG_LEVEL
         Print(L"...BUFFER TOO SMALL\n");
 #endif
@@ -1163,25 +1803,9 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(IN FSW_VOLUME_DATA *Volume,
         return EFI_BUFFER_TOO_SMALL;
     }
 
-    // fill structure
-    ZeroMem(Buffer, RequiredSize);
-    FileInfo = (EFI_FILE_INFO *)Buffer;
-    FileInfo->Size = RequiredSize;
-    FileInfo->FileSize          = dno->size;
-    FileInfo->Attribute         = 0;
-    if (dno->type == FSW_DNODE_TYPE_DIR)
-        FileInfo->Attribute    |= EFI_FILE_DIRECTORY;
-    fsw_efi_strcpy(FileInfo->FileName, &dno->name);
-
-    // get the missing info from the fs driver
-    ZeroMem(&sb, sizeof(struct fsw_dnode_stat));
-    sb.host_data = FileInfo;
-    Status = fsw_efi_map_status(fsw_dnode_stat(dno, &sb), Volume);
-    if (EFI_ERROR(Status))
-        return Status;
-    FileInfo->PhysicalSize      = sb.used_bytes;
-
     // prepare for return
+    CopyMem(Buffer, FileInfo, RequiredSize);
+    FileInfo = (EFI_FILE_INFO *)Buffer;
     *BufferSize = RequiredSize;
 #if DEBUG_LEVEL
     Print(L"...returning '%s'\n", FileInfo->FileName);
@@ -39,11 +39,54 @@
 #define _FSW_EFI_H_
 
 #include "fsw_core.h"
+#include "../include/FswStats.h"
 
 #ifdef __MAKEWITH_GNUEFI
 #define CompareGuid(a, b) CompareGuid(a, b)==0
 #endif
 
+/**
+ * EFI Host: The Disk I/O 2 protocol (UEFI 2.4), declared here because not all
+ * toolkits have it. Only ReadDiskEx and Cancel are used.
+ */
+
+#define FSW_EFI_DISK_IO2_PROTOCOL_GUID \
+  { \
+    0x151c8eae, 0x7f2c, 0x472c, {0x9e, 0x54, 0x98, 0x28, 0x19, 0x4f, 0x6a, 0x88 } \
+  }
+
+typedef struct {
+    EFI_EVENT                   Event;          //!< Signaled when the transaction completes
+    EFI_STATUS                  TransactionStatus;
+} FSW_EFI_DISK_IO2_TOKEN;
+
+typedef struct _FSW_EFI_DISK_IO2 FSW_EFI_DISK_IO2;
+
+struct _FSW_EFI_DISK_IO2 {
+    UINT64                      Revision;
+    EFI_STATUS (EFIAPI *Cancel)(IN FSW_EFI_DISK_IO2 *This);
+    EFI_STATUS (EFIAPI *ReadDiskEx)(IN FSW_EFI_DISK_IO2 *This, IN UINT32 MediaId, IN UINT64 Offset,
+                                    IN OUT FSW_EFI_DISK_IO2_TOKEN *Token, IN UINTN BufferSize,
+                                    OUT VOID *Buffer);
+    VOID                        *WriteDiskEx;
+    VOID                        *FlushDiskEx;
+};
+
+/**
+ * EFI Host: One read window of the disk cache of a volume.
+ */
+
+typedef struct {
+    UINT8                       *Data;          //!< Window buffer, allocated on first use
+    UINT64                      Start;          //!< Disk offset of the window, in bytes
+    UINTN                       Length;         //!< Valid bytes in the buffer, 0 if empty
+    UINT64                      LastUse;        //!< Volume's window clock at the last hit
+    UINT32                      Pins;           //!< Blocks of the window lent to the FSW core
+    BOOLEAN                     Pending;        //!< An asynchronous read into the window is in flight
+    BOOLEAN                     Prefetched;     //!< Read ahead and not used yet
+    FSW_EFI_DISK_IO2_TOKEN      Token;          //!< Completion token of the asynchronous read
+} FSW_EFI_WINDOW;
+
 /**
  * EFI Host: Private per-volume structure.
  */
@@ -52,11 +95,24 @@ typedef struct {
     UINT64                      Signature;      //!< Used to identify this structure
 
     EFI_FILE_IO_INTERFACE       FileSystem;     //!< Published EFI protocol interface structure
+    FSW_STATS_PROTOCOL          Stats;          //!< Published statistics protocol interface structure
 
     EFI_HANDLE                  Handle;         //!< The device handle the protocol is attached to
     EFI_DISK_IO                 *DiskIo;        //!< The Disk I/O protocol we use for disk access
+    FSW_EFI_DISK_IO2            *DiskIo2;       //!< The Disk I/O 2 protocol for readahead, NULL if absent
+    BOOLEAN                     DiskIo2Stalled; //!< A read through Disk I/O 2 timed out, no more readahead
     UINT32                      MediaId;        //!< The media ID from the Block I/O protocol
     EFI_STATUS                  LastIOStatus;   //!< Last status from Disk I/O
+    UINT64                      MediaSize;      //!< Size of the disk in bytes, 0 if unknown
+    UINT32                      OptimalTransfer; //!< Preferred read size of the disk in bytes, 0 if unknown
+
+    FSW_EFI_WINDOW              *Windows;       //!< Disk cache, WindowSets sets of WindowWays windows
+    UINT32                      WindowSets;     //!< Number of sets (power of 2)
+    UINT32                      WindowWays;     //!< Number of windows in each set
+    UINT32                      WindowSize;     //!< Size of one window in bytes (power of 2)
+    UINT64                      WindowClock;    //!< Counts window hits, for LRU replacement
+    UINT64                      WindowNext;     //!< Disk offset following the last window loaded
+    UINT64                      BulkNext;       //!< Disk offset following the last bulk read
 
     struct fsw_volume           *vol;           //!< FSW volume structure
 
@@ -66,6 +122,10 @@ typedef struct {
 #define FSW_VOLUME_DATA_SIGNATURE  EFI_SIGNATURE_32 ('f', 's', 'w', 'V')
 /** Access macro for the volume structure. */
 #define FSW_VOLUME_FROM_FILE_SYSTEM(a)  CR (a, FSW_VOLUME_DATA, FileSystem, FSW_VOLUME_DATA_SIGNATURE)
+#define FSW_VOLUME_FROM_STATS(a)  CR (a, FSW_VOLUME_DATA, Stats, FSW_VOLUME_DATA_SIGNATURE)
+
+/** Number of directory entries read and filled at once by a directory handle. */
+#define FSW_EFI_DIR_BATCH   (32)
 
 /**
  * EFI Host: Private structure for a EFI_FILE interface.
@@ -79,6 +139,10 @@ typedef struct {
     UINT64                       Type;           //!< File type used for dispatching
     struct fsw_shandle          shand;          //!< FSW handle for this file
 
+    struct fsw_dnode            *DirBatch[FSW_EFI_DIR_BATCH]; //!< Directory entries read ahead, with full info
+    UINTN                       DirBatchCount;  //!< Number of entries in DirBatch
+    UINTN                       DirBatchNext;   //!< Next entry of DirBatch to return
+
 } FSW_FILE_DATA;
 
 /** File type: regular file. */
@@ -100,6 +164,6 @@ VOID fsw_efi_decode_time(OUT EFI_TIME *EfiTime, IN UINT32 UnixTime);
 
 UINTN fsw_efi_strsize(struct fsw_string *s);
 VOID fsw_efi_strcpy(CHAR16 *Dest, struct fsw_string *src);
-VOID EFIAPI fsw_efi_clear_cache(VOID);
+VOID EFIAPI fsw_efi_clear_cache(struct fsw_volume *vol);
 
 #endif
@@ -73,6 +73,22 @@ typedef UINT64  fsw_u64;
 #define fsw_memcpy(dest,src,size) CopyMem(dest,src,size)
 #define fsw_memeq(p1,p2,size) (CompareMem(p1,p2,size) == 0)
 
+// time stamps, in CPU cycles or counter ticks (see fsw_efi_ticks_per_second)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define fsw_ticks() ((fsw_u64)__builtin_ia32_rdtsc())
+#elif defined(__GNUC__) && defined(__aarch64__)
+static __inline__ fsw_u64 fsw_efi_read_cntvct(void)
+{
+    fsw_u64 val;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+}
+#define fsw_ticks() fsw_efi_read_cntvct()
+#else
+#define fsw_ticks() ((fsw_u64)0)
+#endif
+
 // message printing
 
 #define FSW_MSGSTR(s) L##s
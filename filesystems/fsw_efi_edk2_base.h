@@ -65,6 +65,7 @@
 # include <Protocol/ComponentName.h>
 
 # define BS gBS
+# define RT gRT
 
 # define EFI_FILE_HANDLE_REVISION EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_REVISION
 # define SIZE_OF_EFI_FILE_SYSTEM_VOLUME_LABEL_INFO  SIZE_OF_EFI_FILE_SYSTEM_VOLUME_LABEL
@@ -32,11 +32,17 @@ static fsw_status_t fsw_ext2_volume_stat(struct fsw_ext2_volume *vol, struct fsw
 
 static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno);
 static void         fsw_ext2_dnode_free(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno);
+static void         fsw_ext2_dnode_trim(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno);
 static fsw_status_t fsw_ext2_dnode_stat(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                         struct fsw_dnode_stat *sb);
 static fsw_status_t fsw_ext2_get_extent(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                         struct fsw_extent *extent);
 
+static fsw_status_t fsw_ext2_bmap_get(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                     struct fsw_ext2_bmap_node **node_inout, fsw_u32 bno, int has_children);
+static void         fsw_ext2_bmap_free(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                     struct fsw_ext2_bmap_node *node);
+
 static fsw_status_t fsw_ext2_dir_lookup(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                         struct fsw_string *lookup_name, struct fsw_ext2_dnode **child_dno);
 static fsw_status_t fsw_ext2_dir_read(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
@@ -65,11 +71,52 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext2) = {
     fsw_ext2_dir_lookup,
     fsw_ext2_dir_read,
     fsw_ext2_readlink,
+    FSW_FSTYPE_DIR_INDEX | FSW_FSTYPE_DIR_POS_BYTES,
+    NULL,
+    fsw_ext2_dnode_trim,
 };
 
+/**
+ * Get the block number of the inode table of a block group. Group descriptors are
+ * not read at mount time. The first access to a group reads the block holding its
+ * descriptor and remembers the inode tables of all groups described in that block.
+ */
+
+static fsw_status_t fsw_ext2_inotab_bno(struct fsw_ext2_volume *vol, fsw_u32 groupno, fsw_u32 *bno_out)
+{
+    fsw_status_t    status;
+    void            *buffer;
+    fsw_u32         gdesc_per_block, gdesc_bno, first, last, g;
+    struct ext2_group_desc *gdesc;
+
+    if (groupno >= vol->groupcnt)
+        return FSW_VOLUME_CORRUPTED;
+    if (vol->inotab_bno[groupno] == 0) {
+        gdesc_per_block = (vol->g.phys_blocksize / sizeof(struct ext2_group_desc));
+        gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / gdesc_per_block;
+        status = fsw_block_get(vol, gdesc_bno, 1, &buffer);
+        if (status)
+            return status;
+
+        first = groupno - groupno % gdesc_per_block;
+        last = first + gdesc_per_block;
+        if (last > vol->groupcnt)
+            last = vol->groupcnt;
+        gdesc = (struct ext2_group_desc *)buffer;
+        for (g = first; g < last; g++, gdesc++)
+            vol->inotab_bno[g] = gdesc->bg_inode_table;
+        fsw_block_release(vol, gdesc_bno, buffer);
+
+        if (vol->inotab_bno[groupno] == 0)
+            return FSW_VOLUME_CORRUPTED;
+    }
+    *bno_out = vol->inotab_bno[groupno];
+    return FSW_SUCCESS;
+}
+
 /**
  * Mount an ext2 volume. Reads the superblock and constructs the
- * root directory dnode.
+ * root directory dnode. Group descriptors are read later, as needed.
  */
 
 static fsw_status_t fsw_ext2_volume_mount(struct fsw_ext2_volume *vol)
@@ -77,8 +124,6 @@ static fsw_status_t fsw_ext2_volume_mount(struct fsw_ext2_volume *vol)
     fsw_status_t    status;
     void            *buffer;
     fsw_u32         blocksize;
-    fsw_u32         groupcnt, groupno, gdesc_per_block, gdesc_bno, gdesc_index;
-    struct ext2_group_desc *gdesc;
     int             i;
     struct fsw_string s;
 
@@ -130,24 +175,12 @@ static fsw_status_t fsw_ext2_volume_mount(struct fsw_ext2_volume *vol)
     if (status)
         return status;
 
-    // read the group descriptors to get inode table offsets
-    groupcnt = ((vol->sb->s_inodes_count - 2) / vol->sb->s_inodes_per_group) + 1;
-    gdesc_per_block = (vol->g.phys_blocksize / sizeof(struct ext2_group_desc));
-
-    status = fsw_alloc(sizeof(fsw_u32) * groupcnt, &vol->inotab_bno);
+    // inode table offsets are filled in by fsw_ext2_inotab_bno as groups are used;
+    // 0 means the group's descriptor has not been read yet
+    vol->groupcnt = ((vol->sb->s_inodes_count - 2) / vol->sb->s_inodes_per_group) + 1;
+    status = fsw_alloc_zero(sizeof(fsw_u32) * vol->groupcnt, (void **)&vol->inotab_bno);
     if (status)
         return status;
-    for (groupno = 0; groupno < groupcnt; groupno++) {
-        // get the block group descriptor
-        gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / gdesc_per_block;
-        gdesc_index = groupno % gdesc_per_block;
-        status = fsw_block_get(vol, gdesc_bno, 1, (void **)&buffer);
-        if (status)
-            return status;
-        gdesc = ((struct ext2_group_desc *)(buffer)) + gdesc_index;
-        vol->inotab_bno[groupno] = gdesc->bg_inode_table;
-        fsw_block_release(vol, gdesc_bno, buffer);
-    }
 
     // setup the root dnode
     status = fsw_dnode_create_root(vol, EXT2_ROOT_INO, &vol->g.root);
@@ -195,7 +228,7 @@ static fsw_status_t fsw_ext2_volume_stat(struct fsw_ext2_volume *vol, struct fsw
 static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno)
 {
     fsw_status_t    status;
-    fsw_u32         groupno, ino_in_group, ino_bno, ino_index;
+    fsw_u32         groupno, ino_in_group, inotab_bno, ino_bno, ino_index;
     fsw_u8          *buffer;
 
     if (dno->raw)
@@ -206,7 +239,10 @@ static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_
     // read the inode block
     groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
     ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
-    ino_bno = vol->inotab_bno[groupno] +
+    status = fsw_ext2_inotab_bno(vol, groupno, &inotab_bno);
+    if (status)
+        return status;
+    ino_bno = inotab_bno +
         ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
     ino_index = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
     status = fsw_block_get(vol, ino_bno, 2, (void **)&buffer);
@@ -244,6 +280,22 @@ static void fsw_ext2_dnode_free(struct fsw_ext2_volume *vol, struct fsw_ext2_dno
 {
     if (dno->raw)
         fsw_free(dno->raw);
+    fsw_ext2_dnode_trim(vol, dno);
+}
+
+/**
+ * Drop the dnode's block map. Called by the core's shrinker, and before the map
+ * grows beyond FSW_DNODE_CACHE_MAX_BYTES; it is read again as needed.
+ */
+
+static void fsw_ext2_dnode_trim(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno)
+{
+    int             i;
+
+    for (i = 0; i < 3; i++) {
+        fsw_ext2_bmap_free(vol, dno, dno->bmap[i]);
+        dno->bmap[i] = NULL;
+    }
 }
 
 /**
@@ -265,6 +317,64 @@ static fsw_status_t fsw_ext2_dnode_stat(struct fsw_ext2_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Get the copy of an indirect block in a dnode's block map, reading the block on
+ * first use. If the block points to further indirect blocks, their copies hang off
+ * the node as they are read in turn.
+ */
+
+static fsw_status_t fsw_ext2_bmap_get(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                     struct fsw_ext2_bmap_node **node_inout, fsw_u32 bno, int has_children)
+{
+    fsw_status_t    status;
+    struct fsw_ext2_bmap_node *node;
+    void            *buffer;
+
+    if (*node_inout != NULL)
+        return FSW_SUCCESS;
+
+    status = fsw_dnode_cache_alloc(dno, sizeof(struct fsw_ext2_bmap_node), (void **)&node);
+    if (status)
+        return status;
+    status = fsw_dnode_cache_alloc(dno, vol->ind_bcnt * sizeof(fsw_u32), (void **)&node->ptrs);
+    if (status == FSW_SUCCESS && has_children)
+        status = fsw_dnode_cache_alloc(dno, vol->ind_bcnt * sizeof(struct fsw_ext2_bmap_node *),
+                                       (void **)&node->children);
+    if (status == FSW_SUCCESS) {
+        status = fsw_block_get(vol, bno, 1, &buffer);
+        if (status == FSW_SUCCESS) {
+            fsw_memcpy(node->ptrs, buffer, vol->ind_bcnt * sizeof(fsw_u32));
+            fsw_block_release(vol, bno, buffer);
+        }
+    }
+    if (status) {
+        fsw_ext2_bmap_free(vol, dno, node);
+        return status;
+    }
+    *node_inout = node;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free a node of a dnode's block map and the nodes below it.
+ */
+
+static void fsw_ext2_bmap_free(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                               struct fsw_ext2_bmap_node *node)
+{
+    fsw_u32         i;
+
+    if (node == NULL)
+        return;
+    if (node->children) {
+        for (i = 0; i < vol->ind_bcnt; i++)
+            fsw_ext2_bmap_free(vol, dno, node->children[i]);
+        fsw_dnode_cache_free(dno, vol->ind_bcnt * sizeof(struct fsw_ext2_bmap_node *), node->children);
+    }
+    fsw_dnode_cache_free(dno, vol->ind_bcnt * sizeof(fsw_u32), node->ptrs);
+    fsw_dnode_cache_free(dno, sizeof(struct fsw_ext2_bmap_node), node);
+}
+
 /**
  * Retrieve file data mapping information. This function is called by the core when
  * fsw_shandle_read needs to know where on the disk the required piece of the file's
@@ -282,8 +392,9 @@ static fsw_status_t fsw_ext2_get_extent(struct fsw_ext2_volume *vol, struct fsw_
                                         struct fsw_extent *extent)
 {
     fsw_status_t    status;
-    fsw_u32         bno, release_bno, buf_bcnt, file_bcnt;
-    fsw_u32         *buffer;
+    fsw_u32         bno, buf_bcnt, file_bcnt;
+    fsw_u32         *ptrs;
+    struct fsw_ext2_bmap_node *node, **slot;
     int             path[5], i;
 
     // Preconditions: The caller has checked that the requested logical block
@@ -328,43 +439,44 @@ static fsw_status_t fsw_ext2_get_extent(struct fsw_ext2_volume *vol, struct fsw_
         }
     }
 
-    // follow the indirection path
-    buffer = dno->raw->i_block;
+    // follow the indirection path, through the dnode's copies of the indirect blocks;
+    // a map that has grown too large is dropped and built again along the way
+    if (dno->g.cache_bytes >= FSW_DNODE_CACHE_MAX_BYTES)
+        fsw_ext2_dnode_trim(vol, dno);
+    ptrs = dno->raw->i_block;
     buf_bcnt = EXT2_NDIR_BLOCKS;
-    release_bno = 0;
+    node = NULL;
     for (i = 0; ; i++) {
-        bno = buffer[path[i]];
-        if (bno == 0) {
-            extent->type = FSW_EXTENT_TYPE_SPARSE;
-            if (release_bno)
-                fsw_block_release(vol, release_bno, buffer);
-            return FSW_SUCCESS;
-        }
-        if (path[i+1] < 0)
+        bno = ptrs[path[i]];
+        if (bno == 0 || path[i+1] < 0)
             break;
 
-        if (release_bno)
-            fsw_block_release(vol, release_bno, buffer);
-        status = fsw_block_get(vol, bno, 1, (void **)&buffer);
+        slot = (i == 0) ? &dno->bmap[path[0] - EXT2_IND_BLOCK] : &node->children[path[i]];
+        status = fsw_ext2_bmap_get(vol, dno, slot, bno, path[i+2] >= 0);
         if (status)
             return status;
-        release_bno = bno;
+        node = *slot;
+        ptrs = node->ptrs;
         buf_bcnt = vol->ind_bcnt;
     }
     extent->phys_start = bno;
+    if (bno == 0) {
+        extent->type = FSW_EXTENT_TYPE_SPARSE;
+        if (path[i+1] >= 0)
+            return FSW_SUCCESS;     // a missing indirect block
+    }
 
-    // check if the following blocks can be aggregated into one extent
-    file_bcnt = (fsw_u32)((dno->g.size + vol->g.log_blocksize - 1) & (vol->g.log_blocksize - 1));
+    // check if the following blocks can be aggregated into one extent, or one hole
+    file_bcnt = (fsw_u32)FSW_U64_DIV(dno->g.size + vol->g.log_blocksize - 1, vol->g.log_blocksize);
     while (path[i]           + extent->log_count < buf_bcnt &&    // indirect block has more block pointers
            extent->log_start + extent->log_count < file_bcnt) {   // file has more blocks
-        if (buffer[path[i] + extent->log_count] == buffer[path[i] + extent->log_count - 1] + 1)
+        if (bno == 0 ? ptrs[path[i] + extent->log_count] == 0 :
+                       ptrs[path[i] + extent->log_count] == bno + extent->log_count)
             extent->log_count++;
         else
             break;
     }
 
-    if (release_bno)
-        fsw_block_release(vol, release_bno, buffer);
     return FSW_SUCCESS;
 }
 
@@ -45,12 +45,23 @@ struct fsw_ext2_volume {
     struct fsw_volume g;            //!< Generic volume structure
     
     struct ext2_super_block *sb;    //!< Full raw ext2 superblock structure
-    fsw_u32     *inotab_bno;        //!< Block numbers of the inode tables
+    fsw_u32     *inotab_bno;        //!< Block numbers of the inode tables, 0 until read
+    fsw_u32     groupcnt;           //!< Number of block groups
     fsw_u32     ind_bcnt;           //!< Number of blocks addressable through an indirect block
     fsw_u32     dind_bcnt;          //!< Number of blocks addressable through a double-indirect block
     fsw_u32     inode_size;         //!< Size of inode structure in bytes
 };
 
+/**
+ * ext2: A copy of an indirect block in a dnode's block map. Nodes for double- and
+ * triple-indirect blocks also keep the copies of the blocks they point to.
+ */
+
+struct fsw_ext2_bmap_node {
+    fsw_u32     *ptrs;              //!< Block pointers of the indirect block (ind_bcnt entries)
+    struct fsw_ext2_bmap_node **children; //!< Nodes of the blocks pointed to, NULL until read (none for single-indirect)
+};
+
 /**
  * ext2: Dnode structure with ext2-specific data.
  */
@@ -59,6 +70,7 @@ struct fsw_ext2_dnode {
     struct fsw_dnode g;             //!< Generic dnode structure
     
     struct ext2_inode *raw;         //!< Full raw inode structure
+    struct fsw_ext2_bmap_node *bmap[3];   //!< Block map: the indirect, double- and triple-indirect blocks read so far
 };
 
 
@@ -23,6 +23,7 @@
  */
 
 #include "fsw_ext4.h"
+#include "crc32c.c"
 
 
 // functions
@@ -33,6 +34,7 @@ static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw
 
 static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno);
 static void         fsw_ext4_dnode_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno);
+static void         fsw_ext4_dnode_trim(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno);
 static fsw_status_t fsw_ext4_dnode_stat(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_dnode_stat *sb);
 static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
@@ -41,12 +43,23 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
                                         struct fsw_extent *extent);
 static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_extent *extent);
+static fsw_status_t fsw_ext4_get_extents(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                         fsw_u64 log_start, struct fsw_extent *extents, fsw_u32 *count_inout);
+static fsw_status_t fsw_ext4_inline_data(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                         fsw_u8 *buffer, fsw_u32 *size_out);
+
+static fsw_status_t fsw_ext4_bmap_get(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                     struct fsw_ext4_bmap_node **node_inout, fsw_u32 bno, int has_children);
+static void         fsw_ext4_bmap_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                     struct fsw_ext4_bmap_node *node);
 
 static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_string *lookup_name, struct fsw_ext4_dnode **child_dno);
 static fsw_status_t fsw_ext4_dir_read(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                       struct fsw_shandle *shand, struct fsw_ext4_dnode **child_dno);
 static fsw_status_t fsw_ext4_read_dentry(struct fsw_shandle *shand, struct ext4_dir_entry *entry);
+static fsw_status_t fsw_ext4_dx_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                       struct fsw_string *name, fsw_u32 *child_ino_out);
 
 static fsw_status_t fsw_ext4_readlink(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                       struct fsw_string *link);
@@ -70,6 +83,9 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext4) = {
     fsw_ext4_dir_lookup,
     fsw_ext4_dir_read,
     fsw_ext4_readlink,
+    FSW_FSTYPE_DIR_INDEX | FSW_FSTYPE_DIR_POS_BYTES,
+    fsw_ext4_get_extents,
+    fsw_ext4_dnode_trim,
 };
 
 
@@ -100,9 +116,107 @@ fsw_ext4_group_first_block_no(struct ext4_super_block *sb, fsw_u32 group_no)
                 sb->s_first_data_block;
 }
 
+/**
+ * Get the number of the block holding the descriptor of a block group.
+ */
+
+static fsw_u64 fsw_ext4_gdesc_bno(struct fsw_ext4_volume *vol, fsw_u32 groupno)
+{
+    fsw_u32         gdesc_per_block, metabg_of_gdesc;
+    fsw_u64         gdesc_bno;
+
+    // Descriptors in one block... s_desc_size needs to be set! (Usually 128 since normal block
+    // descriptors are 32 byte and block size is 4096)
+    gdesc_per_block = EXT4_DESC_PER_BLOCK(vol->sb);
+
+    if(vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG && groupno >= vol->sb->s_first_meta_bg)
+    {
+        // If option meta_bg is set, the block group descriptor is in meta block group...
+        metabg_of_gdesc = (fsw_u32)(groupno / gdesc_per_block) * gdesc_per_block;
+        gdesc_bno = fsw_ext4_group_first_block_no(vol->sb, metabg_of_gdesc);
+        // We need to know if the block group in questition has a super block, if yes, the
+        // block group descriptors are in the next block number
+        if(!(vol->sb->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER) || fsw_ext4_group_sparse(metabg_of_gdesc))
+            gdesc_bno += 1;
+    }
+    else
+    {
+        // All group descriptors follow the super block (+1)
+        gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / gdesc_per_block;
+    }
+    return gdesc_bno;
+}
+
+/**
+ * Compute the metadata_csum checksum of a group descriptor: the low 16 bits of the
+ * crc32c of the group number and the descriptor with bg_checksum taken as zero.
+ */
+
+static fsw_u16 fsw_ext4_gdesc_csum(struct fsw_ext4_volume *vol, fsw_u32 groupno, struct ext4_group_desc *gdesc)
+{
+    fsw_u32         crc, offset;
+    fsw_u16         zero = 0;
+
+    offset = (fsw_u32)((fsw_u8 *)&gdesc->bg_checksum - (fsw_u8 *)gdesc);
+    crc = fsw_crc32c(vol->csum_seed, &groupno, sizeof(groupno));
+    crc = fsw_crc32c(crc, gdesc, offset);
+    crc = fsw_crc32c(crc, &zero, sizeof(zero));
+    offset += sizeof(zero);
+    if (offset < vol->sb->s_desc_size)
+        crc = fsw_crc32c(crc, (fsw_u8 *)gdesc + offset, vol->sb->s_desc_size - offset);
+    return (fsw_u16)crc;
+}
+
+/**
+ * Get the block number of the inode table of a block group. Group descriptors are
+ * not read at mount time. The first access to a group reads the block holding its
+ * descriptor and remembers the inode tables of all groups described in that block.
+ */
+
+static fsw_status_t fsw_ext4_inotab_bno(struct fsw_ext4_volume *vol, fsw_u32 groupno, fsw_u64 *bno_out)
+{
+    fsw_status_t    status;
+    void            *buffer;
+    fsw_u32         gdesc_per_block, first, last, g;
+    fsw_u64         gdesc_bno;
+    struct ext4_group_desc *gdesc;
+
+    if (groupno >= vol->groupcnt)
+        return FSW_VOLUME_CORRUPTED;
+    if (vol->inotab_bno[groupno] == 0) {
+        gdesc_per_block = EXT4_DESC_PER_BLOCK(vol->sb);
+        gdesc_bno = fsw_ext4_gdesc_bno(vol, groupno);
+        status = fsw_block_get(vol, gdesc_bno, 1, &buffer);
+        if (status)
+            return status;
+
+        first = groupno - groupno % gdesc_per_block;
+        last = first + gdesc_per_block;
+        if (last > vol->groupcnt)
+            last = vol->groupcnt;
+        for (g = first; g < last; g++) {
+            if (vol->inotab_bno[g] != 0 || fsw_ext4_gdesc_bno(vol, g) != gdesc_bno)
+                continue;
+            gdesc = (struct ext4_group_desc *)((char *)buffer + (g - first) * vol->sb->s_desc_size);
+            // a descriptor with a bad checksum is left unread, so its group reports corruption
+            if (vol->verify_csum && fsw_ext4_gdesc_csum(vol, g, gdesc) != gdesc->bg_checksum)
+                continue;
+            vol->inotab_bno[g] = gdesc->bg_inode_table_lo;
+            if (vol->sb->s_desc_size >= EXT4_MIN_DESC_SIZE_64BIT)
+                vol->inotab_bno[g] |= (fsw_u64)gdesc->bg_inode_table_hi << 32;
+        }
+        fsw_block_release(vol, gdesc_bno, buffer);
+
+        if (vol->inotab_bno[groupno] == 0)
+            return FSW_VOLUME_CORRUPTED;
+    }
+    *bno_out = vol->inotab_bno[groupno];
+    return FSW_SUCCESS;
+}
+
 /**
  * Mount an ext4 volume. Reads the superblock and constructs the
- * root directory dnode.
+ * root directory dnode. Group descriptors are read later, as needed.
  */
 
 static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
@@ -110,9 +224,6 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
     fsw_status_t    status;
     void            *buffer;
     fsw_u32         blocksize;
-    fsw_u32         groupcnt, groupno, gdesc_per_block, gdesc_index, metabg_of_gdesc;
-    fsw_u64         gdesc_bno;
-    struct ext4_group_desc *gdesc;
     int             i;
     struct fsw_string s;
 
@@ -138,10 +249,24 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
 
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_volume_mount: Incompat flag %x\n"), vol->sb->s_feature_incompat));
 
+    // metadata checksums are checked on request only, starting with the superblock
+    if ((vol->g.mount_flags & FSW_MOUNT_VERIFY_CHECKSUMS) &&
+        (vol->sb->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_METADATA_CSUM)) {
+        if (vol->sb->s_checksum_type != EXT4_CRC32C_CHKSUM ||
+            fsw_crc32c(~0, vol->sb, (fsw_u32)((fsw_u8 *)&vol->sb->s_checksum - (fsw_u8 *)vol->sb)) != vol->sb->s_checksum)
+            return FSW_VOLUME_CORRUPTED;
+        vol->verify_csum = 1;
+        if (vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_CSUM_SEED)
+            vol->csum_seed = vol->sb->s_checksum_seed;
+        else
+            vol->csum_seed = fsw_crc32c(~0, vol->sb->s_uuid, sizeof(vol->sb->s_uuid));
+    }
+
     if (vol->sb->s_rev_level == EXT4_DYNAMIC_REV &&
         (vol->sb->s_feature_incompat & ~(EXT4_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_RECOVER |
                                          EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_FLEX_BG |
-                                         EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_META_BG)))
+                                         EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_META_BG |
+                                         EXT4_FEATURE_INCOMPAT_INLINEDATA | EXT4_FEATURE_INCOMPAT_CSUM_SEED)))
         return FSW_UNSUPPORTED;
 
     if (vol->sb->s_rev_level == EXT4_DYNAMIC_REV &&
@@ -180,53 +305,15 @@ static fsw_status_t fsw_ext4_volume_mount(struct fsw_ext4_volume *vol)
     }
 
     // Calculate group descriptor count the way the kernel does it...
-    groupcnt = (vol->sb->s_blocks_count_lo - vol->sb->s_first_data_block + 
-                vol->sb->s_blocks_per_group - 1) / vol->sb->s_blocks_per_group;
+    vol->groupcnt = (vol->sb->s_blocks_count_lo - vol->sb->s_first_data_block +
+                     vol->sb->s_blocks_per_group - 1) / vol->sb->s_blocks_per_group;
 
-    // Descriptors in one block... s_desc_size needs to be set! (Usually 128 since normal block 
-    // descriptors are 32 byte and block size is 4096)
-    gdesc_per_block = EXT4_DESC_PER_BLOCK(vol->sb);
-    
-    // Read the group descriptors to get inode table offsets
-    status = fsw_alloc(sizeof(fsw_u64) * groupcnt, &vol->inotab_bno);
+    // Inode table locations are filled in by fsw_ext4_inotab_bno as groups are used;
+    // 0 means the group's descriptor has not been read yet
+    status = fsw_alloc_zero(sizeof(fsw_u64) * vol->groupcnt, (void **)&vol->inotab_bno);
     if (status)
         return status;
 
-    // Loop through all block group descriptors in order to get inode table locations
-    for (groupno = 0; groupno < groupcnt; groupno++) {
-
-        // Calculate the block number which contains the block group descriptor we look for
-        if(vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_META_BG && groupno >= vol->sb->s_first_meta_bg)
-        {
-            // If option meta_bg is set, the block group descriptor is in meta block group...
-            metabg_of_gdesc = (fsw_u32)(groupno / gdesc_per_block) * gdesc_per_block;
-            gdesc_bno = fsw_ext4_group_first_block_no(vol->sb, metabg_of_gdesc);
-            // We need to know if the block group in questition has a super block, if yes, the 
-            // block group descriptors are in the next block number
-            if(!(vol->sb->s_feature_ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER) || fsw_ext4_group_sparse(metabg_of_gdesc))
-                gdesc_bno += 1;
-        }
-        else
-        {
-            // All group descriptors follow the super block (+1)
-            gdesc_bno = (vol->sb->s_first_data_block + 1) + groupno / gdesc_per_block;
-        }
-        gdesc_index = groupno % gdesc_per_block;
-
-        // Get block if necessary...
-        status = fsw_block_get(vol, gdesc_bno, 1, (void **)&buffer);
-        if (status)
-            return status;
-
-        // Get group descriptor table and block number of inode table...
-        gdesc = (struct ext4_group_desc *)((char *)buffer + gdesc_index * vol->sb->s_desc_size);
-        vol->inotab_bno[groupno] = gdesc->bg_inode_table_lo;
-        if (vol->sb->s_desc_size >= EXT4_MIN_DESC_SIZE_64BIT)
-            vol->inotab_bno[groupno] |= (fsw_u64)gdesc->bg_inode_table_hi << 32;
-
-        fsw_block_release(vol, gdesc_bno, buffer);
-    }
-
     // setup the root dnode
     status = fsw_dnode_create_root(vol, EXT4_ROOT_INO, &vol->g.root);
     if (status)
@@ -272,6 +359,46 @@ static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw
     return FSW_SUCCESS;
 }
 
+/**
+ * Check the metadata_csum checksum of an inode just read, and remember the inode's
+ * checksum seed for its extent blocks. The checksum covers the inode number, the
+ * generation and the whole on-disk inode with the checksum fields taken as zero.
+ * Only the low 16 bits are stored if the inode has no room for i_checksum_hi.
+ */
+
+static fsw_status_t fsw_ext4_inode_verify(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno)
+{
+    fsw_u8          *raw = (fsw_u8 *)dno->raw;
+    fsw_u32         inum, crc, stored, lo_offset, hi_offset;
+    fsw_u16         zero = 0;
+
+    inum = (fsw_u32)dno->g.dnode_id;
+    crc = fsw_crc32c(vol->csum_seed, &inum, sizeof(inum));
+    crc = fsw_crc32c(crc, &dno->raw->i_generation, sizeof(dno->raw->i_generation));
+    dno->csum_seed = crc;
+    if (vol->sb->s_creator_os != EXT4_OS_LINUX)
+        return FSW_SUCCESS;
+
+    lo_offset = (fsw_u32)((fsw_u8 *)&dno->raw->osd2.linux2.l_i_checksum_lo - raw);
+    hi_offset = (fsw_u32)((fsw_u8 *)&dno->raw->i_checksum_hi - raw);
+    crc = fsw_crc32c(crc, raw, lo_offset);
+    crc = fsw_crc32c(crc, &zero, sizeof(zero));
+    stored = dno->raw->osd2.linux2.l_i_checksum_lo;
+    if (vol->inode_size > EXT4_GOOD_OLD_INODE_SIZE &&
+        EXT4_GOOD_OLD_INODE_SIZE + (fsw_u32)dno->raw->i_extra_isize >= hi_offset + sizeof(zero)) {
+        crc = fsw_crc32c(crc, raw + lo_offset + sizeof(zero), hi_offset - lo_offset - sizeof(zero));
+        crc = fsw_crc32c(crc, &zero, sizeof(zero));
+        crc = fsw_crc32c(crc, raw + hi_offset + sizeof(zero), vol->inode_size - hi_offset - sizeof(zero));
+        stored |= (fsw_u32)dno->raw->i_checksum_hi << 16;
+    } else {
+        crc = fsw_crc32c(crc, raw + lo_offset + sizeof(zero), vol->inode_size - lo_offset - sizeof(zero));
+        crc &= 0xFFFF;
+    }
+    if (crc != stored)
+        return FSW_VOLUME_CORRUPTED;
+    return FSW_SUCCESS;
+}
+
 /**
  * Get full information on a dnode from disk. This function is called by the core
  * whenever it needs to access fields in the dnode structure that may not
@@ -283,8 +410,8 @@ static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw
 static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno)
 {
     fsw_status_t    status;
-    fsw_u32         groupno, ino_in_group, ino_index;
-    fsw_u64         ino_bno;
+    fsw_u32         groupno, ino_in_group, ino_index, inline_size;
+    fsw_u64         inotab_bno, ino_bno;
     fsw_u8          *buffer;
 
     if (dno->raw)
@@ -294,7 +421,10 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
     // read the inode block
     groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
     ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
-    ino_bno = vol->inotab_bno[groupno] +
+    status = fsw_ext4_inotab_bno(vol, groupno, &inotab_bno);
+    if (status)
+        return status;
+    ino_bno = inotab_bno +
         ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
     ino_index = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
     status = fsw_block_get(vol, ino_bno, 2, (void **)&buffer);
@@ -307,14 +437,31 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
     fsw_block_release(vol, ino_bno, buffer);
     if (status)
         return status;
+    if (vol->verify_csum) {
+        status = fsw_ext4_inode_verify(vol, dno);
+        if (status)
+            return status;
+    }
 
     // get info from the inode
     dno->g.size = dno->raw->i_size_lo; // TODO: check docs for 64-bit sized files
 
     if (S_ISREG(dno->raw->i_mode))
         dno->g.type = FSW_DNODE_TYPE_FILE;
-    else if (S_ISDIR(dno->raw->i_mode))
+    else if (S_ISDIR(dno->raw->i_mode)) {
         dno->g.type = FSW_DNODE_TYPE_DIR;
+        // inline directories read as they are put together by fsw_ext4_inline_data
+        if (dno->raw->i_flags & 1 << EXT4_INODE_INLINE_DATA) {
+            status = fsw_ext4_inline_data(vol, dno, NULL, &inline_size);
+            if (status)
+                return status;
+            dno->g.size = inline_size;
+        }
+        // hash-indexed directories are looked up through their HTree, not a core name index
+        if ((vol->sb->s_feature_compat & EXT4_FEATURE_COMPAT_DIR_INDEX) &&
+            (dno->raw->i_flags & 1 << EXT4_INODE_INDEX))
+            dno->g.dir_lookup_indexed = 1;
+    }
     else if (S_ISLNK(dno->raw->i_mode))
         dno->g.type = FSW_DNODE_TYPE_SYMLINK;
     else
@@ -335,6 +482,26 @@ static void fsw_ext4_dnode_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dno
 {
     if (dno->raw)
         fsw_free(dno->raw);
+    fsw_ext4_dnode_trim(vol, dno);
+}
+
+/**
+ * Drop the dnode's block map and extent cache. Called by the core's shrinker, and
+ * before the block map grows beyond FSW_DNODE_CACHE_MAX_BYTES; both are read again
+ * as needed.
+ */
+
+static void fsw_ext4_dnode_trim(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno)
+{
+    int             i;
+
+    for (i = 0; i < 3; i++) {
+        fsw_ext4_bmap_free(vol, dno, dno->bmap[i]);
+        dno->bmap[i] = NULL;
+    }
+    fsw_dnode_cache_free(dno, dno->ext_cache_size * sizeof(struct fsw_ext4_cached_extent), dno->ext_cache);
+    dno->ext_cache = NULL;
+    dno->ext_cache_count = dno->ext_cache_size = 0;
 }
 
 /**
@@ -356,6 +523,90 @@ static fsw_status_t fsw_ext4_dnode_stat(struct fsw_ext4_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Find the part of an inline-data inode's data that doesn't fit into i_block: the
+ * value of the "system.data" extended attribute in the inode's extra space. Sets
+ * *size_out to 0 if there is none.
+ */
+
+static fsw_status_t fsw_ext4_inline_xattr(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                          fsw_u8 **data_out, fsw_u32 *size_out)
+{
+    fsw_u8          *first, *end;
+    fsw_u32         offset;
+    struct ext4_xattr_entry *entry;
+
+    *data_out = NULL;
+    *size_out = 0;
+    if (vol->inode_size <= EXT4_GOOD_OLD_INODE_SIZE)
+        return FSW_SUCCESS;
+    offset = EXT4_GOOD_OLD_INODE_SIZE + dno->raw->i_extra_isize;
+    if (offset + 4 > vol->inode_size || *(fsw_u32 *)((fsw_u8 *)dno->raw + offset) != EXT4_XATTR_MAGIC)
+        return FSW_SUCCESS;
+
+    // value offsets count from the first entry
+    first = (fsw_u8 *)dno->raw + offset + 4;
+    end = (fsw_u8 *)dno->raw + vol->inode_size;
+    entry = (struct ext4_xattr_entry *)first;
+    while ((fsw_u8 *)entry + sizeof(fsw_u32) <= end && *(fsw_u32 *)entry != 0) {
+        if ((fsw_u8 *)entry + EXT4_XATTR_LEN(entry->e_name_len) > end)
+            return FSW_VOLUME_CORRUPTED;
+        if (entry->e_name_index == EXT4_XATTR_INDEX_SYSTEM && entry->e_name_len == 4 &&
+            fsw_memeq(entry + 1, "data", 4)) {
+            if (entry->e_value_inum != 0 || entry->e_value_offs + entry->e_value_size > (fsw_u32)(end - first))
+                return FSW_VOLUME_CORRUPTED;
+            *data_out = first + entry->e_value_offs;
+            *size_out = entry->e_value_size;
+            break;
+        }
+        entry = (struct ext4_xattr_entry *)((fsw_u8 *)entry + EXT4_XATTR_LEN(entry->e_name_len));
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Put together the data of an inline-data inode: i_block, followed by the rest from
+ * the "system.data" attribute. Directories start with their parent's inode number
+ * instead of "." and ".." entries; that is turned into a ".." entry, so that they
+ * read like a directory block. buffer may be NULL to get just the size.
+ */
+
+static fsw_status_t fsw_ext4_inline_data(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                         fsw_u8 *buffer, fsw_u32 *size_out)
+{
+    fsw_status_t    status;
+    fsw_u8          *xattr_data;
+    fsw_u32         xattr_size, size;
+    struct ext4_dir_entry *entry;
+
+    status = fsw_ext4_inline_xattr(vol, dno, &xattr_data, &xattr_size);
+    if (status)
+        return status;
+
+    size = 0;
+    if (S_ISDIR(dno->raw->i_mode)) {
+        if (buffer) {
+            entry = (struct ext4_dir_entry *)buffer;
+            entry->inode = dno->raw->i_block[0];
+            entry->rec_len = 12;
+            entry->name_len = 2;
+            entry->file_type = EXT4_FT_DIR;
+            entry->name[0] = entry->name[1] = '.';
+            entry->name[2] = entry->name[3] = 0;
+            fsw_memcpy(buffer + 12, dno->raw->i_block + 1, EXT4_MIN_INLINE_DATA_SIZE - 4);
+        }
+        size = 12 + EXT4_MIN_INLINE_DATA_SIZE - 4;
+    } else {
+        if (buffer)
+            fsw_memcpy(buffer, dno->raw->i_block, EXT4_MIN_INLINE_DATA_SIZE);
+        size = EXT4_MIN_INLINE_DATA_SIZE;
+    }
+    if (buffer && xattr_size)
+        fsw_memcpy(buffer + size, xattr_data, xattr_size);
+    *size_out = size + xattr_size;
+    return FSW_SUCCESS;
+}
+
 /**
  * Retrieve file data mapping information. This function is called by the core when
  * fsw_shandle_read needs to know where on the disk the required piece of the file's
@@ -371,6 +622,9 @@ static fsw_status_t fsw_ext4_dnode_stat(struct fsw_ext4_volume *vol, struct fsw_
 static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                         struct fsw_extent *extent)
 {
+    fsw_status_t    status;
+    fsw_u32         size;
+
     // Preconditions: The caller has checked that the requested logical block
     //  is within the file's size. The dnode has complete information, i.e.
     //  fsw_ext4_dnode_read_info was called successfully on it.
@@ -378,7 +632,25 @@ static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_
     extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
     extent->log_count = 1;
 
-    if(dno->raw->i_flags & 1 << EXT4_INODE_EXTENTS)
+    if (dno->raw->i_flags & 1 << EXT4_INODE_INLINE_DATA)
+    {
+       // data lives in the inode, which we have: no block to read at all
+       if (extent->log_start > 0) {
+           extent->type = FSW_EXTENT_TYPE_SPARSE;
+           return FSW_SUCCESS;
+       }
+       status = fsw_ext4_inline_data(vol, dno, NULL, &size);
+       if (status)
+           return status;
+       if (size > vol->g.log_blocksize)
+           return FSW_VOLUME_CORRUPTED;
+       status = fsw_alloc_zero(vol->g.log_blocksize, &extent->buffer);
+       if (status)
+           return status;
+       extent->type = FSW_EXTENT_TYPE_BUFFER;
+       return fsw_ext4_inline_data(vol, dno, extent->buffer, &size);
+    }
+    else if(dno->raw->i_flags & 1 << EXT4_INODE_EXTENTS)
     {
        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_extent: inode %d uses extents\n"), dno->g.dnode_id));
        return fsw_ext4_get_by_extent(vol, dno, extent);
@@ -392,76 +664,370 @@ static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_
 }
 
 /**
- * New ext4 extents...
+ * Find the entry of a dnode's extent cache that covers a logical block, by binary
+ * search. Returns the entry's index, or -1 if the block is not in the cache.
  */
-static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
-                                        struct fsw_extent *extent)
+
+static int fsw_ext4_ext_cache_find(struct fsw_ext4_dnode *dno, fsw_u32 bno)
+{
+    fsw_u32       lo, hi, mid;
+
+    lo = 0;
+    hi = dno->ext_cache_count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dno->ext_cache[mid].log_start > bno)
+            hi = mid;
+        else if (bno - dno->ext_cache[mid].log_start >= dno->ext_cache[mid].log_count)
+            lo = mid + 1;
+        else
+            return (int)mid;
+    }
+    return -1;
+}
+
+/**
+ * Put the extents of a leaf into a dnode's extent cache. The leaf covers the logical
+ * blocks from lo up to hi, which don't overlap any other leaf; the gaps between its
+ * extents are entered as holes, so that every block in that range is answered from
+ * the cache from now on. If the cache would grow beyond EXT4_EXTENT_CACHE_MAX entries,
+ * it is emptied first.
+ */
+
+static fsw_status_t fsw_ext4_ext_cache_add(struct fsw_ext4_dnode *dno, struct ext4_extent *ext,
+                                           fsw_u32 entries, fsw_u32 lo, fsw_u32 hi)
 {
     fsw_status_t  status;
-    fsw_u32       bno, buf_offset;
-    int           ext_cnt;
+    struct fsw_ext4_cached_extent *cache, *e;
+    fsw_u32       pos, count, new_count, max_count, size, i, start, len;
+
+    // where the leaf goes, and whether it fits in between its neighbours
+    count = dno->ext_cache_count;
+    if (count + 4 * entries + 2 > EXT4_EXTENT_CACHE_MAX) {
+        count = 0;
+        dno->ext_cache_count = 0;
+    }
+    for (pos = 0; pos < count && dno->ext_cache[pos].log_start < lo; pos++)
+        ;
+    if ((pos > 0 && dno->ext_cache[pos-1].log_start + dno->ext_cache[pos-1].log_count > lo) ||
+        (pos < count && dno->ext_cache[pos].log_start < hi))
+        return FSW_VOLUME_CORRUPTED;
+
+    // make room for the tail to move up, and for decoding the leaf past that
+    max_count = 2 * entries + 1;
+    if (count + 2 * max_count > dno->ext_cache_size) {
+        size = dno->ext_cache_size * 2;
+        if (size > EXT4_EXTENT_CACHE_MAX)
+            size = EXT4_EXTENT_CACHE_MAX;
+        if (size < count + 2 * max_count)
+            size = count + 2 * max_count;
+        status = fsw_dnode_cache_alloc(dno, size * sizeof(struct fsw_ext4_cached_extent), (void **)&cache);
+        if (status)
+            return status;
+        if (count)
+            fsw_memcpy(cache, dno->ext_cache, count * sizeof(struct fsw_ext4_cached_extent));
+        fsw_dnode_cache_free(dno, dno->ext_cache_size * sizeof(struct fsw_ext4_cached_extent), dno->ext_cache);
+        dno->ext_cache = cache;
+        dno->ext_cache_size = size;
+    }
+    cache = dno->ext_cache;
+
+    // decode the leaf past the room the tail needs, filling the gaps with holes
+    e = cache + count + max_count;
+    new_count = 0;
+    for (i = 0; i < entries; i++) {
+        start = ext[i].ee_block;
+        len = ext[i].ee_len;
+        if (len > 32768)
+            len -= 32768;   // uninitialized extent
+        if (len == 0)
+            continue;
+        if (start < lo || start >= hi || len > hi - start)
+            return FSW_VOLUME_CORRUPTED;
+        if (start > lo) {
+            e[new_count].log_start = lo;
+            e[new_count].log_count = start - lo;
+            e[new_count].phys_start = 0;
+            e[new_count].type = FSW_EXTENT_TYPE_SPARSE;
+            new_count++;
+        }
+        e[new_count].log_start = start;
+        e[new_count].log_count = len;
+        e[new_count].phys_start = ((fsw_u64)ext[i].ee_start_hi << 32) | ext[i].ee_start_lo;
+        e[new_count].type = (ext[i].ee_len > 32768) ? FSW_EXTENT_TYPE_SPARSE : FSW_EXTENT_TYPE_PHYSBLOCK;
+        new_count++;
+        lo = start + len;
+    }
+    if (lo < hi) {
+        e[new_count].log_start = lo;
+        e[new_count].log_count = hi - lo;
+        e[new_count].phys_start = 0;
+        e[new_count].type = FSW_EXTENT_TYPE_SPARSE;
+        new_count++;
+    }
+
+    // move the tail up and the leaf in
+    for (i = count; i > pos; i--)
+        cache[i - 1 + new_count] = cache[i - 1];
+    fsw_memcpy(cache + pos, e, new_count * sizeof(struct fsw_ext4_cached_extent));
+    dno->ext_cache_count = count + new_count;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Check the metadata_csum checksum of an extent tree block. It follows the eh_max
+ * entries of the block and covers them with the header, seeded by the inode.
+ */
+
+static int fsw_ext4_ext_block_csum_ok(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                      void *buffer, fsw_u32 node_size)
+{
+    fsw_u32         offset;
+
+    offset = sizeof(struct ext4_extent_header) +
+        (fsw_u32)((struct ext4_extent_header *)buffer)->eh_max * sizeof(struct ext4_extent);
+    if (offset + sizeof(struct ext4_extent_tail) > node_size)
+        return 0;
+    return fsw_crc32c(dno->csum_seed, buffer, offset) ==
+        ((struct ext4_extent_tail *)((fsw_u8 *)buffer + offset))->et_checksum;
+}
+
+/**
+ * Get the entry of a dnode's extent cache that covers a logical block. On a miss, the
+ * extent tree is read from the inode down to the leaf that maps the block, and the
+ * whole leaf is put into the cache, so that sequential reads descend the tree once
+ * per leaf. Each node is searched for the last index that starts at or before the
+ * block by binary search, as the kernel does.
+ */
+
+static fsw_status_t fsw_ext4_ext_cache_get(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                           fsw_u32 bno, struct fsw_ext4_cached_extent **entry_out)
+{
+    fsw_status_t  status;
+    fsw_u32       lo, hi, l, r, m, node_size, depth;
+    fsw_u64       phys_bno, release_bno;
+    int           i;
     void          *buffer;
 
     struct ext4_extent_header  *ext4_extent_header;
     struct ext4_extent_idx     *ext4_extent_idx;
-    struct ext4_extent         *ext4_extent;
 
-    // Logical block requested by core...
-    bno = extent->log_start;
+    i = fsw_ext4_ext_cache_find(dno, bno);
+    if (i >= 0) {
+        *entry_out = &dno->ext_cache[i];
+        return FSW_SUCCESS;
+    }
 
     // First buffer is the i_block field from inode...
     buffer = (void *)dno->raw->i_block;
-    buf_offset = 0;
-    while(1) {
-        ext4_extent_header = (struct ext4_extent_header *)((char *)buffer + buf_offset);
-        buf_offset += sizeof(struct ext4_extent_header);
-        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent header with %d entries\n"), 
-                      ext4_extent_header->eh_entries));
-        if(ext4_extent_header->eh_magic != EXT4_EXT_MAGIC)
-            return FSW_VOLUME_CORRUPTED;
+    node_size = sizeof(dno->raw->i_block);
+    depth = ((struct ext4_extent_header *)buffer)->eh_depth;
+    lo = 0;
+    hi = 0xffffffff;
+    release_bno = 0;
+    while (1) {
+        ext4_extent_header = (struct ext4_extent_header *)buffer;
+        if (ext4_extent_header->eh_magic != EXT4_EXT_MAGIC || ext4_extent_header->eh_depth != depth ||
+            depth > 5 || ext4_extent_header->eh_entries > ext4_extent_header->eh_max ||
+            sizeof(struct ext4_extent_header) +
+                (fsw_u32)ext4_extent_header->eh_max * sizeof(struct ext4_extent) > node_size) {
+            status = FSW_VOLUME_CORRUPTED;
+            goto out;
+        }
+        if (release_bno && vol->verify_csum && !fsw_ext4_ext_block_csum_ok(vol, dno, buffer, node_size)) {
+            status = FSW_VOLUME_CORRUPTED;
+            goto out;
+        }
+        if (depth == 0)
+            break;
+        if (ext4_extent_header->eh_entries == 0) {
+            status = FSW_VOLUME_CORRUPTED;
+            goto out;
+        }
 
-        for(ext_cnt = 0;ext_cnt < ext4_extent_header->eh_entries;ext_cnt++)
-        {
-            if(ext4_extent_header->eh_depth == 0)
-            {
-                // Leaf node, the header follows actual extents
-                ext4_extent = (struct ext4_extent *)((char *)buffer + buf_offset);
-                buf_offset += sizeof(struct ext4_extent);
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent node cover %d...\n"), ext4_extent->ee_block));
-
-                // Is the requested block in this extent?
-                if(bno >= ext4_extent->ee_block && bno < ext4_extent->ee_block + ext4_extent->ee_len)
-                {
-                    extent->phys_start = ((fsw_u64)ext4_extent->ee_start_hi << 32) | ext4_extent->ee_start_lo;
-                    extent->phys_start += (bno - ext4_extent->ee_block);
-                    extent->log_count = ext4_extent->ee_len - (bno - ext4_extent->ee_block);
-                    return FSW_SUCCESS;
-                }
-            }
+        // binary search over entries 1..eh_entries-1; entry 0 covers everything before entry 1
+        ext4_extent_idx = (struct ext4_extent_idx *)(ext4_extent_header + 1);
+        l = 1;
+        r = ext4_extent_header->eh_entries;
+        while (l < r) {
+            m = l + (r - l) / 2;
+            if (ext4_extent_idx[m].ei_block > bno)
+                r = m;
             else
-            {
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index extents, depth %d\n"), 
-                          ext4_extent_header->eh_depth));
-                ext4_extent_idx = (struct ext4_extent_idx *)((char *)buffer + buf_offset);
-                buf_offset += sizeof(struct ext4_extent_idx);
-
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index node covers block %d...\n"),
-                          ext4_extent_idx->ei_block));
-                if(bno >= ext4_extent_idx->ei_block)
-                {
-                    // Follow extent tree...
-                    fsw_u64 phys_bno = ((fsw_u64)ext4_extent_idx->ei_leaf_hi << 32) | ext4_extent_idx->ei_leaf_lo;
-                    status = fsw_block_get(vol, phys_bno, 1, (void **)&buffer);
-                    if (status)
-                        return status;
-                    buf_offset = 0;
-                    break;
-                }
-            }
+                l = m + 1;
         }
+        l--;
+        if (l > 0)
+            lo = ext4_extent_idx[l].ei_block;
+        if (l + 1 < ext4_extent_header->eh_entries)
+            hi = ext4_extent_idx[l + 1].ei_block;
+
+        // Follow extent tree...
+        phys_bno = ((fsw_u64)ext4_extent_idx[l].ei_leaf_hi << 32) | ext4_extent_idx[l].ei_leaf_lo;
+        if (release_bno)
+            fsw_block_release(vol, release_bno, buffer);
+        release_bno = 0;
+        status = fsw_block_get(vol, phys_bno, 1, &buffer);
+        if (status)
+            return status;
+        release_bno = phys_bno;
+        node_size = vol->g.phys_blocksize;
+        depth--;
+    }
+
+    if (lo >= hi) {
+        status = FSW_VOLUME_CORRUPTED;
+        goto out;
     }
+    status = fsw_ext4_ext_cache_add(dno, (struct ext4_extent *)(ext4_extent_header + 1),
+                                    ext4_extent_header->eh_entries, lo, hi);
+    if (status)
+        goto out;
+    i = fsw_ext4_ext_cache_find(dno, bno);
+    if (i < 0) {
+        status = FSW_NOT_FOUND;
+        goto out;
+    }
+    *entry_out = &dno->ext_cache[i];
+
+out:
+    if (release_bno)
+        fsw_block_release(vol, release_bno, buffer);
+    return status;
+}
+
+/**
+ * Hand out the part of a cached extent from a logical block on. Holes are cut off at
+ * the end of the file, the last one of a file covers the rest of the logical blocks.
+ */
 
-    return FSW_NOT_FOUND;
+static void fsw_ext4_ext_cache_copy(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                    struct fsw_ext4_cached_extent *entry, fsw_u32 bno, struct fsw_extent *extent)
+{
+    fsw_u64       file_bcnt;
+
+    extent->type = entry->type;
+    extent->log_start = bno;
+    extent->log_count = entry->log_start + entry->log_count - bno;
+    extent->phys_start = entry->phys_start + (bno - entry->log_start);
+    extent->buffer = NULL;
+    if (entry->type == FSW_EXTENT_TYPE_SPARSE) {
+        file_bcnt = FSW_U64_DIV(dno->g.size + vol->g.log_blocksize - 1, vol->g.log_blocksize);
+        if (file_bcnt > bno && file_bcnt - bno < extent->log_count)
+            extent->log_count = (fsw_u32)(file_bcnt - bno);
+    }
+}
+
+/**
+ * New ext4 extents...
+ */
+static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                        struct fsw_extent *extent)
+{
+    fsw_status_t  status;
+    struct fsw_ext4_cached_extent *entry;
+
+    status = fsw_ext4_ext_cache_get(vol, dno, (fsw_u32)extent->log_start, &entry);
+    if (status)
+        return status;
+    fsw_ext4_ext_cache_copy(vol, dno, entry, (fsw_u32)extent->log_start, extent);
+    return FSW_SUCCESS;
+}
+
+/**
+ * Map a run of consecutive extents for the core's extent list. They are handed out
+ * from the dnode's extent cache, starting with the entry that covers log_start, for
+ * as long as the cached entries follow each other. Uninitialized extents read as
+ * zeroes, so they are sparse, like holes. Inodes that use the old block addressing
+ * are left to fsw_ext4_get_extent.
+ */
+
+static fsw_status_t fsw_ext4_get_extents(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                         fsw_u64 log_start, struct fsw_extent *extents, fsw_u32 *count_inout)
+{
+    fsw_status_t  status;
+    struct fsw_ext4_cached_extent *entry, *end;
+    fsw_u32       bno, n;
+
+    if (!(dno->raw->i_flags & 1 << EXT4_INODE_EXTENTS))
+        return FSW_UNSUPPORTED;
+
+    bno = (fsw_u32)log_start;
+    status = fsw_ext4_ext_cache_get(vol, dno, bno, &entry);
+    if (status)
+        return status;
+    end = dno->ext_cache + dno->ext_cache_count;
+    n = 0;
+    while (n < *count_inout) {
+        fsw_ext4_ext_cache_copy(vol, dno, entry, bno, &extents[n]);
+        bno = entry->log_start + entry->log_count;
+        n++;
+        if (extents[n-1].log_start + extents[n-1].log_count != bno)
+            break;  // a hole cut off at the end of the file
+        entry++;
+        if (entry == end || entry->log_start != bno)
+            break;
+    }
+    *count_inout = n;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Get the copy of an indirect block in a dnode's block map, reading the block on
+ * first use. If the block points to further indirect blocks, their copies hang off
+ * the node as they are read in turn.
+ */
+
+static fsw_status_t fsw_ext4_bmap_get(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                     struct fsw_ext4_bmap_node **node_inout, fsw_u32 bno, int has_children)
+{
+    fsw_status_t    status;
+    struct fsw_ext4_bmap_node *node;
+    void            *buffer;
+
+    if (*node_inout != NULL)
+        return FSW_SUCCESS;
+
+    status = fsw_dnode_cache_alloc(dno, sizeof(struct fsw_ext4_bmap_node), (void **)&node);
+    if (status)
+        return status;
+    status = fsw_dnode_cache_alloc(dno, vol->ind_bcnt * sizeof(fsw_u32), (void **)&node->ptrs);
+    if (status == FSW_SUCCESS && has_children)
+        status = fsw_dnode_cache_alloc(dno, vol->ind_bcnt * sizeof(struct fsw_ext4_bmap_node *),
+                                       (void **)&node->children);
+    if (status == FSW_SUCCESS) {
+        status = fsw_block_get(vol, bno, 1, &buffer);
+        if (status == FSW_SUCCESS) {
+            fsw_memcpy(node->ptrs, buffer, vol->ind_bcnt * sizeof(fsw_u32));
+            fsw_block_release(vol, bno, buffer);
+        }
+    }
+    if (status) {
+        fsw_ext4_bmap_free(vol, dno, node);
+        return status;
+    }
+    *node_inout = node;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free a node of a dnode's block map and the nodes below it.
+ */
+
+static void fsw_ext4_bmap_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                               struct fsw_ext4_bmap_node *node)
+{
+    fsw_u32         i;
+
+    if (node == NULL)
+        return;
+    if (node->children) {
+        for (i = 0; i < vol->ind_bcnt; i++)
+            fsw_ext4_bmap_free(vol, dno, node->children[i]);
+        fsw_dnode_cache_free(dno, vol->ind_bcnt * sizeof(struct fsw_ext4_bmap_node *), node->children);
+    }
+    fsw_dnode_cache_free(dno, vol->ind_bcnt * sizeof(fsw_u32), node->ptrs);
+    fsw_dnode_cache_free(dno, sizeof(struct fsw_ext4_bmap_node), node);
 }
 
 /**
@@ -474,9 +1040,10 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
                                         struct fsw_extent *extent)
 {
     fsw_status_t    status;
-    fsw_u32         bno, release_bno, buf_bcnt, file_bcnt;
+    fsw_u32         bno, buf_bcnt, file_bcnt;
     int             path[5], i;
-    fsw_u32         *buffer;
+    fsw_u32         *ptrs;
+    struct fsw_ext4_bmap_node *node, **slot;
     bno = extent->log_start;
 
     // try direct block pointers in the inode
@@ -513,43 +1080,44 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
         }
     }
     
-    // follow the indirection path
-    buffer = dno->raw->i_block;
+    // follow the indirection path, through the dnode's copies of the indirect blocks;
+    // a map that has grown too large is dropped and built again along the way
+    if (dno->g.cache_bytes >= FSW_DNODE_CACHE_MAX_BYTES)
+        fsw_ext4_dnode_trim(vol, dno);
+    ptrs = dno->raw->i_block;
     buf_bcnt = EXT4_NDIR_BLOCKS;
-    release_bno = 0;
+    node = NULL;
     for (i = 0; ; i++) {
-        bno = buffer[path[i]];
-        if (bno == 0) {
-            extent->type = FSW_EXTENT_TYPE_SPARSE;
-            if (release_bno)
-                fsw_block_release(vol, release_bno, buffer);
-            return FSW_SUCCESS;
-        }
-        if (path[i+1] < 0)
+        bno = ptrs[path[i]];
+        if (bno == 0 || path[i+1] < 0)
             break;
 
-        if (release_bno)
-            fsw_block_release(vol, release_bno, buffer);
-        status = fsw_block_get(vol, bno, 1, (void **)&buffer);
+        slot = (i == 0) ? &dno->bmap[path[0] - EXT4_IND_BLOCK] : &node->children[path[i]];
+        status = fsw_ext4_bmap_get(vol, dno, slot, bno, path[i+2] >= 0);
         if (status)
             return status;
-        release_bno = bno;
+        node = *slot;
+        ptrs = node->ptrs;
         buf_bcnt = vol->ind_bcnt;
     }
     extent->phys_start = bno;
+    if (bno == 0) {
+        extent->type = FSW_EXTENT_TYPE_SPARSE;
+        if (path[i+1] >= 0)
+            return FSW_SUCCESS;     // a missing indirect block
+    }
 
-    // check if the following blocks can be aggregated into one extent
-    file_bcnt = (fsw_u32)((dno->g.size + vol->g.log_blocksize - 1) & (vol->g.log_blocksize - 1));
+    // check if the following blocks can be aggregated into one extent, or one hole
+    file_bcnt = (fsw_u32)FSW_U64_DIV(dno->g.size + vol->g.log_blocksize - 1, vol->g.log_blocksize);
     while (path[i]           + extent->log_count < buf_bcnt &&    // indirect block has more block pointers
            extent->log_start + extent->log_count < file_bcnt) {   // file has more blocks
-        if (buffer[path[i] + extent->log_count] == buffer[path[i] + extent->log_count - 1] + 1)
+        if (bno == 0 ? ptrs[path[i] + extent->log_count] == 0 :
+                       ptrs[path[i] + extent->log_count] == bno + extent->log_count)
             extent->log_count++;
         else
             break;
     }
 
-    if (release_bno)
-        fsw_block_release(vol, release_bno, buffer);
     return FSW_SUCCESS;
 }
 
@@ -558,6 +1126,9 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
  * to retrieve the directory entry with the given name. A dnode is constructed for
  * this entry and returned. The core makes sure that fsw_ext4_dnode_fill has been called
  * and the dnode is actually a directory.
+ *
+ * Hash-indexed directories are searched through their HTree; others, and those whose
+ * index can't be used, are scanned from the start.
  */
 
 static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
@@ -571,6 +1142,24 @@ static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_
 
     // Preconditions: The caller has checked that dno is a directory node.
 
+    if (dno->g.dir_lookup_indexed) {
+        // the index is hashed over the names as stored on disk; a name with characters
+        // that don't survive the conversion is left to the scan, which compares exactly
+        status = fsw_strdup_coerce(&entry_name, FSW_STRING_TYPE_ISO88591, lookup_name);
+        if (status == FSW_SUCCESS && !fsw_streq(lookup_name, &entry_name)) {
+            fsw_strfree(&entry_name);
+            status = FSW_UNSUPPORTED;
+        }
+        if (status == FSW_SUCCESS) {
+            status = fsw_ext4_dx_lookup(vol, dno, &entry_name, &child_ino);
+            if (status == FSW_SUCCESS)
+                status = fsw_dnode_create(dno, child_ino, FSW_DNODE_TYPE_UNKNOWN, &entry_name, child_dno_out);
+            fsw_strfree(&entry_name);
+            if (status != FSW_UNSUPPORTED)
+                return status;
+        }
+    }
+
     entry_name.type = FSW_STRING_TYPE_ISO88591;
 
     // setup handle to read the directory
@@ -608,6 +1197,379 @@ errorexit:
     return status;
 }
 
+/**
+ * Pack up to num words of a name into buf for the half-MD4 and TEA hashes, padding
+ * with the name's length, as str2hashbuf_signed/_unsigned in Linux do.
+ */
+
+static void fsw_ext4_dx_str2hashbuf(const fsw_u8 *msg, int len, fsw_u32 *buf, int num, int is_signed)
+{
+    fsw_u32         pad, val;
+    int             i, c;
+
+    pad = (fsw_u32)len | ((fsw_u32)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (i = 0; i < len; i++) {
+        c = is_signed ? (int)(signed char)msg[i] : (int)msg[i];
+        val = (fsw_u32)c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+#define DX_ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = DX_ROL32(a, s))
+#define DX_K2 0x5A827999
+#define DX_K3 0x6ED9EBA1
+
+/**
+ * The cut-down MD4 transform used by the half-MD4 directory hash.
+ */
+
+static void fsw_ext4_dx_half_md4(fsw_u32 buf[4], const fsw_u32 in[8])
+{
+    fsw_u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    DX_ROUND(DX_F, a, b, c, d, in[0],  3);
+    DX_ROUND(DX_F, d, a, b, c, in[1],  7);
+    DX_ROUND(DX_F, c, d, a, b, in[2], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[3], 19);
+    DX_ROUND(DX_F, a, b, c, d, in[4],  3);
+    DX_ROUND(DX_F, d, a, b, c, in[5],  7);
+    DX_ROUND(DX_F, c, d, a, b, in[6], 11);
+    DX_ROUND(DX_F, b, c, d, a, in[7], 19);
+
+    DX_ROUND(DX_G, a, b, c, d, in[1] + DX_K2,  3);
+    DX_ROUND(DX_G, d, a, b, c, in[3] + DX_K2,  5);
+    DX_ROUND(DX_G, c, d, a, b, in[5] + DX_K2,  9);
+    DX_ROUND(DX_G, b, c, d, a, in[7] + DX_K2, 13);
+    DX_ROUND(DX_G, a, b, c, d, in[0] + DX_K2,  3);
+    DX_ROUND(DX_G, d, a, b, c, in[2] + DX_K2,  5);
+    DX_ROUND(DX_G, c, d, a, b, in[4] + DX_K2,  9);
+    DX_ROUND(DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+    DX_ROUND(DX_H, a, b, c, d, in[3] + DX_K3,  3);
+    DX_ROUND(DX_H, d, a, b, c, in[7] + DX_K3,  9);
+    DX_ROUND(DX_H, c, d, a, b, in[2] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[6] + DX_K3, 15);
+    DX_ROUND(DX_H, a, b, c, d, in[1] + DX_K3,  3);
+    DX_ROUND(DX_H, d, a, b, c, in[5] + DX_K3,  9);
+    DX_ROUND(DX_H, c, d, a, b, in[0] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/**
+ * The TEA transform used by the TEA directory hash.
+ */
+
+static void fsw_ext4_dx_tea(fsw_u32 buf[4], const fsw_u32 in[4])
+{
+    fsw_u32         sum = 0;
+    fsw_u32         b0 = buf[0], b1 = buf[1];
+    fsw_u32         a = in[0], b = in[1], c = in[2], d = in[3];
+    int             n = 16;
+
+    do {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+/**
+ * The original ("legacy") directory hash.
+ */
+
+static fsw_u32 fsw_ext4_dx_legacy(const fsw_u8 *name, int len, int is_signed)
+{
+    fsw_u32         hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int             c;
+
+    while (len--) {
+        c = is_signed ? (int)(signed char)*name++ : (int)*name++;
+        hash = hash1 + (hash0 ^ ((fsw_u32)c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+/**
+ * Hash a name for lookup in a hash-indexed directory, as ext4fs_dirhash in Linux does.
+ * Only the major hash is computed, which is all that a lookup needs. Returns
+ * FSW_UNSUPPORTED for unknown hash versions.
+ */
+
+static fsw_status_t fsw_ext4_dx_hash(struct fsw_ext4_volume *vol, int hash_version,
+                                     const fsw_u8 *name, int len, fsw_u32 *hash_out)
+{
+    fsw_u32         buf[4], in[8], hash;
+    int             i, is_signed;
+
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+    for (i = 0; i < 4; i++) {
+        if (vol->sb->s_hash_seed[i]) {
+            fsw_memcpy(buf, vol->sb->s_hash_seed, sizeof(buf));
+            break;
+        }
+    }
+
+    // the directory records the signed variant; the superblock says which one was used
+    if (hash_version <= DX_HASH_TEA && (vol->sb->s_flags & EXT4_FLAGS_UNSIGNED_HASH))
+        hash_version += DX_HASH_LEGACY_UNSIGNED;
+    is_signed = hash_version < DX_HASH_LEGACY_UNSIGNED;
+
+    switch (hash_version) {
+        case DX_HASH_LEGACY:
+        case DX_HASH_LEGACY_UNSIGNED:
+            hash = fsw_ext4_dx_legacy(name, len, is_signed);
+            break;
+        case DX_HASH_HALF_MD4:
+        case DX_HASH_HALF_MD4_UNSIGNED:
+            for (; len > 0; len -= 32, name += 32) {
+                fsw_ext4_dx_str2hashbuf(name, len, in, 8, is_signed);
+                fsw_ext4_dx_half_md4(buf, in);
+            }
+            hash = buf[1];
+            break;
+        case DX_HASH_TEA:
+        case DX_HASH_TEA_UNSIGNED:
+            for (; len > 0; len -= 16, name += 16) {
+                fsw_ext4_dx_str2hashbuf(name, len, in, 4, is_signed);
+                fsw_ext4_dx_tea(buf, in);
+            }
+            hash = buf[0];
+            break;
+        default:
+            return FSW_UNSUPPORTED;
+    }
+
+    hash &= ~1;
+    if (hash == (EXT4_HTREE_EOF_32BIT << 1))
+        hash = (EXT4_HTREE_EOF_32BIT - 1) << 1;
+    *hash_out = hash;
+    return FSW_SUCCESS;
+}
+
+/**
+ * One level of the path from the HTree root to a leaf: the entries of an index block
+ * and the one that was followed.
+ */
+
+struct fsw_ext4_dx_frame {
+    struct dx_entry *entries;
+    fsw_u32         count;
+    fsw_u32         at;
+};
+
+/**
+ * Read logical block lblk of a directory into buffer.
+ */
+
+static fsw_status_t fsw_ext4_dx_read_block(struct fsw_shandle *shand, fsw_u32 lblk, fsw_u8 *buffer)
+{
+    fsw_status_t    status;
+    fsw_u32         buffer_size;
+
+    shand->pos = (fsw_u64)lblk * shand->dnode->vol->g.log_blocksize;
+    buffer_size = shand->dnode->vol->g.log_blocksize;
+    status = fsw_shandle_read(shand, &buffer_size, buffer);
+    if (status)
+        return status;
+    if (buffer_size != shand->dnode->vol->g.log_blocksize)
+        return FSW_VOLUME_CORRUPTED;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Set up an HTree frame for the index entries at offset in an index block, checking
+ * their count and limit, and pick the last entry whose hash is not above hash.
+ * Returns FSW_UNSUPPORTED if the index block doesn't make sense.
+ */
+
+static fsw_status_t fsw_ext4_dx_frame_probe(struct fsw_ext4_volume *vol, fsw_u8 *buffer, fsw_u32 offset,
+                                            fsw_u32 hash, struct fsw_ext4_dx_frame *frame)
+{
+    struct dx_countlimit *countlimit;
+    fsw_u32         limit, lo, hi, mid;
+
+    if (offset + sizeof(struct dx_entry) > vol->g.log_blocksize)
+        return FSW_UNSUPPORTED;
+    countlimit = (struct dx_countlimit *)(buffer + offset);
+    limit = countlimit->limit;
+    frame->entries = (struct dx_entry *)(buffer + offset);
+    frame->count = countlimit->count;
+    if (frame->count == 0 || frame->count > limit ||
+        offset + limit * sizeof(struct dx_entry) > vol->g.log_blocksize)
+        return FSW_UNSUPPORTED;
+
+    // binary search over entries 1..count-1; entry 0 covers all hashes below entry 1's
+    lo = 1;
+    hi = frame->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (frame->entries[mid].hash > hash)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    frame->at = lo - 1;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Search a directory leaf block for a name. Sets *child_ino_out to the entry's inode
+ * number, or to 0 if the name is not in the block.
+ */
+
+static fsw_status_t fsw_ext4_dx_search_leaf(struct fsw_ext4_volume *vol, fsw_u8 *buffer,
+                                            struct fsw_string *name, fsw_u32 *child_ino_out)
+{
+    struct ext4_dir_entry *entry;
+    fsw_u32         offset;
+
+    *child_ino_out = 0;
+    for (offset = 0; offset + 8 <= vol->g.log_blocksize; offset += entry->rec_len) {
+        entry = (struct ext4_dir_entry *)(buffer + offset);
+        if (entry->rec_len < 8 || offset + entry->rec_len > vol->g.log_blocksize)
+            return FSW_VOLUME_CORRUPTED;
+        if (entry->inode != 0 && entry->name_len == name->size &&
+            8 + entry->name_len <= entry->rec_len &&
+            fsw_memeq(entry->name, name->data, name->size)) {
+            *child_ino_out = entry->inode;
+            break;
+        }
+    }
+    return FSW_SUCCESS;
+}
+
+/**
+ * Look up a name through the HTree of a hash-indexed directory, following the index
+ * blocks down to the one leaf block that can hold the name, and on to the following
+ * leaves while their hashes continue the name's (hash collisions). The name must be
+ * in the on-disk encoding. Returns FSW_UNSUPPORTED if the index can't be used, so
+ * that the caller can scan the directory instead.
+ */
+
+static fsw_status_t fsw_ext4_dx_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                       struct fsw_string *name, fsw_u32 *child_ino_out)
+{
+    fsw_status_t    status;
+    struct fsw_shandle shand;
+    struct fsw_ext4_dx_frame frames[EXT4_HTREE_LEVEL];
+    struct dx_root_info *info;
+    fsw_u8          *buffer, *leaf;
+    fsw_u32         bs = vol->g.log_blocksize;
+    fsw_u32         hash, levels, level;
+
+    if (bs < 32)
+        return FSW_UNSUPPORTED;
+    status = fsw_alloc(bs * (EXT4_HTREE_LEVEL + 1), &buffer);
+    if (status)
+        return status;
+    leaf = buffer + bs * EXT4_HTREE_LEVEL;
+    status = fsw_shandle_open(dno, &shand);
+    if (status) {
+        fsw_free(buffer);
+        return status;
+    }
+
+    // the root block: "." and ".." entries of 12 bytes each, then the root info
+    status = fsw_ext4_dx_read_block(&shand, 0, buffer);
+    if (status)
+        goto done;
+    info = (struct dx_root_info *)(buffer + 24);
+    status = FSW_UNSUPPORTED;
+    if (info->reserved_zero != 0 || info->info_length < 8 || info->indirect_levels >= EXT4_HTREE_LEVEL)
+        goto done;
+    levels = info->indirect_levels;
+    status = fsw_ext4_dx_hash(vol, info->hash_version, (fsw_u8 *)name->data, name->size, &hash);
+    if (status)
+        goto done;
+    status = fsw_ext4_dx_frame_probe(vol, buffer, 24 + info->info_length, hash, &frames[0]);
+    if (status)
+        goto done;
+
+    // interior index blocks start with an empty 8-byte entry spanning the block
+    for (level = 1; level <= levels; level++) {
+        status = fsw_ext4_dx_read_block(&shand, frames[level - 1].entries[frames[level - 1].at].block & 0x0fffffff,
+                                        buffer + bs * level);
+        if (status)
+            goto done;
+        status = fsw_ext4_dx_frame_probe(vol, buffer + bs * level, 8, hash, &frames[level]);
+        if (status)
+            goto done;
+    }
+
+    while (1) {
+        status = fsw_ext4_dx_read_block(&shand, frames[levels].entries[frames[levels].at].block & 0x0fffffff, leaf);
+        if (status)
+            goto done;
+        status = fsw_ext4_dx_search_leaf(vol, leaf, name, child_ino_out);
+        if (status)
+            goto done;
+        if (*child_ino_out != 0)
+            break;
+
+        // the next leaf can only hold the name if its hash continues ours
+        level = levels;
+        while (frames[level].at + 1 >= frames[level].count) {
+            if (level == 0) {
+                status = FSW_NOT_FOUND;
+                goto done;
+            }
+            level--;
+        }
+        frames[level].at++;
+        if ((frames[level].entries[frames[level].at].hash & ~1) != hash) {
+            status = FSW_NOT_FOUND;
+            goto done;
+        }
+        for (level++; level <= levels; level++) {
+            status = fsw_ext4_dx_read_block(&shand, frames[level - 1].entries[frames[level - 1].at].block & 0x0fffffff,
+                                            buffer + bs * level);
+            if (status)
+                goto done;
+            status = fsw_ext4_dx_frame_probe(vol, buffer + bs * level, 8, 0, &frames[level]);
+            if (status)
+                goto done;
+            frames[level].at = 0;
+        }
+    }
+
+done:
+    fsw_shandle_close(&shand);
+    fsw_free(buffer);
+    return status;
+}
+
 /**
  * Get the next directory entry when reading a directory. This function is called during
  * directory iteration to retrieve the next directory entry. A dnode is constructed for
@@ -728,7 +1690,7 @@ static fsw_status_t fsw_ext4_readlink(struct fsw_ext4_volume *vol, struct fsw_ex
     /* Linux kernels ext4_inode_is_fast_symlink... */
     ea_blocks = dno->raw->i_file_acl_lo ? (vol->g.log_blocksize >> 9) : 0;
 
-    if (dno->raw->i_blocks_lo - ea_blocks == 0) {
+    if (!(dno->raw->i_flags & 1 << EXT4_INODE_INLINE_DATA) && dno->raw->i_blocks_lo - ea_blocks == 0) {
         // "fast" symlink, path is stored inside the inode
         s.type = FSW_STRING_TYPE_ISO88591;
         s.size = s.len = (int)dno->g.size;
@@ -36,6 +36,8 @@
 #define EXT4_SUPERBLOCK_BLOCKSIZE  1024
 //! Block number where the (master copy of the) ext4 superblock resides.
 #define EXT4_SUPERBLOCK_BLOCKNO       1
+//! Most entries kept in the extent cache of one inode; more empty the cache first.
+#define EXT4_EXTENT_CACHE_MAX      4096
 
 
 /**
@@ -46,10 +48,35 @@ struct fsw_ext4_volume {
     struct fsw_volume g;            //!< Generic volume structure
     
     struct ext4_super_block *sb;    //!< Full raw ext2 superblock structure
-    fsw_u64     *inotab_bno;        //!< Block numbers of the inode tables
+    fsw_u64     *inotab_bno;        //!< Block numbers of the inode tables, 0 until read
+    fsw_u32     groupcnt;           //!< Number of block groups
     fsw_u32     ind_bcnt;           //!< Number of blocks addressable through an indirect block
     fsw_u32     dind_bcnt;          //!< Number of blocks addressable through a double-indirect block
     fsw_u32     inode_size;         //!< Size of inode structure in bytes
+    int         verify_csum;        //!< Nonzero to check metadata checksums (FSW_MOUNT_VERIFY_CHECKSUMS)
+    fsw_u32     csum_seed;          //!< Checksum seed of the file system, from the UUID or s_checksum_seed
+};
+
+/**
+ * ext4: A run of logical blocks from an extent tree leaf, as kept in a dnode's extent
+ * cache. The gaps between a leaf's extents are kept as holes.
+ */
+
+struct fsw_ext4_cached_extent {
+    fsw_u32     log_start;          //!< First logical block
+    fsw_u32     log_count;          //!< Number of logical blocks
+    fsw_u64     phys_start;         //!< First physical block (for FSW_EXTENT_TYPE_PHYSBLOCK only)
+    fsw_u32     type;               //!< FSW_EXTENT_TYPE_PHYSBLOCK, or _SPARSE for holes and uninitialized extents
+};
+
+/**
+ * ext4: A copy of an indirect block in a dnode's block map. Nodes for double- and
+ * triple-indirect blocks also keep the copies of the blocks they point to.
+ */
+
+struct fsw_ext4_bmap_node {
+    fsw_u32     *ptrs;              //!< Block pointers of the indirect block (ind_bcnt entries)
+    struct fsw_ext4_bmap_node **children; //!< Nodes of the blocks pointed to, NULL until read (none for single-indirect)
 };
 
 /**
@@ -60,6 +87,11 @@ struct fsw_ext4_dnode {
     struct fsw_dnode g;             //!< Generic dnode structure
     
     struct ext4_inode *raw;         //!< Full raw inode structure
+    struct fsw_ext4_bmap_node *bmap[3];   //!< Block map: the indirect, double- and triple-indirect blocks read so far
+    struct fsw_ext4_cached_extent *ext_cache;   //!< Extents of the leaves read so far, sorted by log_start
+    fsw_u32     ext_cache_count;    //!< Number of valid entries in ext_cache
+    fsw_u32     ext_cache_size;     //!< Number of entries allocated for ext_cache
+    fsw_u32     csum_seed;          //!< Checksum seed of the inode, from its number and generation
 };
 
 
@@ -251,6 +251,7 @@ enum {
 	EXT4_INODE_EXTENTS	= 19,	/* Inode uses extents */
 	EXT4_INODE_EA_INODE	= 21,	/* Inode used for large EA */
 	EXT4_INODE_EOFBLOCKS	= 22,	/* Blocks allocated beyond EOF */
+	EXT4_INODE_INLINE_DATA	= 28,	/* Data in inode. */
 	EXT4_INODE_RESERVED	= 31,	/* reserved for ext4 lib */
 };
 
@@ -366,7 +367,13 @@ struct ext4_super_block {
 	__le32	s_usr_quota_inum;	/* inode for tracking user quota */
 	__le32	s_grp_quota_inum;	/* inode for tracking group quota */
 	__le32	s_overhead_clusters;	/* overhead blocks/clusters in fs */
-	__le32	s_reserved[108];	/* Padding to the end of the block */
+	__le32	s_backup_bgs[2];	/* groups with sparse_super2 SBs */
+	__u8	s_encrypt_algos[4];	/* Encryption algorithms in use  */
+	__u8	s_encrypt_pw_salt[16];	/* Salt used for string2key algorithm */
+	__le32	s_lpf_ino;		/* Location of the lost+found inode */
+	__le32	s_prj_quota_inum;	/* inode for tracking project quota */
+	__le32	s_checksum_seed;	/* crc32c(uuid) if csum_seed set */
+	__le32	s_reserved[98];		/* Padding to the end of the block */
 	__le32	s_checksum;		/* crc32c(superblock) */
 };
 
@@ -381,10 +388,21 @@ struct ext4_super_block {
 
 #define EXT4_GOOD_OLD_INODE_SIZE 128
 
+/*
+ * Codes for operating systems (s_creator_os)
+ */
+#define EXT4_OS_LINUX           0
+
+/*
+ * Checksum algorithms (s_checksum_type)
+ */
+#define EXT4_CRC32C_CHKSUM      1
+
 /*
  * Feature set definitions (only the once we need for read support)
  */
 #define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER     0x0001
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM	0x0400
 
 #define EXT4_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT4_FEATURE_INCOMPAT_FILETYPE		0x0002
@@ -397,7 +415,7 @@ struct ext4_super_block {
 #define EXT4_FEATURE_INCOMPAT_FLEX_BG		0x0200
 #define EXT4_FEATURE_INCOMPAT_EA_INODE		0x0400 /* EA in inode */
 #define EXT4_FEATURE_INCOMPAT_DIRDATA		0x1000 /* data in dirent */
-#define EXT4_FEATURE_INCOMPAT_BG_USE_META_CSUM	0x2000 /* use crc32c for bg */
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED		0x2000 /* metadata checksum seed in s_checksum_seed */
 #define EXT4_FEATURE_INCOMPAT_LARGEDIR		0x4000 /* >2GB or 3-lvl htree */
 #define EXT4_FEATURE_INCOMPAT_INLINEDATA	0x8000 /* data in inode */
 
@@ -424,6 +442,64 @@ struct ext4_dir_entry {
 // NOTE: The original Linux kernel header defines ext4_dir_entry with the original
 //  layout and ext4_dir_entry_2 with the revised layout. We simply use the revised one.
 
+/*
+ * Hash-indexed (HTree) directories
+ */
+#define EXT4_FEATURE_COMPAT_DIR_INDEX   0x0020
+
+#define EXT4_FLAGS_SIGNED_HASH          0x0001  /* Signed dirhash in use */
+#define EXT4_FLAGS_UNSIGNED_HASH        0x0002  /* Unsigned dirhash in use */
+
+#define DX_HASH_LEGACY                  0
+#define DX_HASH_HALF_MD4                1
+#define DX_HASH_TEA                     2
+#define DX_HASH_LEGACY_UNSIGNED         3
+#define DX_HASH_HALF_MD4_UNSIGNED       4
+#define DX_HASH_TEA_UNSIGNED            5
+
+#define EXT4_HTREE_EOF_32BIT            0x7fffffffU
+#define EXT4_HTREE_LEVEL                3       /* Maximum depth of the index, with largedir */
+
+/* Follows the "." and ".." entries in the first block of an indexed directory */
+struct dx_root_info {
+    __le32  reserved_zero;
+    __u8    hash_version;
+    __u8    info_length;            /* 8 */
+    __u8    indirect_levels;
+    __u8    unused_flags;
+};
+
+/* The first entry of an index block holds a dx_countlimit instead of a hash */
+struct dx_entry {
+    __le32  hash;
+    __le32  block;
+};
+
+struct dx_countlimit {
+    __le16  limit;
+    __le16  count;
+};
+
+/*
+ * Extended attributes stored in the inode, after i_extra_isize. Inline data
+ * beyond the 60 bytes of i_block lives in the "system.data" attribute.
+ */
+#define EXT4_XATTR_MAGIC                0xEA020000
+#define EXT4_XATTR_INDEX_SYSTEM         7
+#define EXT4_MIN_INLINE_DATA_SIZE       60      /* sizeof(i_block) */
+
+struct ext4_xattr_entry {
+    __u8    e_name_len;             /* length of name */
+    __u8    e_name_index;           /* attribute name index */
+    __le16  e_value_offs;           /* offset in disk block of value */
+    __le32  e_value_inum;           /* inode in which the value is stored */
+    __le32  e_value_size;           /* size of attribute value */
+    __le32  e_hash;                 /* hash value of name and value */
+    /* followed by e_name_len bytes of the name, padded to 4 bytes */
+};
+
+#define EXT4_XATTR_LEN(name_len)        (((name_len) + sizeof(struct ext4_xattr_entry) + 3) & ~3)
+
 /*
  * Ext2 directory file types.  Only the low 3 bits are used.  The
  * other bits are reserved for now.
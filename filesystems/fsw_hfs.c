@@ -60,6 +60,9 @@ static fsw_status_t fsw_hfs_dnode_stat(struct fsw_hfs_volume *vol, struct fsw_hf
                                            struct fsw_dnode_stat *sb);
 static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
                                            struct fsw_extent *extent);
+static fsw_status_t fsw_hfs_get_extents(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
+                                            fsw_u64 log_start, struct fsw_extent *extents,
+                                            fsw_u32 *count_inout);
 
 static fsw_status_t fsw_hfs_dir_lookup(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
                                            struct fsw_string *lookup_name, struct fsw_hfs_dnode **child_dno);
@@ -91,6 +94,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(hfs) = {
     fsw_hfs_dir_lookup,  //retrieve the directory entry with the given name
     fsw_hfs_dir_read,	// next directory entry when reading a directory
     fsw_hfs_readlink,   // return FSW_UNSUPPORTED;
+    0,                  // flags
+    fsw_hfs_get_extents, // map the rest of an extent record at once
 };
 
 static const fsw_u16 fsw_latin_case_fold[] =
@@ -371,6 +376,7 @@ static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
                 (tree_header.keyCompareType == kHFSBinaryCompare);
         vol->catalog_tree.root_node = be32_to_cpu (tree_header.rootNode);
         vol->catalog_tree.node_size = be16_to_cpu (tree_header.nodeSize);
+        fsw_slab_init(&vol->catalog_tree.node_slab, vol->catalog_tree.node_size, 4);
 
         //nms42
         /* Take Volume Name before tree_header overwritten */
@@ -412,6 +418,7 @@ static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
 
         vol->extents_tree.root_node = be32_to_cpu (tree_header.rootNode);
         vol->extents_tree.node_size = be16_to_cpu (tree_header.nodeSize);
+        fsw_slab_init(&vol->extents_tree.node_slab, vol->extents_tree.node_size, 4);
 
         rv = FSW_SUCCESS;
     } while (0);
@@ -478,6 +485,8 @@ static void fsw_hfs_volume_free(struct fsw_hfs_volume *vol)
         fsw_free(vol->primary_voldesc);
         vol->primary_voldesc = NULL;
     }
+    fsw_slab_free(&vol->catalog_tree.node_slab);
+    fsw_slab_free(&vol->extents_tree.node_slab);
 }
 
 /**
@@ -604,7 +613,7 @@ fsw_hfs_btree_search (struct fsw_hfs_btree * btree,
     fsw_u8* buffer = NULL;
 
     currnode = btree->root_node;
-    status = fsw_alloc(btree->node_size, &buffer);
+    status = fsw_slab_alloc(&btree->node_slab, (void **)&buffer);
     if (status)
         return status;
     node = (BTNodeDescriptor*)buffer;
@@ -734,7 +743,7 @@ fsw_hfs_btree_search (struct fsw_hfs_btree * btree,
 
   done:
     if (buffer != NULL && status != FSW_SUCCESS)
-        fsw_free(buffer);
+        fsw_slab_release(&btree->node_slab, buffer);
 
     return status;
 }
@@ -849,7 +858,7 @@ fsw_hfs_btree_iterate_node (struct fsw_hfs_btree * btree,
   BTNodeDescriptor*     node = first_node;
   fsw_u8* buffer = NULL;
 
-  status = fsw_alloc(btree->node_size, &buffer);
+  status = fsw_slab_alloc(&btree->node_slab, (void **)&buffer);
   if (status)
       return status;
 
@@ -889,7 +898,7 @@ fsw_hfs_btree_iterate_node (struct fsw_hfs_btree * btree,
                              btree->node_size, buffer) <= 0)
       {
           status = FSW_VOLUME_CORRUPTED;
-          return 1;
+          break;
       }
 
       node = (BTNodeDescriptor*)buffer;
@@ -897,7 +906,7 @@ fsw_hfs_btree_iterate_node (struct fsw_hfs_btree * btree,
   }
  done:
   if (buffer)
-      fsw_free(buffer);
+      fsw_slab_release(&btree->node_slab, buffer);
 
   return status;
 }
@@ -1078,7 +1087,7 @@ static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume * vol,
 
         if (node != NULL)
         {
-            fsw_free(node);
+            fsw_slab_release(&vol->extents_tree.node_slab, node);
             node = NULL;
         }
 
@@ -1095,11 +1104,97 @@ static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume * vol,
     }
 
     if (node != NULL)
-        fsw_free(node);
+        fsw_slab_release(&vol->extents_tree.node_slab, node);
 
     return status;
 }
 
+/**
+ * Map consecutive extents for the core's extent list. fsw_hfs_get_extent returns one
+ * block at a time; here the extent record that covers log_start is found in the same
+ * way, and all of its extents from there on are returned.
+ */
+
+static fsw_status_t fsw_hfs_get_extents(struct fsw_hfs_volume * vol,
+                                        struct fsw_hfs_dnode  * dno,
+                                        fsw_u64                 log_start,
+                                        struct fsw_extent     * extents,
+                                        fsw_u32               * count_inout)
+{
+    fsw_status_t         status;
+    fsw_u32              lbno, start, count, pos, i, n;
+    HFSPlusExtentRecord  *exts;
+    BTNodeDescriptor     *node = NULL;
+
+    lbno = (fsw_u32)log_start;
+    exts = &dno->extents;
+
+    while (1)
+    {
+        struct HFSPlusExtentKey* key;
+        struct HFSPlusExtentKey  overflowkey;
+        fsw_u32                  ptr;
+
+        for (i = 0; i < 8; i++)
+        {
+            count = be32_to_cpu ((*exts)[i].blockCount);
+            if (lbno < count)
+                break;
+            lbno -= count;
+        }
+        if (i < 8)
+            break;
+
+        /* Find appropriate overflow record */
+        overflowkey.fileID = dno->g.dnode_id;
+        overflowkey.startBlock = (fsw_u32)log_start - lbno;
+
+        if (node != NULL)
+        {
+            fsw_slab_release(&vol->extents_tree.node_slab, node);
+            node = NULL;
+        }
+
+        status = fsw_hfs_btree_search (&vol->extents_tree,
+                                       (BTreeKey*)&overflowkey,
+                                       fsw_hfs_cmp_extkey,
+                                       &node, &ptr);
+        if (status)
+        {
+            if (node != NULL)
+                fsw_slab_release(&vol->extents_tree.node_slab, node);
+            return status;
+        }
+
+        key = (struct HFSPlusExtentKey *)
+                fsw_hfs_btree_rec (&vol->extents_tree, node, ptr);
+        exts = (HFSPlusExtentRecord*) (key + 1);
+    }
+
+    pos = (fsw_u32)log_start;
+    for (n = 0; i < 8 && n < *count_inout; i++, n++)
+    {
+        start = be32_to_cpu ((*exts)[i].startBlock);
+        count = be32_to_cpu ((*exts)[i].blockCount);
+        if (count == 0)
+            break;
+
+        extents[n].type = FSW_EXTENT_TYPE_PHYSBLOCK;
+        extents[n].log_start = pos;
+        extents[n].log_count = count - lbno;
+        extents[n].phys_start = start + lbno + vol->emb_block_off;
+        extents[n].buffer = NULL;
+        pos += count - lbno;
+        lbno = 0;
+    }
+    *count_inout = n;
+
+    if (node != NULL)
+        fsw_slab_release(&vol->extents_tree.node_slab, node);
+
+    return FSW_SUCCESS;
+}
+
 static const fsw_u16* g_blacklist[] =
 {
     //L"AppleIntelCPUPowerManagement.kext",
@@ -1287,7 +1382,7 @@ create:
 done:
 
     if (node != NULL)
-        fsw_free(node);
+        fsw_slab_release(&vol->catalog_tree.node_slab, node);
 
     if (free_data)
         fsw_strfree(&rec_name);
@@ -1351,6 +1446,8 @@ static fsw_status_t fsw_hfs_dir_read(struct fsw_hfs_volume *vol,
         goto done;
 
  done:
+    if (node != NULL)
+        fsw_slab_release(&vol->catalog_tree.node_slab, node);
     fsw_strfree(&rec_name);
 
     return status;
@@ -96,6 +96,8 @@ static fsw_status_t fsw_iso9660_dir_lookup(struct fsw_iso9660_volume *vol, struc
 static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
                                          struct fsw_shandle *shand, struct fsw_iso9660_dnode **child_dno);
 static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, struct fsw_shandle *shand, struct iso9660_dirrec_buffer *dirrec_buffer);
+static fsw_status_t fsw_iso9660_next_dirrec(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
+                                            struct fsw_shandle *shand, struct iso9660_dirrec_buffer *dirrec_buffer);
 
 static fsw_status_t fsw_iso9660_readlink(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
                                          struct fsw_string *link);
@@ -123,6 +125,7 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(iso9660) = {
     fsw_iso9660_dir_lookup,
     fsw_iso9660_dir_read,
     fsw_iso9660_readlink,
+    FSW_FSTYPE_DIR_INDEX | FSW_FSTYPE_DIR_POS_BYTES,
 };
 
 static fsw_status_t rr_find_sp(struct iso9660_dirrec *dirrec, struct fsw_rock_ridge_susp_sp **psp)
@@ -508,19 +511,9 @@ static fsw_status_t fsw_iso9660_dir_lookup(struct fsw_iso9660_volume *vol, struc
     // scan the directory for the file
     while (1) {
         // read next entry
-        status = fsw_iso9660_read_dirrec(vol, &shand, &dirrec_buffer);
+        status = fsw_iso9660_next_dirrec(vol, dno, &shand, &dirrec_buffer);
         if (status)
             goto errorexit;
-        if (dirrec->dirrec_length == 0) {
-            // end of directory reached
-            status = FSW_NOT_FOUND;
-            goto errorexit;
-        }
-
-        // skip . and ..
-        if (dirrec->file_identifier_length == 1 &&
-            (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1))
-            continue;
 
         // compare name
         if (fsw_streq(lookup_name, &dirrec_buffer.name))  // TODO: compare case-insensitively
@@ -559,17 +552,42 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
      * should read both blocks.
      */
 
+    status = fsw_iso9660_next_dirrec(vol, dno, shand, &dirrec_buffer);
+    if (status)
+        return status;
+
+    // setup a dnode for the child item
+    status = fsw_dnode_create(dno, dirrec_buffer.ino, FSW_DNODE_TYPE_UNKNOWN, &dirrec_buffer.name, child_dno_out);
+    if (status == FSW_SUCCESS)
+        fsw_memcpy(&(*child_dno_out)->dirrec, dirrec, sizeof(struct iso9660_dirrec));
+
+    return status;
+}
+
+/**
+ * Get the next entry of a directory other than . and .., for both dir_lookup and
+ * dir_read. Records do not cross block boundaries; a zero length byte marks the
+ * padding at the end of a block, and the next record starts in the next block.
+ * Returns FSW_NOT_FOUND at the end of the directory.
+ */
+
+static fsw_status_t fsw_iso9660_next_dirrec(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
+                                            struct fsw_shandle *shand, struct iso9660_dirrec_buffer *dirrec_buffer)
+{
+    fsw_status_t    status;
+    fsw_u64         start;
+    struct iso9660_dirrec *dirrec = &dirrec_buffer->dirrec;
+
     while (1) {
-        // read next entry
         if (shand->pos >= dno->g.size)
-            return FSW_NOT_FOUND; // end of directory
-        status = fsw_iso9660_read_dirrec(vol, shand, &dirrec_buffer);
+            return FSW_NOT_FOUND;   // end of directory
+        start = shand->pos;
+        status = fsw_iso9660_read_dirrec(vol, shand, dirrec_buffer);
         if (status)
             return status;
-        if (dirrec->dirrec_length == 0)
-        {
-            // try the next block
-            shand->pos =(shand->pos & ~(vol->g.log_blocksize - 1)) + vol->g.log_blocksize;
+        if (dirrec->dirrec_length == 0) {
+            // try the next block; the padding may be shorter than the fixed part just read
+            shand->pos = (start & ~(fsw_u64)(vol->g.log_blocksize - 1)) + vol->g.log_blocksize;
             continue;
         }
 
@@ -577,15 +595,8 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
         if (dirrec->file_identifier_length == 1 &&
             (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1))
             continue;
-        break;
+        return FSW_SUCCESS;
     }
-
-    // setup a dnode for the child item
-    status = fsw_dnode_create(dno, dirrec_buffer.ino, FSW_DNODE_TYPE_UNKNOWN, &dirrec_buffer.name, child_dno_out);
-    if (status == FSW_SUCCESS)
-        fsw_memcpy(&(*child_dno_out)->dirrec, dirrec, sizeof(struct iso9660_dirrec));
-
-    return status;
 }
 
 /**
@@ -37,6 +37,17 @@
 
 #include "fsw_core.h"
 
+/**
+ * Allocate the data of a coerced string, from the arena if one is given.
+ */
+
+static fsw_status_t fsw_strcoerce_alloc(struct fsw_arena *arena, int size, void **ptr_out)
+{
+    if (arena != NULL)
+        return fsw_arena_alloc(arena, (fsw_u32)size, ptr_out);
+    return fsw_alloc(size, ptr_out);
+}
+
 /* Include generated string encoding specific functions */
 #include "fsw_strfunc.h"
 
@@ -71,6 +82,166 @@ fsw_status_t fsw_memdup(void **dest_out, void *src, int len)
     return FSW_SUCCESS;
 }
 
+/** Size of the header that links the chunks of a slab or arena, keeps objects aligned. */
+#define FSW_CHUNK_HEADER_SIZE (8)
+
+/**
+ * Set up a slab for objects of the given size. No memory is allocated until the first
+ * call to fsw_slab_alloc.
+ */
+
+void fsw_slab_init(struct fsw_slab *slab, fsw_u32 object_size, fsw_u32 chunk_objects)
+{
+    if (object_size < sizeof(void *))
+        object_size = sizeof(void *);
+    slab->object_size = (object_size + 7) & ~7;
+    slab->chunk_objects = chunk_objects ? chunk_objects : 1;
+    slab->free_list = NULL;
+    slab->chunks = NULL;
+    slab->allocs = 0;
+    slab->chunk_allocs = 0;
+}
+
+/**
+ * Get an object from a slab. The memory is not cleared. When the free list is empty,
+ * a new chunk is allocated and split into objects.
+ */
+
+fsw_status_t fsw_slab_alloc(struct fsw_slab *slab, void **ptr_out)
+{
+    fsw_status_t    status;
+    fsw_u8          *chunk;
+    fsw_u32         i;
+
+    if (slab->object_size == 0)
+        return FSW_UNSUPPORTED;
+
+    if (slab->free_list == NULL) {
+        status = fsw_alloc(FSW_CHUNK_HEADER_SIZE + slab->chunk_objects * slab->object_size, &chunk);
+        if (status)
+            return status;
+        *(void **)chunk = slab->chunks;
+        slab->chunks = chunk;
+        slab->chunk_allocs++;
+
+        // thread the new objects onto the free list, first object first
+        for (i = slab->chunk_objects; i > 0; i--) {
+            void *obj = chunk + FSW_CHUNK_HEADER_SIZE + (i - 1) * slab->object_size;
+            *(void **)obj = slab->free_list;
+            slab->free_list = obj;
+        }
+    }
+
+    *ptr_out = slab->free_list;
+    slab->free_list = *(void **)slab->free_list;
+    slab->allocs++;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Give an object back to its slab for reuse.
+ */
+
+void fsw_slab_release(struct fsw_slab *slab, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+}
+
+/**
+ * Free all chunks of a slab. Objects still handed out become invalid.
+ */
+
+void fsw_slab_free(struct fsw_slab *slab)
+{
+    while (slab->chunks != NULL) {
+        void *next = *(void **)slab->chunks;
+        fsw_free(slab->chunks);
+        slab->chunks = next;
+    }
+    slab->free_list = NULL;
+}
+
+/**
+ * Set up an arena. No memory is allocated until the first call to fsw_arena_alloc.
+ */
+
+void fsw_arena_init(struct fsw_arena *arena, fsw_u32 chunk_size, fsw_u32 limit)
+{
+    arena->chunk = NULL;
+    arena->chunk_size = chunk_size;
+    arena->used = 0;
+    arena->limit = limit;
+    arena->total = 0;
+    arena->allocs = 0;
+    arena->chunk_allocs = 0;
+    arena->rollbacks = 0;
+}
+
+/**
+ * Get memory from an arena. Returns FSW_OUT_OF_MEMORY if the request does not fit into
+ * a chunk or the arena has reached its limit; callers then fall back to fsw_alloc.
+ */
+
+fsw_status_t fsw_arena_alloc(struct fsw_arena *arena, fsw_u32 size, void **ptr_out)
+{
+    fsw_status_t    status;
+    fsw_u8          *chunk;
+
+    size = (size + 7) & ~7;
+    if (size == 0 || size > arena->chunk_size - FSW_CHUNK_HEADER_SIZE)
+        return FSW_OUT_OF_MEMORY;
+
+    if (arena->chunk == NULL || arena->used + size > arena->chunk_size) {
+        if (arena->total + arena->chunk_size > arena->limit)
+            return FSW_OUT_OF_MEMORY;
+        status = fsw_alloc(arena->chunk_size, &chunk);
+        if (status)
+            return status;
+        *(fsw_u8 **)chunk = arena->chunk;
+        arena->chunk = chunk;
+        arena->used = FSW_CHUNK_HEADER_SIZE;
+        arena->total += arena->chunk_size;
+        arena->chunk_allocs++;
+    }
+
+    *ptr_out = arena->chunk + arena->used;
+    arena->used += size;
+    arena->allocs++;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Give memory back to an arena. Only the latest allocation is actually taken back,
+ * anything else stays in use until fsw_arena_free.
+ */
+
+void fsw_arena_release(struct fsw_arena *arena, void *ptr, fsw_u32 size)
+{
+    size = (size + 7) & ~7;
+    if (arena->chunk != NULL && size > 0 && (fsw_u8 *)ptr + size == arena->chunk + arena->used) {
+        arena->used -= size;
+        arena->rollbacks++;
+    }
+}
+
+/**
+ * Free all chunks of an arena. Memory still handed out becomes invalid.
+ */
+
+void fsw_arena_free(struct fsw_arena *arena)
+{
+    while (arena->chunk != NULL) {
+        fsw_u8 *prev = *(fsw_u8 **)arena->chunk;
+        fsw_free(arena->chunk);
+        arena->chunk = prev;
+    }
+    arena->used = 0;
+    arena->total = 0;
+}
+
 /**
  * Get the length of a string. Returns the number of characters in the string.
  */
@@ -165,6 +336,17 @@ int fsw_streq_cstr(struct fsw_string *s1, const char *s2)
  */
 
 fsw_status_t fsw_strdup_coerce(struct fsw_string *dest, int type, struct fsw_string *src)
+{
+    return fsw_strdup_coerce_arena(dest, type, src, NULL);
+}
+
+/**
+ * Like fsw_strdup_coerce, but takes the string data from the given arena if it is not
+ * NULL. Such a string must not be passed to fsw_strfree, use fsw_arena_release instead.
+ */
+
+fsw_status_t fsw_strdup_coerce_arena(struct fsw_string *dest, int type, struct fsw_string *src,
+                                     struct fsw_arena *arena)
 {
     fsw_status_t    status;
 
@@ -179,7 +361,7 @@ fsw_status_t fsw_strdup_coerce(struct fsw_string *dest, int type, struct fsw_str
         dest->type = type;
         dest->len  = src->len;
         dest->size = src->size;
-        status = fsw_alloc(dest->size, &dest->data);
+        status = fsw_strcoerce_alloc(arena, dest->size, &dest->data);
         if (status)
             return status;
 
@@ -190,7 +372,7 @@ fsw_status_t fsw_strdup_coerce(struct fsw_string *dest, int type, struct fsw_str
     // dispatch to type-specific functions
     #define STRCOERCE_DISPATCH(type1, type2) \
       if (src->type == FSW_STRING_TYPE_##type1 && type == FSW_STRING_TYPE_##type2) \
-        return fsw_strcoerce_##type1##_##type2(src->data, src->len, dest);
+        return fsw_strcoerce_##type1##_##type2(src->data, src->len, dest, arena);
     STRCOERCE_DISPATCH(UTF8, ISO88591);
     STRCOERCE_DISPATCH(UTF16, ISO88591);
     STRCOERCE_DISPATCH(UTF16_SWAPPED, ISO88591);
@@ -1267,6 +1267,64 @@ static fsw_status_t fsw_ntfs_get_extent(struct fsw_volume *volg, struct fsw_dnod
     return fsw_ntfs_get_extent_sparse(vol, dno, extent);
 }
 
+/*
+ * Map consecutive extents for the core's extent list by decoding the runlist of the
+ * attribute that holds log_start once. Only plain data attributes are handled here;
+ * the data past the initialized size is left to fsw_ntfs_get_extent_sparse.
+ */
+static fsw_status_t fsw_ntfs_get_extents(struct fsw_volume *volg, struct fsw_dnode *dnog, fsw_u64 log_start,
+	struct fsw_extent *extents, fsw_u32 *count_inout)
+{
+    struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
+    struct fsw_ntfs_dnode *dno = (struct fsw_ntfs_dnode *)dnog;
+    fsw_status_t err;
+
+    if(dno->unreadable || dno->embeded || dno->compressed)
+	return FSW_UNSUPPORTED;
+    if((log_start << vol->clbits) > dno->finited)
+	return FSW_UNSUPPORTED;
+    if(!attribute_has_vcn(dno->attr.ptr, dno->attr.len, log_start)) {
+	err = find_attribute(vol, &dno->mft, &dno->attr, log_start);
+	if( err != FSW_SUCCESS )
+	    return err;
+	if(!attribute_has_vcn(dno->attr.ptr, dno->attr.len, log_start))
+	    return FSW_VOLUME_CORRUPTED;
+    }
+    fsw_u8 *ptr = dno->attr.ptr;
+    int len = dno->attr.len;
+    fsw_u64 pos = 0;
+    fsw_u64 lcn, cnt, c;
+    fsw_u64 vcn = log_start;
+    fsw_u64 last = dno->finited >> vol->clbits;
+    fsw_u64 svcn = attribute_first_vcn(ptr, len);
+    fsw_u64 evcn = attribute_last_vcn(ptr, len) + 1;
+    fsw_u32 n = 0;
+    int off = GETU16(ptr, 0x20);
+    ptr += off;
+    len -= off;
+    while(n < *count_inout && len > 0 && get_extent(&ptr, &len, &lcn, &cnt, &pos)==FSW_SUCCESS) {
+	if(svcn + cnt > vcn) {
+	    if(vcn > last)
+		break;
+	    c = svcn + cnt - vcn;
+	    if(vcn + c > last + 1)
+		c = last + 1 - vcn;
+	    extents[n].type = lcn ? FSW_EXTENT_TYPE_PHYSBLOCK : FSW_EXTENT_TYPE_SPARSE;
+	    extents[n].log_start = vcn;
+	    extents[n].log_count = (fsw_u32)c;
+	    extents[n].phys_start = lcn + vcn - svcn;
+	    extents[n].buffer = NULL;
+	    n++;
+	    vcn += c;
+	}
+	svcn += cnt;
+	if(svcn >= evcn)
+	    break;
+    }
+    *count_inout = n;
+    return FSW_SUCCESS;
+}
+
 static fsw_status_t load_upcase(struct fsw_ntfs_volume *vol)
 {
     fsw_status_t err;
@@ -1576,6 +1634,8 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ntfs) = {
     fsw_ntfs_dir_lookup,
     fsw_ntfs_dir_read,
     fsw_ntfs_readlink,
+    0,
+    fsw_ntfs_get_extents,
 };
 
 // EOF
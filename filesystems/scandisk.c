@@ -81,8 +81,11 @@ static struct fsw_volume *clone_dummy_volume(struct fsw_volume *vol)
 
 static void free_dummy_volume(struct fsw_volume *vol)
 {
-    fsw_free(vol->host_data);
+    FSW_VOLUME_DATA *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+
+    // the unmount still needs host_data to drop the disk cache
     fsw_unmount(vol);
+    fsw_free(Volume);
 }
 
 static int scan_disks(int (*hook)(struct fsw_volume *, struct fsw_volume *), struct fsw_volume *master)
@@ -52,7 +52,8 @@ fsw_status_t fsw_posix_open_dno(struct fsw_posix_volume *pvol, const char *path,
 void fsw_posix_change_blocksize(struct fsw_volume *vol,
                               fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                               fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer);
 
 /**
  * Dispatch table for our FSW host driver.
@@ -62,7 +63,8 @@ struct fsw_host_table   fsw_posix_host_table = {
     FSW_STRING_TYPE_ISO88591,
 
     fsw_posix_change_blocksize,
-    fsw_posix_read_block
+    fsw_posix_read_block,
+    fsw_posix_read_blocks
 };
 
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
@@ -209,6 +211,7 @@ struct fsw_posix_dir * fsw_posix_opendir(struct fsw_posix_volume *pvol, const ch
     if (status)
         return NULL;
     dir->pvol = pvol;
+    dir->batch_count = dir->batch_next = 0;
 
     // open the directory
     status = fsw_posix_open_dno(pvol, path, FSW_DNODE_TYPE_DIR, &dir->shand);
@@ -222,7 +225,19 @@ struct fsw_posix_dir * fsw_posix_opendir(struct fsw_posix_volume *pvol, const ch
 }
 
 /**
- * Read the next entry from a directory.
+ * Release the entries a directory has read ahead.
+ */
+
+static void fsw_posix_dir_batch_drop(struct fsw_posix_dir *dir)
+{
+    while (dir->batch_next < dir->batch_count)
+        fsw_dnode_release(dir->batch[dir->batch_next++]);
+    dir->batch_count = dir->batch_next = 0;
+}
+
+/**
+ * Read the next entry from a directory. Entries are read and filled with
+ * fsw_dnode_dir_read_plus, a directory block at a time where the file system allows it.
  */
 
 struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
@@ -231,13 +246,19 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
     struct fsw_dnode    *dno;
     static struct dirent dent;
 
-    // get next entry from file system
-    status = fsw_dnode_dir_read(&dir->shand, &dno);
-    if (status) {
-        if (status != 4)
-            fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read returned %d\n", status);
-        return NULL;
+    // get next entries from file system
+    if (dir->batch_next >= dir->batch_count) {
+        dir->batch_next = 0;
+        dir->batch_count = FSW_POSIX_DIR_BATCH;
+        status = fsw_dnode_dir_read_plus(&dir->shand, dir->batch, &dir->batch_count);
+        if (status) {
+            dir->batch_count = 0;
+            if (status != 4)
+                fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read_plus returned %d\n", status);
+            return NULL;
+        }
     }
+    dno = dir->batch[dir->batch_next++];
     status = fsw_dnode_fill(dno);
     if (status) {
         fprintf(stderr, "fsw_posix_readdir: fsw_dnode_fill returned %d\n", status);
@@ -267,6 +288,7 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 #endif
     memcpy(dent.d_name, dno->name.data, dno->name.size);
     dent.d_name[dno->name.size] = 0;
+    fsw_dnode_release(dno);
 
     return &dent;
 }
@@ -277,6 +299,7 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 
 void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 {
+    fsw_posix_dir_batch_drop(dir);
     dir->shand.pos = 0;
 }
 
@@ -286,6 +309,7 @@ void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 
 int fsw_posix_closedir(struct fsw_posix_dir *dir)
 {
+    fsw_posix_dir_batch_drop(dir);
     fsw_shandle_close(&dir->shand);
     fsw_free(dir);
     return 0;
@@ -362,7 +386,7 @@ void fsw_posix_change_blocksize(struct fsw_volume *vol,
  * to read a block of data from the device. The buffer is allocated by the core code.
  */
 
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer)
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
 {
     struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
     off_t           block_offset, seek_result;
@@ -382,6 +406,42 @@ fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void
     return FSW_SUCCESS;
 }
 
+/**
+ * FSW interface function to read several consecutive blocks with a single pread.
+ */
+
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+    size_t          size = (size_t)count * vol->phys_blocksize;
+    ssize_t         read_result;
+
+    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_blocks: %d +%d  (%d)\n"), start_bno, count, vol->phys_blocksize));
+
+    read_result = pread(pvol->fd, buffer, size, (off_t)start_bno * vol->phys_blocksize);
+    if (read_result < 0 || (size_t)read_result != size)
+        return FSW_IO_ERROR;
+
+    return FSW_SUCCESS;
+}
+
+/**
+ * Callbacks for the fsw_dnode_stat call. The POSIX host does not report
+ * timestamps or attributes, so these do nothing.
+ */
+
+void fsw_store_time_posix(struct fsw_dnode_stat *sb, int which, fsw_u32 posix_time)
+{
+}
+
+void fsw_store_attr_posix(struct fsw_dnode_stat *sb, fsw_u16 posix_mode)
+{
+}
+
+void fsw_store_attr_efi(struct fsw_dnode_stat *sb, fsw_u16 attr)
+{
+}
+
 
 /**
  * Time mapping callback for the fsw_dnode_stat call. This function converts
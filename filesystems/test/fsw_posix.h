@@ -67,6 +67,9 @@ struct fsw_posix_file {
 
 };
 
+/** Number of directory entries read and filled at once. */
+#define FSW_POSIX_DIR_BATCH (32)
+
 /**
  * POSIX Host: Private structure for an open directory.
  */
@@ -76,6 +79,10 @@ struct fsw_posix_dir {
 
     struct fsw_shandle          shand;          //!< FSW handle for this file
 
+    struct fsw_dnode            *batch[FSW_POSIX_DIR_BATCH]; //!< Entries read ahead, with full info
+    fsw_u32                     batch_count;    //!< Number of entries in batch
+    fsw_u32                     batch_next;     //!< Next entry of batch to return
+
 };
 
 
@@ -45,10 +45,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 
 #define FSW_LITTLE_ENDIAN (1)
 // TODO: use info from the headers to define FSW_LITTLE_ENDIAN or FSW_BIG_ENDIAN
 
+// calling convention used in the host and fstype dispatch tables
+#ifndef EFIAPI
+#define EFIAPI
+#endif
+
 
 // types
 
@@ -73,6 +79,17 @@ typedef uint64_t            fsw_u64;
 #define fsw_memcpy(dest,src,size) memcpy(dest,src,size)
 #define fsw_memeq(p1,p2,size) (memcmp(p1,p2,size) == 0)
 
+// time stamps, in nanoseconds
+
+static inline fsw_u64 fsw_posix_ticks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (fsw_u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#define fsw_ticks() fsw_posix_ticks()
+
 // message printing
 
 #define FSW_MSGSTR(s) s
@@ -0,0 +1,968 @@
+/**
+ * \file fswbench.c
+ * Micro-benchmarks for the FSW core in the POSIX user space environment.
+ */
+
+/*-
+ * Distributed under the terms of the GNU General Public License (GPL)
+ * version 3 (GPLv3), or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "fsw_posix.h"
+#include "crc32c.c"
+
+#include <time.h>
+
+
+//
+// Synthetic volume: every block reads as a pattern derived from its number,
+// so the benchmarks measure the core and not the disk.
+//
+
+#define BENCH_BLOCKSIZE (4096)
+
+static fsw_u64 bench_blocks_read;
+static fsw_u64 bench_requests;
+
+static void bench_change_blocksize(struct fsw_volume *vol,
+                                   fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
+                                   fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize)
+{
+    // nothing to do
+}
+
+static fsw_status_t bench_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    bench_blocks_read++;
+    bench_requests++;
+    memset(buffer, (int)phys_bno, vol->phys_blocksize);
+    *(fsw_u64 *)buffer = phys_bno;
+    return FSW_SUCCESS;
+}
+
+static fsw_status_t bench_read_blocks(struct fsw_volume *vol, fsw_u64 start_bno, fsw_u32 count, void *buffer)
+{
+    fsw_u32         i;
+
+    bench_blocks_read += count;
+    bench_requests++;
+    memset(buffer, (int)start_bno, (size_t)count * vol->phys_blocksize);
+    for (i = 0; i < count; i++)
+        *(fsw_u64 *)((fsw_u8 *)buffer + (size_t)i * vol->phys_blocksize) = start_bno + i;
+    return FSW_SUCCESS;
+}
+
+static struct fsw_host_table bench_host_table = {
+    FSW_STRING_TYPE_ISO88591,
+
+    bench_change_blocksize,
+    bench_read_block,
+    bench_read_blocks
+};
+
+static fsw_status_t bench_volume_mount(struct fsw_volume *vol)
+{
+    fsw_set_blocksize(vol, BENCH_BLOCKSIZE, BENCH_BLOCKSIZE);
+    return fsw_dnode_create_root(vol, 1, &vol->root);
+}
+
+//
+// Synthetic directory: the root holds bench_dir_entries files named "f00000",
+// "f00001", ..., with dnode ids counting up from 2. Like ext2, lookups scan the
+// directory from the start.
+//
+
+static fsw_u32 bench_dir_entries;
+static fsw_u32 bench_dir_scanned;
+
+#define BENCH_NAME_BUF (12)     // "f" and up to 10 digits
+
+static void bench_dir_name(fsw_u32 index, char *name_buf, struct fsw_string *name)
+{
+    name->type = FSW_STRING_TYPE_ISO88591;
+    name->len = name->size = snprintf(name_buf, BENCH_NAME_BUF, "f%05u", index);
+    name->data = name_buf;
+}
+
+static fsw_status_t bench_dnode_fill(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    return FSW_SUCCESS;
+}
+
+/** A regular file stored in one contiguous extent, starting at this block. */
+#define BENCH_FILE_ID       (0xF11E)
+#define BENCH_FILE_START    (100000)
+
+/**
+ * A fragmented regular file: runs of BENCH_FRAG_RUN blocks, each followed by a gap on
+ * the disk. Mapping it costs a walk of a two-level extent tree (two block cache
+ * lookups), once per extent with get_extent and once per list with get_extents.
+ */
+#define BENCH_FRAG_ID       (0xF4A6)
+#define BENCH_FRAG_START    (200000)
+#define BENCH_FRAG_RUN      (16)
+
+static fsw_u32 bench_extent_walks;
+
+static fsw_status_t bench_extent_walk(struct fsw_volume *vol)
+{
+    fsw_status_t    status;
+    void            *block;
+    fsw_u64         bno;
+
+    bench_extent_walks++;
+    for (bno = 10; bno < 12; bno++) {
+        status = fsw_block_get(vol, bno, 2, &block);
+        if (status)
+            return status;
+        fsw_block_release(vol, bno, block);
+    }
+    return FSW_SUCCESS;
+}
+
+static void bench_frag_extent(fsw_u64 log_bno, struct fsw_extent *extent)
+{
+    fsw_u64         run = log_bno / BENCH_FRAG_RUN;
+
+    extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+    extent->log_start = log_bno;
+    extent->log_count = (fsw_u32)((run + 1) * BENCH_FRAG_RUN - log_bno);
+    extent->phys_start = BENCH_FRAG_START + run * 2 * BENCH_FRAG_RUN + (log_bno - run * BENCH_FRAG_RUN);
+    extent->buffer = NULL;
+}
+
+static fsw_status_t bench_get_extent(struct fsw_volume *vol, struct fsw_dnode *dno,
+                                     struct fsw_extent *extent)
+{
+    if (dno->dnode_id == BENCH_FRAG_ID) {
+        bench_frag_extent(extent->log_start, extent);
+        return bench_extent_walk(vol);
+    }
+    if (dno->dnode_id != BENCH_FILE_ID)
+        return FSW_UNSUPPORTED;
+    extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+    extent->log_start = 0;
+    extent->log_count = (fsw_u32)((dno->size + BENCH_BLOCKSIZE - 1) / BENCH_BLOCKSIZE);
+    extent->phys_start = BENCH_FILE_START;
+    return FSW_SUCCESS;
+}
+
+static fsw_status_t bench_get_extents(struct fsw_volume *vol, struct fsw_dnode *dno,
+                                      fsw_u64 log_start, struct fsw_extent *extents, fsw_u32 *count_inout)
+{
+    fsw_u64         file_blocks = (dno->size + BENCH_BLOCKSIZE - 1) / BENCH_BLOCKSIZE;
+    fsw_u32         n;
+
+    if (dno->dnode_id != BENCH_FRAG_ID)
+        return FSW_UNSUPPORTED;
+    for (n = 0; n < *count_inout && log_start < file_blocks; n++) {
+        bench_frag_extent(log_start, &extents[n]);
+        log_start += extents[n].log_count;
+    }
+    *count_inout = n;
+    return bench_extent_walk(vol);
+}
+
+static fsw_status_t bench_dir_lookup(struct fsw_volume *vol, struct fsw_dnode *dno,
+                                     struct fsw_string *lookup_name, struct fsw_dnode **child_dno)
+{
+    char            name_buf[BENCH_NAME_BUF];
+    struct fsw_string name;
+    fsw_u32         i;
+
+    for (i = 0; i < bench_dir_entries; i++) {
+        bench_dir_scanned++;
+        bench_dir_name(i, name_buf, &name);
+        if (fsw_streq(lookup_name, &name))
+            return fsw_dnode_create(dno, i + 2, FSW_DNODE_TYPE_FILE, &name, child_dno);
+    }
+    return FSW_NOT_FOUND;
+}
+
+static fsw_status_t bench_dir_read(struct fsw_volume *vol, struct fsw_dnode *dno,
+                                   struct fsw_shandle *shand, struct fsw_dnode **child_dno)
+{
+    char            name_buf[BENCH_NAME_BUF];
+    struct fsw_string name;
+
+    if (shand->pos >= bench_dir_entries)
+        return FSW_NOT_FOUND;
+    bench_dir_scanned++;
+    bench_dir_name((fsw_u32)shand->pos, name_buf, &name);
+    shand->pos++;
+    return fsw_dnode_create(dno, shand->pos + 1, FSW_DNODE_TYPE_FILE, &name, child_dno);
+}
+
+static void bench_volume_free(struct fsw_volume *vol)
+{
+}
+
+static void bench_dnode_free(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+}
+
+static struct fsw_fstype_table bench_fstype_table = {
+    { FSW_STRING_TYPE_ISO88591, 5, 5, "bench" },
+    sizeof(struct fsw_volume),
+    sizeof(struct fsw_dnode),
+
+    bench_volume_mount,
+    bench_volume_free,
+    NULL,
+    bench_dnode_fill,
+    bench_dnode_free,
+    NULL,
+    bench_get_extent,
+    bench_dir_lookup,
+    bench_dir_read,
+    NULL,
+    FSW_FSTYPE_DIR_INDEX,
+    bench_get_extents
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Cheap deterministic pseudo-random sequence, so runs are comparable. */
+static fsw_u32 bench_rand(fsw_u32 *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+
+//
+// Block cache: lookup and replacement cost as the cache grows
+//
+
+#define BCACHE_LOOKUPS (1000000)
+
+static int bench_bcache(void)
+{
+    struct fsw_volume *vol;
+    fsw_u32         nblocks, i, seed;
+    fsw_u64         bno;
+    void            **held, *buffer;
+    double          t0, hit_ns, miss_ns;
+
+    // the benchmark pins far more blocks than the default budget allows
+    fsw_set_cache_budget((fsw_u64)1 << 40, (fsw_u64)1 << 40);
+
+    printf("block cache: %-10s %-12s %-12s\n", "entries", "hit ns/op", "miss ns/op");
+    for (nblocks = 256; nblocks <= 65536; nblocks <<= 2) {
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+            return 1;
+        held = malloc(nblocks * sizeof(void *));
+
+        // hold a reference on every block, forcing the cache to grow to nblocks entries
+        for (i = 0; i < nblocks; i++)
+            fsw_block_get(vol, (fsw_u64)i * 7919, 2, &held[i]);
+
+        // random hits
+        seed = 1;
+        t0 = bench_now();
+        for (i = 0; i < BCACHE_LOOKUPS; i++) {
+            bno = (fsw_u64)(bench_rand(&seed) % nblocks) * 7919;
+            fsw_block_get(vol, bno, 2, &buffer);
+            fsw_block_release(vol, bno, buffer);
+        }
+        hit_ns = (bench_now() - t0) / BCACHE_LOOKUPS;
+
+        for (i = 0; i < nblocks; i++)
+            fsw_block_release(vol, (fsw_u64)i * 7919, held[i]);
+
+        // misses that each replace an entry of the now unreferenced cache
+        t0 = bench_now();
+        for (i = 0; i < BCACHE_LOOKUPS; i++) {
+            bno = (fsw_u64)nblocks * 7919 + i;
+            fsw_block_get(vol, bno, 0, &buffer);
+            fsw_block_release(vol, bno, buffer);
+        }
+        miss_ns = (bench_now() - t0) / BCACHE_LOOKUPS;
+
+        printf("block cache: %-10u %-12.1f %-12.1f\n", vol->bcache_size, hit_ns, miss_ns);
+        free(held);
+        fsw_unmount(vol);
+    }
+    return 0;
+}
+
+
+//
+// Block cache budget: two volumes sharing a small driver budget
+//
+
+static int bench_budget(void)
+{
+    struct fsw_volume *vols[2];
+    fsw_u32         i, v;
+    fsw_u64         bno;
+    void            *buffer;
+
+    // room for 64 blocks per volume and 96 blocks for the driver
+    fsw_set_cache_budget(64 * BENCH_BLOCKSIZE + 8192, 96 * BENCH_BLOCKSIZE + 16384);
+
+    printf("budget: %-8s %-12s %-10s %-10s %-10s\n", "volume", "cache bytes", "entries", "budget ev", "shrunk");
+    for (v = 0; v < 2; v++) {
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vols[v]))
+            return 1;
+        vols[v]->bcache_size = 1024;    // like btrfs, start with a large table
+    }
+
+    // stream file data through the first volume, then metadata through the second
+    for (v = 0; v < 2; v++) {
+        for (i = 0; i < 10000; i++) {
+            bno = i % (v == 0 ? 10000 : 200);
+            if (fsw_block_get(vols[v], bno, v == 0 ? 0 : 2, &buffer)) {
+                fprintf(stderr, "fsw_block_get failed\n");
+                return 1;
+            }
+            fsw_block_release(vols[v], bno, buffer);
+        }
+    }
+
+    for (v = 0; v < 2; v++) {
+        printf("budget: %-8u %-12llu %-10u %-10llu %-10llu\n", v,
+               (unsigned long long)vols[v]->bcache_bytes, vols[v]->bcache_used,
+               (unsigned long long)vols[v]->stats.bcache_budget_evictions,
+               (unsigned long long)vols[v]->stats.bcache_shrink_frees);
+        fsw_unmount(vols[v]);
+    }
+    return 0;
+}
+
+
+//
+// Dnode registry: a loader-style scan that keeps every entry of a large
+// directory open, then looks each one up again by name
+//
+
+#define DNODE_ENTRIES (10000)
+
+static int bench_dnode(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_shandle shand;
+    struct fsw_dnode **held, *dno;
+    struct fsw_string name;
+    char            name_buf[BENCH_NAME_BUF];
+    fsw_u32         i, n;
+    double          t0, read_ns, lookup_ns;
+
+    bench_dir_entries = DNODE_ENTRIES;
+    if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+        return 1;
+    held = malloc(DNODE_ENTRIES * sizeof(struct fsw_dnode *));
+
+    // enumerate the directory, creating a new dnode for every entry
+    if (fsw_shandle_open(vol->root, &shand))
+        return 1;
+    t0 = bench_now();
+    for (n = 0; n < DNODE_ENTRIES; n++)
+        if (fsw_dnode_dir_read(&shand, &held[n]))
+            break;
+    read_ns = (bench_now() - t0) / n;
+    fsw_shandle_close(&shand);
+
+    // look up every entry by name, finding the existing dnode each time
+    t0 = bench_now();
+    for (i = 0; i < n; i++) {
+        bench_dir_name(i, name_buf, &name);
+        if (fsw_dnode_lookup(vol->root, &name, &dno) || dno != held[i]) {
+            fprintf(stderr, "lookup of %s failed\n", name_buf);
+            return 1;
+        }
+        fsw_dnode_release(dno);
+    }
+    lookup_ns = (bench_now() - t0) / n;
+
+    printf("dnode: %u entries, dir_read %.1f ns/entry, lookup %.1f ns/entry\n", n, read_ns, lookup_ns);
+
+    for (i = 0; i < n; i++)
+        fsw_dnode_release(held[i]);
+    free(held);
+    fsw_unmount(vol);
+    return 0;
+}
+
+
+//
+// Directory index: repeated lookups in one large directory, answered by the
+// fstype's linear scan or by the core's name index
+//
+
+#define DINDEX_LOOKUPS (2000)
+
+static int bench_dindex(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_string name;
+    char            name_buf[BENCH_NAME_BUF];
+    fsw_u32         i, seed, use_index, found;
+    double          t0;
+
+    bench_dir_entries = DNODE_ENTRIES;
+    printf("dir index: %-6s %-14s %-14s %s\n", "index", "hit us/op", "miss us/op", "entries scanned");
+    for (use_index = 0; use_index < 2; use_index++) {
+        if (use_index)
+            bench_fstype_table.flags |= FSW_FSTYPE_DIR_INDEX;
+        else
+            bench_fstype_table.flags &= ~FSW_FSTYPE_DIR_INDEX;
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+            return 1;
+        bench_dir_scanned = 0;
+
+        // names that exist
+        seed = 1;
+        found = 0;
+        t0 = bench_now();
+        for (i = 0; i < DINDEX_LOOKUPS; i++) {
+            bench_dir_name(bench_rand(&seed) % DNODE_ENTRIES, name_buf, &name);
+            if (fsw_dnode_lookup(vol->root, &name, &dno) == FSW_SUCCESS) {
+                found++;
+                fsw_dnode_release(dno);
+            }
+        }
+        printf("dir index: %-6s %-14.2f ", use_index ? "yes" : "no",
+               (bench_now() - t0) / DINDEX_LOOKUPS / 1000);
+
+        // names that don't exist
+        t0 = bench_now();
+        for (i = 0; i < DINDEX_LOOKUPS; i++) {
+            bench_dir_name(DNODE_ENTRIES + i, name_buf, &name);
+            if (fsw_dnode_lookup(vol->root, &name, &dno) == FSW_SUCCESS)
+                return 1;
+        }
+        printf("%-14.2f %u\n", (bench_now() - t0) / DINDEX_LOOKUPS / 1000, bench_dir_scanned);
+
+        fsw_unmount(vol);
+        if (found != DINDEX_LOOKUPS)
+            return 1;
+    }
+    return 0;
+}
+
+
+//
+// Negative lookup cache: a loader scan probing the same few nonexistent
+// names over and over, in a directory without a name index
+//
+
+#define NEGCACHE_NAMES  (40)
+#define NEGCACHE_ROUNDS (50)
+
+static int bench_negcache(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_string name;
+    char            name_buf[BENCH_NAME_BUF];
+    fsw_u32         i, round;
+    double          t0;
+
+    bench_dir_entries = DNODE_ENTRIES;
+    bench_fstype_table.flags &= ~FSW_FSTYPE_DIR_INDEX;
+    if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+        return 1;
+    bench_dir_scanned = 0;
+
+    t0 = bench_now();
+    for (round = 0; round < NEGCACHE_ROUNDS; round++) {
+        for (i = 0; i < NEGCACHE_NAMES; i++) {
+            bench_dir_name(DNODE_ENTRIES + i, name_buf, &name);
+            if (fsw_dnode_lookup(vol->root, &name, &dno) == FSW_SUCCESS)
+                return 1;
+        }
+    }
+    printf("negative cache: %llu lookups, %.2f us/op, hit rate %.1f%%, %u entries scanned\n",
+           (unsigned long long)vol->stats.negcache_lookups,
+           (bench_now() - t0) / (NEGCACHE_NAMES * NEGCACHE_ROUNDS) / 1000,
+           100.0 * vol->stats.negcache_hits / vol->stats.negcache_lookups, bench_dir_scanned);
+
+    fsw_unmount(vol);
+    bench_fstype_table.flags |= FSW_FSTYPE_DIR_INDEX;
+    return 0;
+}
+
+
+//
+// Bulk file read: an initrd-sized file read in 1 MiB chunks, the way the
+// EFI host passes on a loader's Read() calls
+//
+
+#define BULK_FILE_SIZE  (64 * 1024 * 1024)
+#define BULK_CHUNK      (1024 * 1024)
+
+static int bench_bulk(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_shandle shand;
+    struct fsw_string name;
+    fsw_u8          *buffer;
+    void            *block;
+    fsw_u32         size, total, vectored, i;
+    fsw_u64         bno;
+    double          t0, ms;
+
+    buffer = malloc(BULK_CHUNK);
+    for (vectored = 0; vectored < 2; vectored++) {
+        bench_host_table.read_blocks = vectored ? bench_read_blocks : NULL;
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+            return 1;
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = 6;
+        name.data = "initrd";
+        if (fsw_dnode_create(vol->root, BENCH_FILE_ID, FSW_DNODE_TYPE_FILE, &name, &dno))
+            return 1;
+        dno->size = BULK_FILE_SIZE;
+
+        // file data in large chunks
+        if (fsw_shandle_open(dno, &shand))
+            return 1;
+        bench_blocks_read = bench_requests = 0;
+        total = 0;
+        t0 = bench_now();
+        do {
+            size = BULK_CHUNK;
+            if (fsw_shandle_read(&shand, &size, buffer))
+                return 1;
+            total += size;
+        } while (size > 0);
+        ms = (bench_now() - t0) / 1e6;
+        fsw_shandle_close(&shand);
+
+        printf("bulk read: %-10s %u MiB in %.1f ms (%.0f MiB/s), %llu blocks in %llu requests, %u cache entries\n",
+               vectored ? "vectored" : "per-block", total >> 20, ms, (total >> 20) / (ms / 1000),
+               (unsigned long long)bench_blocks_read, (unsigned long long)bench_requests, vol->bcache_used);
+
+        // metadata scan through the block cache, e.g. a large directory
+        bench_blocks_read = bench_requests = 0;
+        t0 = bench_now();
+        for (i = 0; i < 4096; i++) {
+            bno = 5000 + i;
+            if (fsw_block_get(vol, bno, 1, &block) || *(fsw_u64 *)block != bno)
+                return 1;
+            fsw_block_release(vol, bno, block);
+        }
+        ms = (bench_now() - t0) / 1e6;
+        printf("seq blocks: %-9s %u blocks in %.2f ms, %llu requests, %llu read ahead\n",
+               vectored ? "vectored" : "per-block", i, ms, (unsigned long long)bench_requests,
+               (unsigned long long)vol->stats.bcache_readahead_blocks);
+
+        fsw_dnode_release(dno);
+        fsw_unmount(vol);
+    }
+    bench_host_table.read_blocks = bench_read_blocks;
+    free(buffer);
+    return 0;
+}
+
+
+#define RA_CHUNK        (4096)
+#define RA_RUN          (256 * 1024)
+
+static int bench_readahead(void)
+{
+    static const char *pattern_names[] = { "sequential", "runs", "random", "first read" };
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_shandle shand;
+    struct fsw_string name;
+    fsw_u8          buffer[RA_CHUNK];
+    fsw_u32         size, pattern, n, seed;
+    fsw_u64         total;
+    double          t0, ms;
+
+    for (pattern = 0; pattern < 4; pattern++) {
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+            return 1;
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = 6;
+        name.data = "initrd";
+        if (fsw_dnode_create(vol->root, BENCH_FILE_ID, FSW_DNODE_TYPE_FILE, &name, &dno))
+            return 1;
+        dno->size = BULK_FILE_SIZE;
+        if (fsw_shandle_open(dno, &shand))
+            return 1;
+
+        // 4 KiB reads: the whole file in order, 256 KiB runs at random offsets,
+        // single blocks at random offsets, or the first block through a fresh handle
+        // each time (a loader scan checking headers)
+        bench_blocks_read = bench_requests = 0;
+        seed = 1;
+        total = 0;
+        t0 = bench_now();
+        for (n = 0; total < BULK_FILE_SIZE / 4; n++) {
+            if (pattern == 1 && (n % (RA_RUN / RA_CHUNK)) == 0)
+                shand.pos = (fsw_u64)(bench_rand(&seed) % (BULK_FILE_SIZE / RA_RUN)) * RA_RUN;
+            else if (pattern == 2)
+                shand.pos = (fsw_u64)(bench_rand(&seed) % (BULK_FILE_SIZE / RA_CHUNK)) * RA_CHUNK;
+            else if (pattern == 3) {
+                fsw_shandle_close(&shand);
+                if (fsw_shandle_open(dno, &shand))
+                    return 1;
+            }
+            size = RA_CHUNK;
+            if (fsw_shandle_read(&shand, &size, buffer) || size != RA_CHUNK ||
+                *(fsw_u64 *)buffer != BENCH_FILE_START + (shand.pos - RA_CHUNK) / BENCH_BLOCKSIZE)
+                return 1;
+            total += size;
+        }
+        ms = (bench_now() - t0) / 1e6;
+        fsw_shandle_close(&shand);
+
+        printf("readahead: %-10s %llu MiB in %.1f ms, %llu requests, %llu windows, %llu KiB useful, %llu KiB wasted\n",
+               pattern_names[pattern], (unsigned long long)(total >> 20), ms,
+               (unsigned long long)bench_requests, (unsigned long long)vol->stats.readahead_reads,
+               (unsigned long long)(vol->stats.readahead_useful_bytes >> 10),
+               (unsigned long long)(vol->stats.readahead_wasted_bytes >> 10));
+
+        fsw_dnode_release(dno);
+        fsw_unmount(vol);
+    }
+    return 0;
+}
+
+
+#define EXTENTS_FILE_SIZE   (64 * 1024 * 1024)
+#define EXTENTS_CHUNK       (256 * 1024)
+
+static int bench_extents(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_shandle shand;
+    struct fsw_string name;
+    fsw_u8          *buffer;
+    fsw_u32         size, total, batched;
+    double          t0, ms;
+
+    buffer = malloc(EXTENTS_CHUNK);
+    for (batched = 0; batched < 2; batched++) {
+        bench_fstype_table.get_extents = batched ? bench_get_extents : NULL;
+        if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+            return 1;
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = 6;
+        name.data = "kernel";
+        if (fsw_dnode_create(vol->root, BENCH_FRAG_ID, FSW_DNODE_TYPE_FILE, &name, &dno))
+            return 1;
+        dno->size = EXTENTS_FILE_SIZE;
+
+        if (fsw_shandle_open(dno, &shand))
+            return 1;
+        bench_extent_walks = 0;
+        bench_requests = 0;
+        total = 0;
+        t0 = bench_now();
+        do {
+            size = EXTENTS_CHUNK;
+            if (fsw_shandle_read(&shand, &size, buffer))
+                return 1;
+            if (size > 0 && *(fsw_u64 *)buffer !=
+                BENCH_FRAG_START + (total / BENCH_BLOCKSIZE / BENCH_FRAG_RUN) * 2 * BENCH_FRAG_RUN)
+                return 1;
+            total += size;
+        } while (size > 0);
+        ms = (bench_now() - t0) / 1e6;
+        fsw_shandle_close(&shand);
+
+        printf("extents: %-11s %u MiB in %.1f ms, %u extents, %u tree walks, %llu requests\n",
+               batched ? "get_extents" : "get_extent", total >> 20, ms,
+               EXTENTS_FILE_SIZE / BENCH_BLOCKSIZE / BENCH_FRAG_RUN, bench_extent_walks,
+               (unsigned long long)bench_requests);
+
+        fsw_dnode_release(dno);
+        fsw_unmount(vol);
+    }
+    bench_fstype_table.get_extents = bench_get_extents;
+    free(buffer);
+    return 0;
+}
+
+
+//
+// Allocation: a path walk that looks up names and drops the dnodes right away,
+// then a scan that keeps every entry of the directory open
+//
+
+#define ALLOC_WALKS (100000)
+
+static int bench_alloc(void)
+{
+    struct fsw_volume *vol;
+    struct fsw_shandle shand;
+    struct fsw_dnode **held, *dno;
+    struct fsw_string name;
+    char            name_buf[BENCH_NAME_BUF];
+    fsw_u32         i, n;
+    double          t0, walk_ns, scan_ns;
+
+    bench_dir_entries = DNODE_ENTRIES;
+    if (fsw_mount(NULL, &bench_host_table, &bench_fstype_table, &vol))
+        return 1;
+    held = malloc(DNODE_ENTRIES * sizeof(struct fsw_dnode *));
+
+    t0 = bench_now();
+    for (i = 0; i < ALLOC_WALKS; i++) {
+        bench_dir_name(i % 64, name_buf, &name);
+        if (fsw_dnode_lookup(vol->root, &name, &dno))
+            return 1;
+        fsw_dnode_release(dno);
+    }
+    walk_ns = (bench_now() - t0) / ALLOC_WALKS;
+    printf("alloc: walk %.1f ns/dnode, %u dnodes from %u slab chunks, %u names with %u arena rollbacks\n",
+           walk_ns, vol->dnode_slab.allocs, vol->dnode_slab.chunk_allocs,
+           vol->name_arena.allocs, vol->name_arena.rollbacks);
+
+    if (fsw_shandle_open(vol->root, &shand))
+        return 1;
+    t0 = bench_now();
+    for (n = 0; n < DNODE_ENTRIES; n++)
+        if (fsw_dnode_dir_read(&shand, &held[n]))
+            break;
+    fsw_shandle_close(&shand);
+    for (i = 0; i < n; i++)
+        fsw_dnode_release(held[i]);
+    scan_ns = (bench_now() - t0) / n;
+    printf("alloc: scan %.1f ns/dnode, %u slab chunks, %u arena chunks (%u KiB)\n",
+           scan_ns, vol->dnode_slab.chunk_allocs, vol->name_arena.chunk_allocs,
+           vol->name_arena.total >> 10);
+
+    free(held);
+    fsw_unmount(vol);
+    return 0;
+}
+
+
+//
+// Host cache: file data read through a host that keeps its own window cache,
+// copied into the block cache or lent straight out of the host's windows
+//
+
+#define PIN_WINDOW      (128 * 1024)
+#define PIN_WINDOWS     (16)
+#define PIN_CHUNK       (1000)
+
+static fsw_u8 *bench_windows[PIN_WINDOWS];
+static fsw_u64 bench_window_start[PIN_WINDOWS];
+static fsw_u32 bench_pins;
+
+static fsw_u8 *bench_window(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u64         start = phys_bno * vol->phys_blocksize / PIN_WINDOW * PIN_WINDOW;
+    fsw_u32         w = (fsw_u32)(start / PIN_WINDOW) % PIN_WINDOWS;
+
+    if (bench_window_start[w] != start) {
+        bench_read_blocks(vol, start / vol->phys_blocksize, PIN_WINDOW / vol->phys_blocksize,
+                          bench_windows[w]);
+        bench_window_start[w] = start;
+    }
+    return bench_windows[w] + (phys_bno * vol->phys_blocksize - start);
+}
+
+static fsw_status_t bench_window_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    memcpy(buffer, bench_window(vol, phys_bno), vol->phys_blocksize);
+    return FSW_SUCCESS;
+}
+
+static fsw_status_t bench_window_get_block(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out)
+{
+    bench_pins++;
+    *buffer_out = bench_window(vol, phys_bno);
+    return FSW_SUCCESS;
+}
+
+static void bench_window_put_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
+{
+    bench_pins--;
+}
+
+static int bench_pin(void)
+{
+    struct fsw_host_table host_table = bench_host_table;
+    struct fsw_volume *vol;
+    struct fsw_dnode *dno;
+    struct fsw_shandle shand;
+    struct fsw_string name;
+    fsw_u8          buffer[PIN_CHUNK];
+    fsw_u32         size, lend, w;
+    fsw_u64         total;
+    double          t0, ms;
+
+    for (w = 0; w < PIN_WINDOWS; w++)
+        bench_windows[w] = malloc(PIN_WINDOW);
+
+    // no read_blocks, so every block passes through fsw_block_get
+    host_table.read_block = bench_window_read_block;
+    host_table.read_blocks = NULL;
+    for (lend = 0; lend < 2; lend++) {
+        host_table.get_block = lend ? bench_window_get_block : NULL;
+        host_table.put_block = lend ? bench_window_put_block : NULL;
+        for (w = 0; w < PIN_WINDOWS; w++)
+            bench_window_start[w] = (fsw_u64)-1;
+        if (fsw_mount(NULL, &host_table, &bench_fstype_table, &vol))
+            return 1;
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = 6;
+        name.data = "initrd";
+        if (fsw_dnode_create(vol->root, BENCH_FILE_ID, FSW_DNODE_TYPE_FILE, &name, &dno))
+            return 1;
+        dno->size = BULK_FILE_SIZE;
+        if (fsw_shandle_open(dno, &shand))
+            return 1;
+
+        bench_requests = 0;
+        total = 0;
+        t0 = bench_now();
+        do {
+            size = PIN_CHUNK;
+            if (fsw_shandle_read(&shand, &size, buffer))
+                return 1;
+            if (size > 0 && (total % BENCH_BLOCKSIZE) == 0 &&
+                *(fsw_u64 *)buffer != BENCH_FILE_START + total / BENCH_BLOCKSIZE)
+                return 1;
+            total += size;
+        } while (size > 0);
+        ms = (bench_now() - t0) / 1e6;
+        fsw_shandle_close(&shand);
+        if (bench_pins != 0)
+            return 1;
+
+        printf("pin: %-5s %llu MiB in %.1f ms (%.0f MiB/s), %llu device requests, %llu blocks lent, %llu KiB block cache\n",
+               lend ? "lend" : "copy", (unsigned long long)(total >> 20), ms, (total >> 20) / (ms / 1e3),
+               (unsigned long long)bench_requests, (unsigned long long)vol->stats.bcache_lent,
+               (unsigned long long)(vol->bcache_bytes >> 10));
+
+        fsw_dnode_release(dno);
+        fsw_unmount(vol);
+    }
+    for (w = 0; w < PIN_WINDOWS; w++)
+        free(bench_windows[w]);
+    return 0;
+}
+
+
+//
+// CRC32C: the engines behind ext4 metadata_csum and btrfs checksums, over
+// buffers the size of a metadata block and of a large tree node
+//
+
+#define CRC32C_BYTES    (256 * 1024 * 1024)
+
+static int bench_crc32c(void)
+{
+    static const struct {
+        const char          *name;
+        fsw_crc32c_engine_t engine;
+    } engines[] = {
+        { "bytewise", fsw_crc32c_bytewise },
+        { "slice-by-8", fsw_crc32c_sliced },
+#ifdef FSW_CRC32C_HW
+        { FSW_CRC32C_HW_NAME, fsw_crc32c_hw },
+#endif
+    };
+    static const fsw_u32 sizes[] = { 4096, 65536 };
+    fsw_u8          *buf;
+    fsw_u32         i, e, z, n, crc, rand_state = 1, expected = 0;
+    double          t0, mbps;
+
+    init_crc32c_table();
+    if (grub_getcrc32c(0, "123456789", 9) != 0xe3069283) {
+        printf("crc32c: check value mismatch\n");
+        return 1;
+    }
+
+    buf = malloc(65536);
+    for (i = 0; i < 65536; i++)
+        buf[i] = (fsw_u8)bench_rand(&rand_state);
+    for (e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+#ifdef FSW_CRC32C_HW
+        if (engines[e].engine == fsw_crc32c_hw && !fsw_crc32c_hw_present()) {
+            printf("crc32c: %s not supported by this CPU\n", engines[e].name);
+            continue;
+        }
+#endif
+        // odd offset, so that the hardware engines also run their unaligned head
+        crc = engines[e].engine(~0, buf + 1, 65535);
+        if (e == 0)
+            expected = crc;
+        else if (crc != expected) {
+            printf("crc32c: %s disagrees with bytewise\n", engines[e].name);
+            return 1;
+        }
+        for (z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+            n = CRC32C_BYTES / sizes[z];
+            if (e == 0)
+                n /= 8;
+            crc = 0;
+            t0 = bench_now();
+            for (i = 0; i < n; i++)
+                crc = engines[e].engine(crc, buf, sizes[z]);
+            mbps = (double)n * sizes[z] / ((bench_now() - t0) / 1e9) / (1024 * 1024);
+            printf("crc32c: %-10s %6u byte buffers: %8.1f MiB/s%s (%08x)\n", engines[e].name, sizes[z], mbps,
+                   engines[e].engine == fsw_crc32c_engine ? ", in use" : "", crc);
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+
+//
+// Driver
+//
+
+static struct {
+    const char  *name;
+    int         (*run)(void);
+} benchmarks[] = {
+    { "bcache", bench_bcache },
+    { "budget", bench_budget },
+    { "dnode", bench_dnode },
+    { "dindex", bench_dindex },
+    { "negcache", bench_negcache },
+    { "bulk", bench_bulk },
+    { "readahead", bench_readahead },
+    { "extents", bench_extents },
+    { "alloc", bench_alloc },
+    { "pin", bench_pin },
+    { "crc32c", bench_crc32c },
+    { NULL, NULL }
+};
+
+int main(int argc, char **argv)
+{
+    int i, found = 0;
+
+    for (i = 0; benchmarks[i].name; i++) {
+        if (argc > 1 && strcmp(argv[1], benchmarks[i].name) != 0)
+            continue;
+        found = 1;
+        // each benchmark starts from the default budget, whatever the previous one set
+        fsw_set_cache_budget(FSW_BCACHE_BUDGET_DEFAULT, FSW_BCACHE_BUDGET_DEFAULT);
+        if (benchmarks[i].run())
+            return 1;
+    }
+    if (!found) {
+        fprintf(stderr, "Usage: fswbench [benchmark]\n");
+        return 1;
+    }
+    return 0;
+}
+
+// EOF
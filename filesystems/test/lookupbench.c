@@ -0,0 +1,111 @@
+/**
+ * \file lookupbench.c
+ * Name lookup benchmark for a file system driver in the POSIX user space
+ * environment, on a directory with many entries (see mkbigdir.sh).
+ */
+
+/*-
+ * Distributed under the terms of the GNU General Public License (GPL)
+ * version 3 (GPLv3), or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "fsw_posix.h"
+
+#include <time.h>
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+//
+// Each round mounts the volume afresh and looks up a few names, the way a
+// boot loader scan does; the first lookup in a directory pays for whatever
+// index has to be built or read.
+//
+
+#define LOOKUP_ROUNDS   (20)
+#define LOOKUP_NAMES    (50)
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/** Cheap deterministic pseudo-random sequence, so runs are comparable. */
+static fsw_u32 bench_rand(fsw_u32 *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *vol;
+    struct fsw_posix_file *file;
+    char            path[4096];
+    fsw_u32         entries, seed, round, i, hits = 0;
+    fsw_u64         reads = 0, lookups = 0;
+    double          t0, hit_ns = 0, miss_ns = 0;
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: lookupbench <file/device> <directory> <entries>\n");
+        return 1;
+    }
+    entries = (fsw_u32)strtoul(argv[3], NULL, 10);
+    if (entries == 0)
+        return 1;
+
+    seed = 1;
+    for (round = 0; round < LOOKUP_ROUNDS; round++) {
+        vol = fsw_posix_mount(argv[1], &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+        if (vol == NULL) {
+            fprintf(stderr, "Mounting failed.\n");
+            return 1;
+        }
+
+        // names that exist (files are named entryNNNNN by mkbigdir.sh)
+        t0 = bench_now();
+        for (i = 0; i < LOOKUP_NAMES; i++) {
+            snprintf(path, sizeof(path), "%s/entry%05u", argv[2], bench_rand(&seed) % entries);
+            file = fsw_posix_open(vol, path, 0, 0);
+            if (file != NULL) {
+                hits++;
+                fsw_posix_close(file);
+            }
+        }
+        hit_ns += bench_now() - t0;
+
+        // names that don't
+        t0 = bench_now();
+        for (i = 0; i < LOOKUP_NAMES; i++) {
+            snprintf(path, sizeof(path), "%s/missing%05u", argv[2], bench_rand(&seed) % entries);
+            file = fsw_posix_open(vol, path, 0, 0);
+            if (file != NULL)
+                fsw_posix_close(file);
+        }
+        miss_ns += bench_now() - t0;
+
+        reads += vol->vol->stats.device_reads;
+        lookups += vol->vol->stats.dir_lookup_calls;
+        fsw_posix_unmount(vol);
+    }
+
+    printf("lookup: %u entries, %.2f us/hit, %.2f us/miss, %.1f device reads/lookup, %llu dir_lookup calls\n",
+           entries, hit_ns / (LOOKUP_ROUNDS * LOOKUP_NAMES) / 1000, miss_ns / (LOOKUP_ROUNDS * LOOKUP_NAMES) / 1000,
+           (double)reads / (2 * LOOKUP_ROUNDS * LOOKUP_NAMES), (unsigned long long)lookups);
+    if (hits != LOOKUP_ROUNDS * LOOKUP_NAMES) {
+        fprintf(stderr, "%u of %u names not found.\n", LOOKUP_ROUNDS * LOOKUP_NAMES - hits,
+                LOOKUP_ROUNDS * LOOKUP_NAMES);
+        return 1;
+    }
+    return 0;
+}
+
+// EOF
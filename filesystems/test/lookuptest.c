@@ -0,0 +1,112 @@
+/**
+ * \file lookuptest.c
+ * Checks that name lookups with UTF-16 names give the same answer in a
+ * directory with a hash index as in a plain one, in the POSIX user space
+ * environment. Build with "make DRIVERNAME=ext4 lookuptest".
+ */
+
+/*-
+ * Distributed under the terms of the GNU General Public License (GPL)
+ * version 3 (GPLv3), or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "fsw_posix.h"
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+//
+// The firmware hands the drivers UTF-16 names. <name> must exist in
+// <directory>; it is looked up as UTF-16, then once more with its first
+// character moved above U+00FF, which must not match anything: a character
+// cut to its low byte would find <name> again.
+//
+
+#define TEST_NAME_MAX   (256)
+
+/** Look up name in dir as a UTF-16 string; on success, *child_out is the dnode found. */
+static fsw_status_t test_lookup(struct fsw_dnode *dir, const char *name, fsw_u16 first_char_high,
+                                struct fsw_dnode **child_out)
+{
+    struct fsw_string   lookup_name;
+    fsw_u16             chars[TEST_NAME_MAX];
+    int                 i;
+
+    for (i = 0; name[i] && i < TEST_NAME_MAX; i++)
+        chars[i] = (fsw_u8)name[i];
+    chars[0] |= first_char_high;
+
+    lookup_name.type = FSW_STRING_TYPE_UTF16;
+    lookup_name.len = i;
+    lookup_name.size = i * sizeof(fsw_u16);
+    lookup_name.data = chars;
+    return fsw_dnode_lookup(dir, &lookup_name, child_out);
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_string   dir_path;
+    struct fsw_dnode    *dir, *child;
+    fsw_status_t        status;
+    int                 failed = 0;
+
+    if (argc != 4 || argv[3][0] == 0 || strlen(argv[3]) > TEST_NAME_MAX) {
+        fprintf(stderr, "Usage: lookuptest <file/device> <directory> <name>\n");
+        return 1;
+    }
+
+    pvol = fsw_posix_mount(argv[1], &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+
+    dir_path.type = FSW_STRING_TYPE_ISO88591;
+    dir_path.len = dir_path.size = strlen(argv[2]);
+    dir_path.data = argv[2];
+    status = fsw_dnode_lookup_path(pvol->vol->root, &dir_path, '/', &dir);
+    if (status) {
+        fprintf(stderr, "lookuptest: %s: not found (%d)\n", argv[2], status);
+        fsw_posix_unmount(pvol);
+        return 1;
+    }
+
+    // the name as stored: found, and the dnode carries the name from the disk
+    status = test_lookup(dir, argv[3], 0, &child);
+    if (status) {
+        printf("FAIL: %s not found (%d)\n", argv[3], status);
+        failed = 1;
+    } else {
+        if (child->name.type != FSW_STRING_TYPE_ISO88591 || !fsw_streq_cstr(&child->name, argv[3])) {
+            printf("FAIL: %s found under another name\n", argv[3]);
+            failed = 1;
+        }
+        fsw_dnode_release(child);
+    }
+
+    // the same name with its first character above U+00FF
+    status = test_lookup(dir, argv[3], 0x100, &child);
+    if (status == FSW_SUCCESS) {
+        printf("FAIL: U+%04X%s matched %s\n", (fsw_u8)argv[3][0] | 0x100, argv[3] + 1,
+               (const char *)child->name.data);
+        fsw_dnode_release(child);
+        failed = 1;
+    } else if (status != FSW_NOT_FOUND) {
+        printf("FAIL: U+%04X%s: error %d\n", (fsw_u8)argv[3][0] | 0x100, argv[3] + 1, status);
+        failed = 1;
+    }
+
+    if (!failed)
+        printf("OK: %s%s\n", argv[2], dir->dir_lookup_indexed ? " (indexed)" : "");
+    fsw_dnode_release(dir);
+    fsw_posix_unmount(pvol);
+    return failed;
+}
+
+// EOF
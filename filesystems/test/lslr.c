@@ -105,6 +105,41 @@ static int catfile(struct fsw_posix_volume *vol, char *path)
     return 0;
 }
 
+static void printstats(struct fsw_posix_volume *vol)
+{
+    struct fsw_volume_stats stats, *st = &stats;
+
+    fsw_volume_get_stats(vol->vol, st);
+    // ticks are nanoseconds in the POSIX environment
+    fprintf(stderr, "Block cache: %llu hits, %llu misses (%llu lent), %llu evictions (%llu over budget), "
+            "%llu shrunk, %llu read ahead\n",
+            (unsigned long long)st->bcache_hits, (unsigned long long)st->bcache_misses,
+            (unsigned long long)st->bcache_lent, (unsigned long long)st->bcache_evictions,
+            (unsigned long long)st->bcache_budget_evictions, (unsigned long long)st->bcache_shrink_frees,
+            (unsigned long long)st->bcache_readahead_blocks);
+    fprintf(stderr, "Device: %llu reads, %llu bytes, %.3f ms\n",
+            (unsigned long long)st->device_reads, (unsigned long long)st->device_read_bytes,
+            st->device_read_ticks / 1e6);
+    fprintf(stderr, "Bulk reads: %llu, %llu bytes\n",
+            (unsigned long long)st->bulk_reads, (unsigned long long)st->bulk_read_bytes);
+    fprintf(stderr, "Readahead: %llu reads, %llu bytes used, %llu bytes wasted\n",
+            (unsigned long long)st->readahead_reads, (unsigned long long)st->readahead_useful_bytes,
+            (unsigned long long)st->readahead_wasted_bytes);
+    fprintf(stderr, "get_extent: %llu calls, %.3f ms, %llu single, %llu batches\n",
+            (unsigned long long)st->get_extent_calls, st->get_extent_ticks / 1e6,
+            (unsigned long long)st->extent_lookups, (unsigned long long)st->extent_batches);
+    fprintf(stderr, "dir_lookup: %llu calls, %.3f ms\n",
+            (unsigned long long)st->dir_lookup_calls, st->dir_lookup_ticks / 1e6);
+    fprintf(stderr, "dir_read: %llu calls, %.3f ms\n",
+            (unsigned long long)st->dir_read_calls, st->dir_read_ticks / 1e6);
+    fprintf(stderr, "Negative lookup cache: %llu lookups, %llu hits\n",
+            (unsigned long long)st->negcache_lookups, (unsigned long long)st->negcache_hits);
+    fprintf(stderr, "Dnodes: %llu allocs, %llu chunks; names: %llu allocs, %llu chunks, %llu rollbacks\n",
+            (unsigned long long)st->dnode_allocs, (unsigned long long)st->dnode_chunks,
+            (unsigned long long)st->name_allocs, (unsigned long long)st->name_chunks,
+            (unsigned long long)st->name_rollbacks);
+}
+
 int main(int argc, char **argv)
 {
     struct fsw_posix_volume *vol;
@@ -129,6 +164,7 @@ int main(int argc, char **argv)
 
     listdir(vol, "/boot/", 0);
     catfile(vol, "/boot/testfile.txt");
+    printstats(vol);
 
     fsw_posix_unmount(vol);
 
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Build an ext4 image with one directory of many entries for lookupbench:
+#   mkbigdir.sh <image> [entries] [mke2fs options]
+# The files are named /big/entryNNNNN. e2fsck -D gives the directory its
+# hash index (HTree); pass "-O ^dir_index" to get a plain linear directory.
+
+IMAGE=$1
+ENTRIES=${2:-50000}
+[ -n "$IMAGE" ] || { echo "Usage: mkbigdir.sh <image> [entries] [mke2fs options]"; exit 1; }
+shift; [ $# -gt 0 ] && shift
+
+TREE=$(mktemp -d) || exit 1
+mkdir "$TREE/big"
+i=0
+while [ $i -lt $ENTRIES ]; do
+    : > "$TREE/big/$(printf 'entry%05u' $i)"
+    i=$((i + 1))
+done
+
+rm -f "$IMAGE"
+STATUS=2
+if mke2fs -q -t ext4 -N $((ENTRIES + 1024)) "$@" -d "$TREE" "$IMAGE" 64M; then
+    e2fsck -fyD "$IMAGE" > /dev/null
+    STATUS=$?
+fi
+rm -rf "$TREE"
+# e2fsck exits with 1 when it has changed (here: indexed) the file system
+[ $STATUS -le 1 ]
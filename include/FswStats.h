@@ -0,0 +1,84 @@
+/*
+ * include/FswStats.h
+ * Protocol published by rEFInd's file system drivers next to the
+ * SimpleFileSystem protocol of every mounted volume, to report how much
+ * work the driver did for that volume.
+ *
+ * Copyright (c) 2016 Roderick W. Smith
+ * All rights reserved.
+ *
+ * This program is distributed under the terms of the GNU General Public
+ * License (GPL) version 3 (GPLv3), a copy of which must be distributed
+ * with this source code or binaries made from it.
+ *
+ */
+
+#ifndef __FSW_STATS_H_
+#define __FSW_STATS_H_
+
+//
+// {CD5F399B-132C-4E7F-BE65-F6F17BB5B06B}
+#define FSW_STATS_PROTOCOL_GUID \
+  { \
+    0xcd5f399b, 0x132c, 0x4e7f, { 0xbe, 0x65, 0xf6, 0xf1, 0x7b, 0xb5, 0xb0, 0x6b } \
+  }
+
+#define FSW_STATS_PROTOCOL_REVISION  0x00000002
+
+typedef struct _FSW_STATS_PROTOCOL FSW_STATS_PROTOCOL;
+
+//
+// Counters for one volume. Times are in ticks; TicksPerSecond converts them.
+//
+typedef struct {
+    UINT64  TicksPerSecond;         // 0 if the driver has no clock
+    UINT64  BlockCacheHits;
+    UINT64  BlockCacheMisses;
+    UINT64  BlockCacheEvictions;
+    UINT64  DeviceReads;
+    UINT64  DeviceReadBytes;
+    UINT64  DeviceReadTicks;
+    UINT64  GetExtentCalls;
+    UINT64  GetExtentTicks;
+    UINT64  DirLookupCalls;
+    UINT64  DirLookupTicks;
+    UINT64  DirReadCalls;
+    UINT64  DirReadTicks;
+    // Revision 2 and later
+    UINT64  BlockCacheLent;         // misses served from the host's disk cache
+    UINT64  BlockCacheBudgetEvictions;
+    UINT64  BlockCacheShrinkFrees;
+    UINT64  BlockCacheReadaheadBlocks;
+    UINT64  NegativeCacheLookups;
+    UINT64  NegativeCacheHits;
+    UINT64  BulkReads;
+    UINT64  BulkReadBytes;
+    UINT64  ReadaheadReads;
+    UINT64  ReadaheadUsefulBytes;
+    UINT64  ReadaheadWastedBytes;
+    UINT64  ExtentLookups;
+    UINT64  ExtentBatches;
+    UINT64  DnodeAllocs;
+    UINT64  DnodeChunks;
+    UINT64  NameAllocs;
+    UINT64  NameChunks;
+    UINT64  NameRollbacks;
+} FSW_VOLUME_STATS;
+
+//
+// Copy the current counters of the volume into *Stats.
+//
+typedef
+EFI_STATUS
+(EFIAPI *FSW_STATS_GET_STATS) (
+  IN  FSW_STATS_PROTOCOL  *This,
+  OUT FSW_VOLUME_STATS    *Stats
+  );
+
+struct _FSW_STATS_PROTOCOL {
+    UINT64               Revision;
+    CHAR16               *DriverName;   // e.g. L"ext4"
+    FSW_STATS_GET_STATS  GetStats;
+};
+
+#endif
@@ -766,6 +766,12 @@ VOID ReadConfig(CHAR16 *FileName)
 
         } else if (MyStriCmp(TokenList[0], L"enable_touch")) {
            GlobalConfig.EnableTouch = HandleBoolean(TokenList, TokenCount);
+
+        } else if (MyStriCmp(TokenList[0], L"driver_probe")) {
+           GlobalConfig.ProbeDrivers = HandleBoolean(TokenList, TokenCount);
+
+        } else if (MyStriCmp(TokenList[0], L"connect_partitions_only")) {
+           GlobalConfig.ConnectPartitionsOnly = HandleBoolean(TokenList, TokenCount);
         }
 
         FreeTokenLine(&TokenList, &TokenCount);
@@ -780,6 +786,37 @@ VOID ReadConfig(CHAR16 *FileName)
     }
 } /* VOID ReadConfig() */
 
+// Read the options that LoadDrivers() needs. Drivers are loaded before
+// ScanVolumes() and hence before ReadConfig(), so the full configuration
+// file isn't available yet at that point. Included files aren't followed.
+VOID ReadDriverConfig(CHAR16 *FileName)
+{
+    EFI_STATUS      Status;
+    REFIT_FILE      File;
+    CHAR16          **TokenList;
+    UINTN           TokenCount, i;
+
+    if (!FileExists(SelfDir, FileName))
+        return;
+    Status = ReadFile(SelfDir, FileName, &File, &i);
+    if (EFI_ERROR(Status))
+        return;
+
+    for (;;) {
+        TokenCount = ReadTokenLine(&File, &TokenList);
+        if (TokenCount == 0)
+            break;
+
+        if (MyStriCmp(TokenList[0], L"driver_probe"))
+           GlobalConfig.ProbeDrivers = HandleBoolean(TokenList, TokenCount);
+        else if (MyStriCmp(TokenList[0], L"connect_partitions_only"))
+           GlobalConfig.ConnectPartitionsOnly = HandleBoolean(TokenList, TokenCount);
+
+        FreeTokenLine(&TokenList, &TokenCount);
+    }
+    MyFreePool(File.Buffer);
+} /* VOID ReadDriverConfig() */
+
 // Finds a volume with the specified Identifier (a filesystem label, a
 // partition name, a partition GUID, or a number followed by a colon). If
 // found, sets *Volume to point to that volume. If not, leaves it unchanged.
@@ -85,6 +85,8 @@
 #define DRIVER_DIRS             L"drivers"
 #endif
 
+DRIVER_TIMES gDriverTimes;
+
 #ifdef __MAKEWITH_GNUEFI
 // Following "global" constants are from EDK2's AutoGen.c....
 EFI_GUID gEfiLoadedImageProtocolGuid = { 0x5B1B31A1, 0x9562, 0x11D2, { 0x8E, 0x3F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B }};
@@ -533,9 +535,170 @@ VOID ConnectFilesystemDriver(EFI_HANDLE DriverHandle) {
     FreePool(Handles);
 } // VOID ConnectFilesystemDriver()
 
-// Scan a directory for drivers.
+// Filesystem signatures for the "driver_probe" option. Name is the part of
+// a driver's file name before its first '_' or '.', as in ext4_x64.efi.
+typedef struct {
+    CHAR16  *Name;
+    UINTN   Offset;
+    UINTN   Length;
+    CHAR8   *Signature;
+} FS_SIGNATURE;
+
+static FS_SIGNATURE FsSignatures[] = {
+    { L"ext4",     1024 + 56,  2, (CHAR8 *) "\x53\xEF" },
+    { L"ext2",     1024 + 56,  2, (CHAR8 *) "\x53\xEF" },
+    { L"reiserfs", 65536 + 52, 8, (CHAR8 *) "ReIsErFs" },
+    { L"reiserfs", 65536 + 52, 9, (CHAR8 *) "ReIsEr2Fs" },
+    { L"reiserfs", 65536 + 52, 9, (CHAR8 *) "ReIsEr3Fs" },
+    { L"reiserfs", 8192 + 52,  8, (CHAR8 *) "ReIsErFs" },
+    { L"btrfs",    65536 + 64, 8, (CHAR8 *) "_BHRfS_M" },
+    { L"hfs",      1024,       2, (CHAR8 *) "H+" },
+    { L"hfs",      1024,       2, (CHAR8 *) "HX" },
+    { L"hfs",      1024,       2, (CHAR8 *) "BD" },
+    { L"iso9660",  32768 + 1,  5, (CHAR8 *) "CD001" },
+    { L"ntfs",     3,          8, (CHAR8 *) "NTFS    " }
+};
+
+#define NUM_FS_SIGNATURES (sizeof(FsSignatures) / sizeof(FS_SIGNATURE))
+
+// Bytes at the start of a partition that hold all the signatures above.
+#define PROBE_SIZE (128 * 1024)
+
+// The combined driver (all_{arch}.efi) handles every signature above.
+#define ALL_FS_DRIVER_NAME L"all"
+
+// What ProbeFilesystems() found: which signatures were seen, and the
+// partitions that carry one of them. Probed is FALSE if it wasn't run.
+typedef struct {
+    BOOLEAN     Probed;
+    BOOLEAN     Seen[NUM_FS_SIGNATURES];
+    BOOLEAN     AnySeen;
+    UINTN       HandleCount;
+    EFI_HANDLE  *Handles;
+    BOOLEAN     LoadedOther;   // a driver that isn't a filesystem driver was loaded
+} FS_PROBE;
+
+// Read the start of every partition that doesn't have a filesystem yet, once,
+// and note which of the FsSignatures it carries. Returns FALSE if there's
+// nothing to go on, in which case all drivers should be loaded and connected
+// as usual. That includes the case where a partition can't be read: what's on
+// it is unknown, so it might need any of the drivers.
+static BOOLEAN ProbeFilesystems(OUT FS_PROBE *Probe) {
+    EFI_STATUS                        Status;
+    UINTN                             HandleCount = 0, Index, i;
+    UINTN                             ProbeSize;
+    UINT64                            MediaSize;
+    EFI_HANDLE                        *Handles = NULL;
+    EFI_BLOCK_IO_PROTOCOL             *BlockIo;
+    EFI_DISK_IO                       *DiskIo;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL   *Fs;
+    UINT8                             *Buffer;
+    BOOLEAN                           Matched, Unknown = FALSE;
+
+    ZeroMem(Probe, sizeof(FS_PROBE));
+    Status = refit_call5_wrapper(gBS->LocateHandleBuffer, ByProtocol, &gEfiDiskIoProtocolGuid, NULL,
+                                 &HandleCount, &Handles);
+    if (EFI_ERROR(Status) || HandleCount == 0)
+        return FALSE;
+    Probe->Handles = AllocatePool(HandleCount * sizeof(EFI_HANDLE));
+    Buffer = AllocatePool(PROBE_SIZE);
+    if ((Probe->Handles == NULL) || (Buffer == NULL)) {
+        MyFreePool(Probe->Handles);
+        MyFreePool(Buffer);
+        FreePool(Handles);
+        Probe->Handles = NULL;
+        return FALSE;
+    }
+
+    for (Index = 0; Index < HandleCount; Index++) {
+        Status = refit_call3_wrapper(gBS->HandleProtocol, Handles[Index], &gEfiSimpleFileSystemProtocolGuid,
+                                     (VOID **) &Fs);
+        if (Status == EFI_SUCCESS)
+            continue;   // the firmware or an earlier driver already handles this one
+        Status = refit_call3_wrapper(gBS->HandleProtocol, Handles[Index], &gEfiBlockIoProtocolGuid,
+                                     (VOID **) &BlockIo);
+        if (EFI_ERROR(Status) || (BlockIo->Media == NULL)) {
+            Unknown = TRUE;
+            break;
+        }
+        if (!BlockIo->Media->MediaPresent)
+            continue;   // nothing there to mount
+        Status = refit_call3_wrapper(gBS->HandleProtocol, Handles[Index], &gEfiDiskIoProtocolGuid,
+                                     (VOID **) &DiskIo);
+        if (EFI_ERROR(Status)) {
+            Unknown = TRUE;
+            break;
+        }
+
+        // Disk I/O reads at any offset into any buffer, so neither the block
+        // size nor the device's buffer alignment matters here.
+        ProbeSize = PROBE_SIZE;
+        MediaSize = MultU64x32(BlockIo->Media->LastBlock + 1, BlockIo->Media->BlockSize);
+        if (MediaSize < PROBE_SIZE)
+            ProbeSize = (UINTN) MediaSize;
+        if (ProbeSize == 0)
+            continue;
+        SetMem(Buffer, PROBE_SIZE, 0);
+        Status = refit_call5_wrapper(DiskIo->ReadDisk, DiskIo, BlockIo->Media->MediaId, 0, ProbeSize, Buffer);
+        if (EFI_ERROR(Status)) {
+            Unknown = TRUE;
+            break;
+        }
+
+        Matched = FALSE;
+        for (i = 0; i < NUM_FS_SIGNATURES; i++) {
+            if ((FsSignatures[i].Offset + FsSignatures[i].Length <= ProbeSize) &&
+                (CompareMem(Buffer + FsSignatures[i].Offset, FsSignatures[i].Signature,
+                            FsSignatures[i].Length) == 0)) {
+                Probe->Seen[i] = TRUE;
+                Probe->AnySeen = TRUE;
+                Matched = TRUE;
+            } // if
+        } // for
+        if (Matched)
+            Probe->Handles[Probe->HandleCount++] = Handles[Index];
+    } // for
+
+    FreePool(Buffer);
+    FreePool(Handles);
+    if (Unknown) {
+        MyFreePool(Probe->Handles);
+        ZeroMem(Probe, sizeof(FS_PROBE));
+        return FALSE;
+    }
+    Probe->Probed = TRUE;
+    return TRUE;
+} // static BOOLEAN ProbeFilesystems()
+
+// Decide whether to load the driver in FileName, given what ProbeFilesystems()
+// found. Drivers that aren't for a filesystem in FsSignatures are always loaded,
+// and so is everything if there was no probe.
+static BOOLEAN WantDriver(IN CHAR16 *FileName, IN OUT FS_PROBE *Probe) {
+    CHAR16      Name[256];
+    UINTN       i;
+    BOOLEAN     IsFsDriver = FALSE;
+
+    for (i = 0; (i < 255) && (FileName[i] != L'\0') && (FileName[i] != L'_') && (FileName[i] != L'.'); i++)
+        Name[i] = FileName[i];
+    Name[i] = L'\0';
+
+    if (MyStriCmp(Name, ALL_FS_DRIVER_NAME))
+        return !Probe->Probed || Probe->AnySeen;
+    for (i = 0; i < NUM_FS_SIGNATURES; i++) {
+        if (MyStriCmp(Name, FsSignatures[i].Name)) {
+            IsFsDriver = TRUE;
+            if (Probe->Seen[i])
+                return TRUE;
+        } // if
+    } // for
+    if (!IsFsDriver)
+        Probe->LoadedOther = TRUE;
+    return !IsFsDriver || !Probe->Probed;
+} // static BOOLEAN WantDriver()
+
+// Scan a directory for drivers, loading those that WantDriver() accepts.
 // Originally from rEFIt's main.c (BSD), but modified since then (GPLv3).
-static UINTN ScanDriverDir(IN CHAR16 *Path)
+static UINTN ScanDriverDir(IN CHAR16 *Path, IN OUT FS_PROBE *Probe)
 {
     EFI_STATUS              Status;
     REFIT_DIR_ITER          DirIter;
@@ -549,6 +712,8 @@ static UINTN ScanDriverDir(IN CHAR16 *Path)
     while (DirIterNext(&DirIter, 2, LOADER_MATCH_PATTERNS, &DirEntry)) {
         if (DirEntry->FileName[0] == '.')
             continue;   // skip this
+        if (!WantDriver(DirEntry->FileName, Probe))
+            continue;   // no partition needs it
 
         SPrint(FileName, 255, L"%s\\%s", Path, DirEntry->FileName);
         NumFound++;
@@ -564,13 +729,111 @@ static UINTN ScanDriverDir(IN CHAR16 *Path)
 } // static UINTN ScanDriverDir()
 
 
+// Returns TRUE if the partition driver has produced partitions on the disk
+// in Handle, which it does by opening the disk's DiskIo for each of them.
+static BOOLEAN HasPartitionChildren(IN EFI_HANDLE Handle) {
+    EFI_STATUS                            Status;
+    EFI_OPEN_PROTOCOL_INFORMATION_ENTRY   *OpenInfo;
+    UINTN                                 OpenInfoCount, OpenInfoIndex;
+    BOOLEAN                               HasChildren = FALSE;
+
+    Status = refit_call4_wrapper(gBS->OpenProtocolInformation, Handle, &gEfiDiskIoProtocolGuid,
+                                 &OpenInfo, &OpenInfoCount);
+    if (EFI_ERROR(Status))
+        return FALSE;
+    for (OpenInfoIndex = 0; OpenInfoIndex < OpenInfoCount; OpenInfoIndex++) {
+        if (OpenInfo[OpenInfoIndex].Attributes & EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER)
+            HasChildren = TRUE;
+    } // for
+    FreePool(OpenInfo);
+    return HasChildren;
+} // static BOOLEAN HasPartitionChildren()
+
+// Connect every partition that has DiskIo but no SimpleFileSystem yet, which
+// is all that freshly loaded filesystem drivers can bind to. Whole disks
+// without partitions, such as an ISO-9660 image on an optical disc or a
+// USB flash drive formatted as a "superfloppy," count as partitions here.
+// Returns the number of handles connected.
+static UINTN ConnectPartitions(VOID) {
+    EFI_STATUS                        Status;
+    UINTN                             HandleCount = 0, Index, NumConnected = 0;
+    EFI_HANDLE                        *Handles = NULL;
+    EFI_BLOCK_IO_PROTOCOL             *BlockIo;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL   *Fs;
+
+    Status = refit_call5_wrapper(gBS->LocateHandleBuffer, ByProtocol, &gEfiDiskIoProtocolGuid, NULL,
+                                 &HandleCount, &Handles);
+    if (EFI_ERROR(Status) || HandleCount == 0)
+        return 0;
+
+    for (Index = 0; Index < HandleCount; Index++) {
+        Status = refit_call3_wrapper(gBS->HandleProtocol, Handles[Index], &gEfiBlockIoProtocolGuid,
+                                     (VOID **) &BlockIo);
+        if (EFI_ERROR(Status) || (BlockIo->Media == NULL))
+            continue;
+        if (!BlockIo->Media->LogicalPartition && HasPartitionChildren(Handles[Index]))
+            continue;
+        Status = refit_call3_wrapper(gBS->HandleProtocol, Handles[Index], &gEfiSimpleFileSystemProtocolGuid,
+                                     (VOID **) &Fs);
+        if (Status == EFI_SUCCESS)
+            continue;
+        refit_call4_wrapper(gBS->ConnectController, Handles[Index], NULL, NULL, FALSE);
+        NumConnected++;
+    } // for
+    FreePool(Handles);
+    return NumConnected;
+} // static UINTN ConnectPartitions()
+
+// Time stamps for the About screen's driver timings, in CPU cycles or
+// counter ticks; 0 where there's no such counter.
+static UINT64 ReadTicks(VOID) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return (UINT64) __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    UINT64 Value;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (Value));
+    return Value;
+#else
+    return 0;
+#endif
+} // static UINT64 ReadTicks()
+
+// Convert a number of ticks to microseconds, calibrating ReadTicks() against
+// the firmware's Stall() the first time.
+static UINTN TicksToMicroseconds(IN UINT64 Ticks) {
+    static UINT64   TicksPerMicrosecond = 0;
+    UINT64          Start;
+
+    if (TicksPerMicrosecond == 0) {
+        Start = ReadTicks();
+        refit_call1_wrapper(gBS->Stall, 1000);
+        TicksPerMicrosecond = (ReadTicks() - Start) / 1000;
+        if (TicksPerMicrosecond == 0)
+            return 0;
+    }
+    return (UINTN) (Ticks / TicksPerMicrosecond);
+} // static UINTN TicksToMicroseconds()
+
 // Load all EFI drivers from rEFInd's "drivers" subdirectory and from the
 // directories specified by the user in the "scan_driver_dirs" configuration
-// file line.
+// file line. With "driver_probe", filesystem drivers are loaded only if a
+// partition carries their signature, and only those partitions are connected.
+// With "connect_partitions_only", filesystem drivers are connected only to
+// partitions that don't have a filesystem yet. Either way, loading any other
+// kind of driver connects all devices, as before.
 // Originally from rEFIt's main.c (BSD), but modified since then (GPLv3).
 VOID LoadDrivers(VOID) {
     CHAR16        *Directory, *SelfDirectory;
     UINTN         i = 0, Length, NumFound = 0;
+    FS_PROBE      Probe;
+    UINT64        Start;
+
+    ZeroMem(&gDriverTimes, sizeof(DRIVER_TIMES));
+    Start = ReadTicks();
+    ZeroMem(&Probe, sizeof(FS_PROBE));
+    if (GlobalConfig.ProbeDrivers)
+        ProbeFilesystems(&Probe);
 
     // load drivers from the subdirectories of rEFInd's home directory specified
     // in the DRIVER_DIRS constant.
@@ -578,7 +841,7 @@ VOID LoadDrivers(VOID) {
         SelfDirectory = SelfDirPath ? StrDuplicate(SelfDirPath) : NULL;
         CleanUpPathNameSlashes(SelfDirectory);
         MergeStrings(&SelfDirectory, Directory, L'\\');
-        NumFound += ScanDriverDir(SelfDirectory);
+        NumFound += ScanDriverDir(SelfDirectory, &Probe);
         MyFreePool(Directory);
         MyFreePool(SelfDirectory);
     }
@@ -589,12 +852,27 @@ VOID LoadDrivers(VOID) {
         CleanUpPathNameSlashes(Directory);
         Length = StrLen(Directory);
         if (Length > 0) {
-            NumFound += ScanDriverDir(Directory);
+            NumFound += ScanDriverDir(Directory, &Probe);
         } // if
         MyFreePool(Directory);
     } // while
-
-    // connect all devices
-    if (NumFound > 0)
-        ConnectAllDriversToAllControllers();
+    gDriverTimes.NumLoaded = NumFound;
+    gDriverTimes.LoadMicroseconds = TicksToMicroseconds(ReadTicks() - Start);
+
+    // connect all devices, or just the partitions that filesystem drivers can use
+    if (NumFound > 0) {
+        Start = ReadTicks();
+        if (Probe.Probed && !Probe.LoadedOther) {
+            for (i = 0; i < Probe.HandleCount; i++)
+                refit_call4_wrapper(gBS->ConnectController, Probe.Handles[i], NULL, NULL, FALSE);
+            gDriverTimes.NumConnected = Probe.HandleCount;
+        } else if (GlobalConfig.ConnectPartitionsOnly && !Probe.LoadedOther) {
+            gDriverTimes.NumConnected = ConnectPartitions();
+        } else {
+            ConnectAllDriversToAllControllers();
+            gDriverTimes.ConnectedAll = TRUE;
+        } // if/else
+        gDriverTimes.ConnectMicroseconds = TicksToMicroseconds(ReadTicks() - Start);
+    } // if
+    MyFreePool(Probe.Handles);
 } /* VOID LoadDrivers() */
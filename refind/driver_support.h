@@ -52,6 +52,17 @@ LibScanHandleDatabase (
   EFI_HANDLE  **HandleBuffer,
   UINT32      **HandleType
   );
+// How long LoadDrivers() took, for the About screen
+typedef struct {
+    UINTN    NumLoaded;
+    UINTN    NumConnected;          // partitions connected, if not ConnectedAll
+    BOOLEAN  ConnectedAll;          // connected every controller
+    UINTN    LoadMicroseconds;      // 0 if unknown
+    UINTN    ConnectMicroseconds;
+} DRIVER_TIMES;
+
+extern DRIVER_TIMES gDriverTimes;
+
 EFI_STATUS ConnectAllDriversToAllControllers(VOID);
 VOID ConnectFilesystemDriver(EFI_HANDLE DriverHandle);
 VOID LoadDrivers(VOID);
@@ -313,6 +313,8 @@ typedef struct {
    BOOLEAN          EnableAndLockVMX;
    BOOLEAN          FoldLinuxKernels;
    BOOLEAN          EnableTouch;
+   BOOLEAN          ProbeDrivers;
+   BOOLEAN          ConnectPartitionsOnly;
    UINTN            RequestedScreenWidth;
    UINTN            RequestedScreenHeight;
    UINTN            BannerBottomEdge;
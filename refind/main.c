@@ -70,6 +70,7 @@
 #include "driver_support.h"
 #include "../include/Handle.h"
 #include "../include/refit_call_wrapper.h"
+#include "../include/FswStats.h"
 #include "../EfiLib/BdsHelper.h"
 #include "../EfiLib/legacy.h"
 
@@ -147,6 +148,10 @@ EFI_GUID gFreedesktopRootGuid = { 0x69dad710, 0x2ce4, 0x4e3c, { 0xb1, 0x6c, 0x21
 // Maximum length of a text string in certain menus
 #define MAX_LINE_LENGTH 65
 
+// Limits for the filesystem driver lines on the About screen
+#define FSW_STATS_MAX_VOLUMES 6
+#define FSW_STATS_NAME_LENGTH 16
+
 static REFIT_MENU_ENTRY MenuEntryAbout    = { L"About rEFInd", TAG_ABOUT, 1, 0, 'A', NULL, NULL, NULL };
 static REFIT_MENU_ENTRY MenuEntryReset    = { L"Reboot Computer", TAG_REBOOT, 1, 0, 'R', NULL, NULL, NULL };
 static REFIT_MENU_ENTRY MenuEntryShutdown = { L"Shut Down Computer", TAG_SHUTDOWN, 1, 0, 'U', NULL, NULL, NULL };
@@ -159,8 +164,9 @@ REFIT_MENU_SCREEN MainMenu       = { L"Main Menu", NULL, 0, NULL, 0, NULL, 0, L"
                                      L"Use arrow keys to move cursor; Enter to boot;",
                                      L"Insert, Tab, or F2 for more options; Esc or Backspace to refresh" };
 static REFIT_MENU_SCREEN AboutMenu      = { L"About", NULL, 0, NULL, 0, NULL, 0, NULL, L"Press Enter to return to main menu", L"" };
+static UINTN             AboutStaticLines = 0; // About screen lines kept from one visit to the next
 
-REFIT_CONFIG GlobalConfig = { FALSE, TRUE, FALSE, FALSE, TRUE, FALSE, 0, 0, 0, DONT_CHANGE_TEXT_MODE,
+REFIT_CONFIG GlobalConfig = { FALSE, TRUE, FALSE, FALSE, TRUE, FALSE, FALSE, FALSE, 0, 0, 0, DONT_CHANGE_TEXT_MODE,
                               20, 0, 0, GRAPHICS_FOR_OSX, LEGACY_TYPE_MAC,
                               0, 0, { DEFAULT_BIG_ICON_SIZE / 4, DEFAULT_SMALL_ICON_SIZE, DEFAULT_BIG_ICON_SIZE },
                               BANNER_NOSCALE, NULL, NULL, NULL, NULL, CONFIG_FILE_NAME, NULL, NULL, NULL, NULL,
@@ -172,6 +178,7 @@ REFIT_CONFIG GlobalConfig = { FALSE, TRUE, FALSE, FALSE, TRUE, FALSE, 0, 0, 0, D
 
 EFI_GUID GlobalGuid = EFI_GLOBAL_VARIABLE;
 EFI_GUID RefindGuid = REFIND_GUID_VALUE;
+static EFI_GUID FswStatsGuid = FSW_STATS_PROTOCOL_GUID;
 
 GPT_DATA *gPartitions = NULL;
 
@@ -187,10 +194,106 @@ struct LOADER_LIST {
 // misc functions
 //
 
+// Convert a time in ticks, as reported by a filesystem driver, to milliseconds.
+static UINT64 TicksToMs(UINT64 Ticks, UINT64 TicksPerSecond) {
+    if (TicksPerSecond < 1000)
+        return 0;
+    return Ticks / (TicksPerSecond / 1000);
+} // UINT64 TicksToMs()
+
+// Add lines to the About screen that say how long loading and connecting
+// drivers took at startup.
+static VOID AddDriverTimesLines(REFIT_MENU_SCREEN *Menu) {
+    if (gDriverTimes.NumLoaded == 0)
+        return;
+
+    AddMenuInfoLine(Menu, PoolPrint(L"Drivers: %d loaded in %d.%03d ms", gDriverTimes.NumLoaded,
+                                    gDriverTimes.LoadMicroseconds / 1000, gDriverTimes.LoadMicroseconds % 1000));
+    if (gDriverTimes.ConnectedAll) {
+        AddMenuInfoLine(Menu, PoolPrint(L" all controllers connected in %d.%03d ms",
+                                        gDriverTimes.ConnectMicroseconds / 1000, gDriverTimes.ConnectMicroseconds % 1000));
+    } else {
+        AddMenuInfoLine(Menu, PoolPrint(L" %d partitions connected in %d.%03d ms", gDriverTimes.NumConnected,
+                                        gDriverTimes.ConnectMicroseconds / 1000, gDriverTimes.ConnectMicroseconds % 1000));
+    }
+    AddMenuInfoLine(Menu, L"");
+} // VOID AddDriverTimesLines()
+
+// Return a short name for the volume on which a filesystem driver's statistics
+// protocol is installed, for the About screen: the volume's label if rEFInd
+// scanned it, otherwise its position in the list of driver volumes.
+static CHAR16 *FswStatsVolumeName(EFI_HANDLE Handle, UINTN HandleIndex) {
+    CHAR16  *Name = NULL;
+    UINTN   VolumeIndex;
+
+    for (VolumeIndex = 0; VolumeIndex < VolumesCount; VolumeIndex++) {
+        if (Volumes[VolumeIndex]->DeviceHandle == Handle && Volumes[VolumeIndex]->VolName != NULL) {
+            Name = StrDuplicate(Volumes[VolumeIndex]->VolName);
+            break;
+        }
+    } // for
+    if (Name == NULL)
+        Name = PoolPrint(L"volume %d", HandleIndex + 1);
+    LimitStringLength(Name, FSW_STATS_NAME_LENGTH);
+    return Name;
+} // CHAR16 *FswStatsVolumeName()
+
+// Add a line to the About screen, cut short so that it fits on an 800x600 display.
+static VOID AddShortInfoLine(REFIT_MENU_SCREEN *Menu, CHAR16 *Line) {
+    if (Line == NULL)
+        return;
+    if (StrLen(Line) > MAX_LINE_LENGTH)
+        Line[MAX_LINE_LENGTH] = L'\0'; // not LimitStringLength(), which would eat the indentation
+    AddMenuInfoLine(Menu, Line);
+} // VOID AddShortInfoLine()
+
+// Add lines to the About screen that describe the work done by rEFInd's own
+// filesystem drivers, one pair of lines per volume they have mounted, for up
+// to FSW_STATS_MAX_VOLUMES volumes. All lines are allocated, so that the
+// caller can free them when the About screen is rebuilt.
+static VOID AddFswStatsLines(REFIT_MENU_SCREEN *Menu) {
+    EFI_STATUS           Status;
+    UINTN                HandleIndex, HandleCount = 0, Shown = 0;
+    EFI_HANDLE           *Handles;
+    FSW_STATS_PROTOCOL   *FswStats;
+    FSW_VOLUME_STATS     Stats;
+    CHAR16               *Name;
+
+    Status = LibLocateHandle(ByProtocol, &FswStatsGuid, NULL, &HandleCount, &Handles);
+    if (EFI_ERROR(Status) || HandleCount == 0)
+        return; // no rEFInd filesystem drivers loaded
+
+    AddMenuInfoLine(Menu, StrDuplicate(L"Filesystem drivers:"));
+    for (HandleIndex = 0; HandleIndex < HandleCount; HandleIndex++) {
+        if (Shown == FSW_STATS_MAX_VOLUMES) {
+            AddShortInfoLine(Menu, PoolPrint(L" (%d more volumes not shown)", HandleCount - HandleIndex));
+            break;
+        }
+        Status = refit_call3_wrapper(BS->HandleProtocol, Handles[HandleIndex], &FswStatsGuid, (VOID **) &FswStats);
+        if (EFI_ERROR(Status) || FswStats->Revision < FSW_STATS_PROTOCOL_REVISION)
+            continue;
+        Status = refit_call2_wrapper(FswStats->GetStats, FswStats, &Stats);
+        if (EFI_ERROR(Status))
+            continue;
+        Name = FswStatsVolumeName(Handles[HandleIndex], HandleIndex);
+        AddShortInfoLine(Menu, PoolPrint(L" %s on %s: %ld hits, %ld misses", FswStats->DriverName, Name,
+                                         Stats.BlockCacheHits, Stats.BlockCacheMisses));
+        MyFreePool(Name);
+        AddShortInfoLine(Menu, PoolPrint(L"  %ld reads, %ld KiB, %ld ms; %ld lookups, %ld ms",
+                                         Stats.DeviceReads, Stats.DeviceReadBytes / 1024,
+                                         TicksToMs(Stats.DeviceReadTicks, Stats.TicksPerSecond),
+                                         Stats.DirLookupCalls, TicksToMs(Stats.DirLookupTicks, Stats.TicksPerSecond)));
+        Shown++;
+    } // for
+    AddMenuInfoLine(Menu, StrDuplicate(L""));
+    MyFreePool(Handles);
+} // VOID AddFswStatsLines()
+
 static VOID AboutrEFInd(VOID)
 {
     CHAR16     *FirmwareVendor;
     UINT32     CsrStatus;
+    UINTN      i;
 
     if (AboutMenu.EntryCount == 0) {
         AboutMenu.TitleImage = BuiltinIcon(BUILTIN_ICON_FUNC_ABOUT);
@@ -225,16 +328,25 @@ static VOID AboutrEFInd(VOID)
                                               ST->FirmwareRevision & ((1 << 16) - 1)));
         AddMenuInfoLine(&AboutMenu, PoolPrint(L" Screen Output: %s", egScreenDescription()));
         AddMenuInfoLine(&AboutMenu, L"");
+        AddDriverTimesLines(&AboutMenu);
+        AboutStaticLines = AboutMenu.InfoLineCount;
+        AddMenuEntry(&AboutMenu, &MenuEntryReturn);
+    } else {
+        // drop the lines from the last visit; the driver counters have moved on since
+        for (i = AboutStaticLines; i < AboutMenu.InfoLineCount; i++)
+            MyFreePool(AboutMenu.InfoLines[i]);
+        AboutMenu.InfoLineCount = AboutStaticLines;
+    }
+
+    AddFswStatsLines(&AboutMenu);
 #if defined(__MAKEWITH_GNUEFI)
-        AddMenuInfoLine(&AboutMenu, L"Built with GNU-EFI");
+    AddMenuInfoLine(&AboutMenu, StrDuplicate(L"Built with GNU-EFI"));
 #else
-        AddMenuInfoLine(&AboutMenu, L"Built with TianoCore EDK2");
+    AddMenuInfoLine(&AboutMenu, StrDuplicate(L"Built with TianoCore EDK2"));
 #endif
-        AddMenuInfoLine(&AboutMenu, L"");
-        AddMenuInfoLine(&AboutMenu, L"For more information, see the rEFInd Web site:");
-        AddMenuInfoLine(&AboutMenu, L"http://www.rodsbooks.com/refind/");
-        AddMenuEntry(&AboutMenu, &MenuEntryReturn);
-    }
+    AddMenuInfoLine(&AboutMenu, StrDuplicate(L""));
+    AddMenuInfoLine(&AboutMenu, StrDuplicate(L"For more information, see the rEFInd Web site:"));
+    AddMenuInfoLine(&AboutMenu, StrDuplicate(L"http://www.rodsbooks.com/refind/"));
 
     RunMenu(&AboutMenu, NULL);
 } /* VOID AboutrEFInd() */
@@ -2098,6 +2210,7 @@ efi_main (EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
        CopyMem(GlobalConfig.ScanFor, "ihebocm   ", NUM_SCAN_OPTIONS);
     SetConfigFilename(ImageHandle);
     MokProtocol = SecureBootSetup();
+    ReadDriverConfig(GlobalConfig.ConfigFilename);
     LoadDrivers();
     ScanVolumes(); // Do before ReadConfig() because it needs SelfVolume->VolName
     ReadConfig(GlobalConfig.ConfigFilename);